@@ -0,0 +1,480 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "analyze.h"
+#include "disassemble.h"
+
+constexpr char AnalysisFileMagic[4] = {'X', '8', 'A', 'N'};
+constexpr uint32_t AnalysisFileVersion = 1;
+
+// Longest run of 1NNN words accepted as a BNNN jump table; V0 can index at most 128 two-byte entries
+constexpr int MaxJumpTableEntries = 128;
+
+uint64_t hashROM(const uint8_t *rom, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= rom[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+namespace {
+
+// The extension opcodes used by an instruction; its length and control
+// flow come from instructionShape().
+uint32_t extensionOpcodes(uint16_t instructionWord)
+{
+    uint8_t low = instructionWord & 0xFF;
+
+    switch(instructionWord >> 12) {
+        case 0x0: {
+            uint16_t sysOpcode = instructionWord & 0xFFF;
+            if(sysOpcode == 0x0FD) {
+                return EXT_EXIT;
+            } else if((sysOpcode == 0x0FB) || (sysOpcode == 0x0FC)) {
+                return EXT_SCROLL_RIGHT_LEFT;
+            } else if((sysOpcode == 0x0FE) || (sysOpcode == 0x0FF)) {
+                return EXT_SCREEN_MODE;
+            } else if((sysOpcode & 0xFF0) == 0x0C0) {
+                return EXT_SCROLL_DOWN;
+            } else if((sysOpcode & 0xFF0) == 0x0D0) {
+                return EXT_SCROLL_UP;
+            }
+            return 0;
+        }
+        case 0x5: {
+            uint8_t opcode = instructionWord & 0xF;
+            return ((opcode == 0x2) || (opcode == 0x3)) ? EXT_REGISTER_RANGE : 0;
+        }
+        case 0xD: return ((instructionWord & 0xF) == 0) ? (uint32_t)EXT_LARGE_SPRITE : 0;
+        case 0xF: {
+            if(instructionWord == 0xF000) {
+                return EXT_LONG_INDEX;
+            } else if(instructionWord == 0xF002) {
+                return EXT_AUDIO;
+            } else if(low == 0x01) {
+                return EXT_PLANES;
+            } else if(low == 0x30) {
+                return EXT_LARGE_DIGIT;
+            } else if((low == 0x75) || (low == 0x85)) {
+                return EXT_RPL_FLAGS;
+            }
+            return 0;
+        }
+        default: return 0;
+    }
+}
+
+struct Walker
+{
+    const uint8_t *rom;
+    size_t size;
+    ROMAnalysis& analysis;
+    std::vector<uint16_t> pending;
+
+    Walker(const uint8_t *rom, size_t size, ROMAnalysis& analysis) :
+        rom(rom),
+        size(size),
+        analysis(analysis)
+    {}
+
+    bool inROM(uint32_t addr, int length = 2) const
+    {
+        return (addr >= analysis.loadAddress) && (addr - analysis.loadAddress + length <= size);
+    }
+
+    uint16_t wordAt(uint32_t addr) const
+    {
+        uint32_t offset = addr - analysis.loadAddress;
+        return rom[offset] * 256 + rom[offset + 1];
+    }
+
+    int sizeAt(uint32_t addr) const
+    {
+        int size = instructionShape(wordAt(addr)).size;
+        return inROM(addr, size) ? size : 2;
+    }
+
+    void addSuccessor(uint32_t addr, uint8_t flag)
+    {
+        addr &= 0xFFFF;
+        if(!inROM(addr)) {
+            analysis.externalTargets.push_back(addr);
+            return;
+        }
+        analysis.flags[addr - analysis.loadAddress] |= ROMAnalysis::BLOCK_START | flag;
+        pending.push_back(addr);
+    }
+
+    // A BNNN target is resolvable if the instruction immediately before
+    // it in the same block loaded a constant into the index register, or
+    // if NNN starts a run of 1NNN jumps (the usual Octo "jump0" table), in
+    // which case every entry is a possible target.  The index register is
+    // V0, or VX for BXNN under the jump quirk; the analysis doesn't know
+    // the quirks, so a constant loaded into either one is accepted.
+    void resolveJumpV0(uint16_t pc, uint16_t instructionWord)
+    {
+        uint16_t base = instructionWord & 0xFFF;
+        uint16_t quirkLoad = 0x6000 | (instructionWord & 0x0F00);
+        uint32_t previous = pc - 2;
+        if(inROM(previous) && !(analysis.flags[pc - analysis.loadAddress] & ROMAnalysis::BLOCK_START) &&
+            (analysis.flags[previous - analysis.loadAddress] & ROMAnalysis::INSTRUCTION_START) &&
+            (((wordAt(previous) & 0xFF00) == 0x6000) || ((wordAt(previous) & 0xFF00) == quirkLoad))) {
+            uint16_t target = base + (wordAt(previous) & 0xFF);
+            analysis.jumpTables.push_back({pc, {target}});
+            addSuccessor(target, ROMAnalysis::JUMP_TABLE_ENTRY);
+            return;
+        }
+        ROMAnalysis::JumpTable table{pc, {}};
+        for(int i = 0; i < MaxJumpTableEntries; i++) {
+            uint32_t entry = base + i * 2;
+            if(!inROM(entry) || ((wordAt(entry) & 0xF000) != 0x1000)) {
+                break;
+            }
+            table.targets.push_back(entry);
+        }
+        if(table.targets.empty()) {
+            analysis.unresolvedJumps.push_back(pc);
+            return;
+        }
+        for(uint16_t target : table.targets) {
+            addSuccessor(target, ROMAnalysis::JUMP_TABLE_ENTRY);
+        }
+        analysis.jumpTables.push_back(std::move(table));
+    }
+
+    void walk()
+    {
+        while(!pending.empty()) {
+            uint32_t pc = pending.back();
+            pending.pop_back();
+
+            while(inROM(pc)) {
+                uint8_t& pcFlags = analysis.flags[pc - analysis.loadAddress];
+                if(pcFlags & ROMAnalysis::INSTRUCTION_START) {
+                    break;
+                }
+                uint16_t instructionWord = wordAt(pc);
+                InstructionShape insn = instructionShape(instructionWord);
+                if(!inROM(pc, insn.size)) {
+                    break;
+                }
+                pcFlags |= ROMAnalysis::INSTRUCTION_START;
+                for(int i = 0; i < insn.size; i++) {
+                    analysis.flags[pc - analysis.loadAddress + i] |= ROMAnalysis::CODE;
+                }
+                analysis.extensionOpcodes |= extensionOpcodes(instructionWord);
+
+                uint32_t next = pc + insn.size;
+                bool fallsThrough = true;
+                switch(insn.flow) {
+                    case FLOW_NEXT:
+                        break;
+                    case FLOW_SKIP:
+                        addSuccessor(next, 0);
+                        if(inROM(next)) {
+                            addSuccessor(next + sizeAt(next), 0);
+                        }
+                        fallsThrough = false;
+                        break;
+                    case FLOW_JUMP:
+                        addSuccessor(instructionWord & 0xFFF, 0);
+                        fallsThrough = false;
+                        break;
+                    case FLOW_CALL:
+                        addSuccessor(instructionWord & 0xFFF, ROMAnalysis::CALL_TARGET);
+                        analysis.callTargets.push_back(instructionWord & 0xFFF);
+                        addSuccessor(next, 0);
+                        fallsThrough = false;
+                        break;
+                    case FLOW_JUMP_V0:
+                        resolveJumpV0(pc, instructionWord);
+                        fallsThrough = false;
+                        break;
+                    case FLOW_RETURN:
+                    case FLOW_EXIT:
+                        fallsThrough = false;
+                        break;
+                }
+                if(!fallsThrough) {
+                    break;
+                }
+                pc = next;
+            }
+        }
+    }
+
+    // Split the reachable instructions into blocks.  A block ends at a
+    // control transfer or just before another block's first instruction.
+    void buildBlocks()
+    {
+        bool inBlock = false;
+        ROMAnalysis::BasicBlock block{0, 0};
+        for(size_t offset = 0; offset < size; offset++) {
+            uint8_t f = analysis.flags[offset];
+            if(!(f & ROMAnalysis::INSTRUCTION_START)) {
+                continue;
+            }
+            uint16_t pc = analysis.loadAddress + offset;
+            if(inBlock && ((f & ROMAnalysis::BLOCK_START) || (pc != block.end))) {
+                analysis.blocks.push_back(block);
+                inBlock = false;
+            }
+            if(!inBlock) {
+                analysis.flags[offset] |= ROMAnalysis::BLOCK_START;
+                block.start = pc;
+                inBlock = true;
+            }
+            InstructionShape insn = instructionShape(wordAt(pc));
+            block.end = pc + insn.size;
+            if(insn.flow != FLOW_NEXT) {
+                analysis.blocks.push_back(block);
+                inBlock = false;
+            }
+        }
+        if(inBlock) {
+            analysis.blocks.push_back(block);
+        }
+    }
+};
+
+void sortUnique(std::vector<uint16_t>& v)
+{
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+}
+
+}
+
+ROMAnalysis analyzeROM(const uint8_t *rom, size_t size, uint16_t loadAddress)
+{
+    ROMAnalysis analysis;
+    analysis.romHash = hashROM(rom, size);
+    analysis.loadAddress = loadAddress;
+    analysis.flags.resize(size, 0);
+
+    Walker walker(rom, size, analysis);
+    walker.addSuccessor(loadAddress, 0);
+    walker.walk();
+    walker.buildBlocks();
+
+    sortUnique(analysis.callTargets);
+    sortUnique(analysis.unresolvedJumps);
+    sortUnique(analysis.externalTargets);
+    std::sort(analysis.jumpTables.begin(), analysis.jumpTables.end(),
+        [](const ROMAnalysis::JumpTable& a, const ROMAnalysis::JumpTable& b) { return a.pc < b.pc; });
+
+    return analysis;
+}
+
+size_t ROMAnalysis::codeBytes() const
+{
+    return std::count_if(flags.begin(), flags.end(), [](uint8_t f) { return (f & CODE) != 0; });
+}
+
+void ROMAnalysis::print(FILE *fp) const
+{
+    static const char *extensionNames[] = {
+        "00Cn scroll down", "00FB/00FC scroll right/left", "00FD exit", "00FE/00FF screen mode",
+        "Dxy0 16x16 sprite", "Fx30 large digit", "Fx75/Fx85 RPL flags", nullptr,
+        "00Dn scroll up", "5xy2/5xy3 register range", "F000 long index", "Fn01 planes", "F002 audio",
+    };
+
+    fprintf(fp, "ROM %016llx: %zu bytes at %03X, %zu code, %zu data\n", (unsigned long long)romHash,
+        flags.size(), loadAddress, codeBytes(), flags.size() - codeBytes());
+    fprintf(fp, "%zu basic blocks, %zu call targets, %zu jump tables, %zu unresolved BNNN, %zu targets outside the ROM\n",
+        blocks.size(), callTargets.size(), jumpTables.size(), unresolvedJumps.size(), externalTargets.size());
+    for(uint16_t target : callTargets) {
+        fprintf(fp, "    call target %03X\n", target);
+    }
+    for(const auto& table : jumpTables) {
+        fprintf(fp, "    jump table at %03X: %zu targets\n", table.pc, table.targets.size());
+    }
+    for(uint16_t pc : unresolvedJumps) {
+        fprintf(fp, "    unresolved BNNN at %03X\n", pc);
+    }
+    for(uint16_t target : externalTargets) {
+        fprintf(fp, "    control transfer to %03X outside the ROM\n", target);
+    }
+    fprintf(fp, "extension opcodes:%s\n", (extensionOpcodes == 0) ? " none" : "");
+    for(int i = 0; i < (int)(sizeof(extensionNames) / sizeof(extensionNames[0])); i++) {
+        if((extensionOpcodes & (1u << i)) && (extensionNames[i] != nullptr)) {
+            fprintf(fp, "    %s (%s)\n", extensionNames[i], ((1u << i) & XOCHIPExtensionOpcodes) ? "XO-CHIP" : "SCHIP");
+        }
+    }
+}
+
+// Cache file layout, host byte order: magic, version, ROM hash, ROM size,
+// load address, extension opcodes, then flags (one byte per ROM byte),
+// blocks, call targets, jump tables, unresolved jumps, and external
+// targets, each vector preceded by a uint32_t count.
+
+std::string analysisCacheFilename(uint64_t romHash)
+{
+    std::string directory;
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if((xdg != nullptr) && (xdg[0] != '\0')) {
+        directory = xdg;
+    } else if(home != nullptr) {
+        directory = std::string(home) + "/.cache";
+    } else {
+        return "";
+    }
+    directory += "/xochip";
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.analysis", (unsigned long long)romHash);
+    return directory + name;
+}
+
+namespace {
+
+template <class T>
+bool writeVector(FILE *fp, const std::vector<T>& v)
+{
+    uint32_t count = v.size();
+    return (fwrite(&count, sizeof(count), 1, fp) == 1) && (fwrite(v.data(), sizeof(T), count, fp) == count);
+}
+
+template <class T>
+bool readVector(FILE *fp, std::vector<T>& v, uint32_t limit)
+{
+    uint32_t count;
+    if((fread(&count, sizeof(count), 1, fp) != 1) || (count > limit)) {
+        return false;
+    }
+    v.resize(count);
+    return fread(v.data(), sizeof(T), count, fp) == count;
+}
+
+struct AnalysisFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t romHash;
+    uint32_t romSize;
+    uint16_t loadAddress;
+    uint16_t reserved;
+    uint32_t extensionOpcodes;
+};
+
+}
+
+int saveAnalysis(const std::string& filename, const ROMAnalysis& analysis)
+{
+    std::string directory = filename.substr(0, filename.rfind('/'));
+    mkdir(directory.substr(0, directory.rfind('/')).c_str(), 0755);
+    mkdir(directory.c_str(), 0755);
+
+    // Write to a temporary of this process's own and rename so a concurrent
+    // reader never sees a partial file and concurrent writers don't collide
+    std::string temporary = filename + ".XXXXXX";
+    int fd = mkstemp(&temporary[0]);
+    if(fd < 0) {
+        return errno;
+    }
+    fchmod(fd, 0644);
+    FILE *fp = fdopen(fd, "wb");
+    if(fp == nullptr) {
+        int error = errno;
+        close(fd);
+        remove(temporary.c_str());
+        return error;
+    }
+    AnalysisFileHeader header;
+    memcpy(header.magic, AnalysisFileMagic, sizeof(header.magic));
+    header.version = AnalysisFileVersion;
+    header.romHash = analysis.romHash;
+    header.romSize = analysis.flags.size();
+    header.loadAddress = analysis.loadAddress;
+    header.reserved = 0;
+    header.extensionOpcodes = analysis.extensionOpcodes;
+    errno = 0;
+    bool success = (fwrite(&header, sizeof(header), 1, fp) == 1);
+    success = success && writeVector(fp, analysis.flags);
+    success = success && writeVector(fp, analysis.blocks);
+    success = success && writeVector(fp, analysis.callTargets);
+    uint32_t tableCount = analysis.jumpTables.size();
+    success = success && (fwrite(&tableCount, sizeof(tableCount), 1, fp) == 1);
+    for(const auto& table : analysis.jumpTables) {
+        success = success && (fwrite(&table.pc, sizeof(table.pc), 1, fp) == 1);
+        success = success && writeVector(fp, table.targets);
+    }
+    success = success && writeVector(fp, analysis.unresolvedJumps);
+    success = success && writeVector(fp, analysis.externalTargets);
+    // Keep the first failure's errno; a short write needn't set one
+    int error = success ? 0 : ((errno != 0) ? errno : EIO);
+    if((fclose(fp) != 0) && (error == 0)) {
+        error = errno;
+    }
+    if((error == 0) && (rename(temporary.c_str(), filename.c_str()) != 0)) {
+        error = errno;
+    }
+    if(error != 0) {
+        remove(temporary.c_str());
+    }
+    return error;
+}
+
+bool loadAnalysis(const std::string& filename, uint64_t romHash, size_t size, uint16_t loadAddress, ROMAnalysis& analysis)
+{
+    FILE *fp = fopen(filename.c_str(), "rb");
+    if(fp == nullptr) {
+        return false;
+    }
+    AnalysisFileHeader header;
+    bool success = (fread(&header, sizeof(header), 1, fp) == 1) &&
+        (memcmp(header.magic, AnalysisFileMagic, sizeof(header.magic)) == 0) &&
+        (header.version == AnalysisFileVersion) &&
+        (header.romHash == romHash) &&
+        (header.romSize == size) &&
+        (header.loadAddress == loadAddress);
+    if(success) {
+        analysis.romHash = header.romHash;
+        analysis.loadAddress = header.loadAddress;
+        analysis.extensionOpcodes = header.extensionOpcodes;
+    }
+    success = success && readVector(fp, analysis.flags, size) && (analysis.flags.size() == size);
+    success = success && readVector(fp, analysis.blocks, size);
+    success = success && readVector(fp, analysis.callTargets, size);
+    uint32_t tableCount = 0;
+    success = success && (fread(&tableCount, sizeof(tableCount), 1, fp) == 1) && (tableCount <= size);
+    analysis.jumpTables.resize(success ? tableCount : 0);
+    for(auto& table : analysis.jumpTables) {
+        success = success && (fread(&table.pc, sizeof(table.pc), 1, fp) == 1);
+        success = success && readVector(fp, table.targets, MaxJumpTableEntries);
+    }
+    success = success && readVector(fp, analysis.unresolvedJumps, size);
+    success = success && readVector(fp, analysis.externalTargets, size);
+    fclose(fp);
+    return success;
+}
+
+ROMAnalysis analyzeROMCached(const uint8_t *rom, size_t size, uint64_t romHash, uint16_t loadAddress, bool *wasCached)
+{
+    std::string filename = analysisCacheFilename(romHash);
+
+    ROMAnalysis analysis;
+    if(!filename.empty() && loadAnalysis(filename, romHash, size, loadAddress, analysis)) {
+        if(wasCached != nullptr) {
+            *wasCached = true;
+        }
+        return analysis;
+    }
+
+    analysis = analyzeROM(rom, size, loadAddress);
+    int error = filename.empty() ? 0 : saveAnalysis(filename, analysis);
+    if(error != 0) {
+        fprintf(stderr, "couldn't write ROM analysis cache \"%s\": %s\n", filename.c_str(), strerror(error));
+    }
+    if(wasCached != nullptr) {
+        *wasCached = false;
+    }
+    return analysis;
+}
@@ -0,0 +1,90 @@
+#ifndef ANALYZE_H
+#define ANALYZE_H
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+#include <string>
+
+// Static control-flow analysis of a ROM.  Starting at the load address,
+// every reachable instruction is followed through jumps, calls, skips,
+// and resolvable BNNN jump tables, yielding basic blocks, call targets,
+// the code/data split, and the set of SCHIP and XO-CHIP opcodes used.
+// Analysis results are cached on disk keyed by a hash of the ROM.
+
+// FNV-1a 64-bit hash of the ROM image
+uint64_t hashROM(const uint8_t *rom, size_t size);
+
+enum ExtensionOpcode
+{
+    EXT_SCROLL_DOWN = 0x0001,           // 00Cn    SCHIP
+    EXT_SCROLL_RIGHT_LEFT = 0x0002,     // 00FB, 00FC    SCHIP
+    EXT_EXIT = 0x0004,                  // 00FD    SCHIP
+    EXT_SCREEN_MODE = 0x0008,           // 00FE, 00FF    SCHIP
+    EXT_LARGE_SPRITE = 0x0010,          // Dxy0    SCHIP
+    EXT_LARGE_DIGIT = 0x0020,           // Fx30    SCHIP
+    EXT_RPL_FLAGS = 0x0040,             // Fx75, Fx85    SCHIP
+    EXT_SCROLL_UP = 0x0100,             // 00Dn    XO-CHIP
+    EXT_REGISTER_RANGE = 0x0200,        // 5xy2, 5xy3    XO-CHIP
+    EXT_LONG_INDEX = 0x0400,            // F000 NNNN    XO-CHIP
+    EXT_PLANES = 0x0800,                // Fn01    XO-CHIP
+    EXT_AUDIO = 0x1000,                 // F002    XO-CHIP
+};
+
+constexpr uint32_t SCHIPExtensionOpcodes = 0x00FF;
+constexpr uint32_t XOCHIPExtensionOpcodes = 0xFF00;
+
+struct ROMAnalysis
+{
+    enum ByteFlags
+    {
+        CODE = 0x01,                    // byte is part of a reachable instruction
+        INSTRUCTION_START = 0x02,       // first byte of a reachable instruction
+        BLOCK_START = 0x04,             // first instruction of a basic block
+        CALL_TARGET = 0x08,             // target of a 2NNN call
+        JUMP_TABLE_ENTRY = 0x10,        // reached through a BNNN jump table
+    };
+
+    struct BasicBlock
+    {
+        uint16_t start;
+        uint16_t end;                   // address after the last instruction
+    };
+
+    struct JumpTable
+    {
+        uint16_t pc;                    // address of the BNNN instruction
+        std::vector<uint16_t> targets;
+    };
+
+    uint64_t romHash = 0;
+    uint16_t loadAddress = 0x200;
+    std::vector<uint8_t> flags;         // one per ROM byte
+    std::vector<BasicBlock> blocks;
+    std::vector<uint16_t> callTargets;
+    std::vector<JumpTable> jumpTables;
+    std::vector<uint16_t> unresolvedJumps;    // BNNN instructions whose targets weren't found
+    std::vector<uint16_t> externalTargets;    // control transfers outside the ROM image
+    uint32_t extensionOpcodes = 0;
+
+    bool isCode(uint16_t addr) const
+    {
+        return (addr >= loadAddress) && ((size_t)(addr - loadAddress) < flags.size()) && (flags[addr - loadAddress] & CODE);
+    }
+    size_t codeBytes() const;
+    void print(FILE *fp) const;
+};
+
+ROMAnalysis analyzeROM(const uint8_t *rom, size_t size, uint16_t loadAddress);
+
+// Return the cached analysis for this ROM (romHash is hashROM() of it) if present and current,
+// otherwise analyze it and try to write the cache.  The cache directory is
+// $XDG_CACHE_HOME/xochip or $HOME/.cache/xochip.
+ROMAnalysis analyzeROMCached(const uint8_t *rom, size_t size, uint64_t romHash, uint16_t loadAddress, bool *wasCached = nullptr);
+
+std::string analysisCacheFilename(uint64_t romHash);
+bool loadAnalysis(const std::string& filename, uint64_t romHash, size_t size, uint16_t loadAddress, ROMAnalysis& analysis);
+// Returns 0, or the errno value of the call that failed.
+int saveAnalysis(const std::string& filename, const ROMAnalysis& analysis);
+
+#endif /* ANALYZE_H */
@@ -0,0 +1,1705 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <algorithm>
+#include <map>
+#include <array>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cassert>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <numeric>
+#include <atomic>
+
+#include "disassemble.h"
+#include "trace.h"
+
+// The emulator core: clock, interpreter, memory, and the display, keypad,
+// and audio synthesis state it drives.  Shared by the xochip program and
+// libxochip; nothing here depends on a window or an audio device.
+
+typedef uint64_t clk_t;
+
+// System clock position with a binary fraction, for devices whose period
+// isn't a whole number of system clocks
+typedef unsigned __int128 clk_fixed_t;
+constexpr int ClockFractionBits = 32;
+
+struct Clock
+{
+    clk_t rate;
+    clk_t clocks;
+
+    Clock(clk_t rate) :
+        rate(rate),
+        clocks(0)
+    {}
+
+    Clock(const Clock& clock) :
+        rate(clock.rate), 
+        clocks(clock.clocks)
+    {}
+
+    Clock(const Clock& clock, clk_t newClocks) :
+        rate(clock.rate), 
+        clocks(newClocks)
+    {}
+
+    Clock& operator=(const Clock& clock)
+    {
+        clocks = clock.clocks;
+        rate = clock.rate;
+        return *this;
+    }
+
+    Clock& operator+=(clk_t inc)
+    {
+        clocks += inc;
+        return *this;
+    }
+
+    Clock operator+(clk_t inc) const
+    {
+        return Clock(rate, clocks + inc);
+    }
+
+    // operator clk_t() const { return clocks; }
+};
+
+constexpr int FieldsPerSecond = 60;
+constexpr int Chip8TimerFrequency = 60;
+
+// The system clock runs at a fixed rate that doesn't depend on the CPU or
+// audio rates.  The CPU, the timers, and audio output each keep the time of
+// their next event as a clk_fixed_t and add a period computed once by
+// clockPeriod() when their rate is set, so any rate works, rates can change
+// while running, and stepping time needs no division.  The rate is a
+// multiple of the field rate and of the common audio rates, whose periods
+// are then exact.
+constexpr clk_t SystemClockRate = 28224000;     // 640 * 44100, 588 * 48000
+constexpr clk_t SystemClocksPerField = SystemClockRate / FieldsPerSecond;
+static_assert(SystemClockRate % FieldsPerSecond == 0, "a field must be a whole number of system clocks");
+
+inline clk_fixed_t fixedClock(clk_t clock)
+{
+    return (clk_fixed_t)clock << ClockFractionBits;
+}
+
+// The period of something happening rate times a second
+inline clk_fixed_t clockPeriod(uint64_t rate)
+{
+    return fixedClock(SystemClockRate) / rate;
+}
+
+// The first whole system clock at or after time
+inline clk_t clockAtOrAfter(clk_fixed_t time)
+{
+    return (clk_t)((time + fixedClock(1) - 1) >> ClockFractionBits);
+}
+
+// Advance time by whole steps until it falls on or after clock
+inline clk_fixed_t stepToClock(clk_fixed_t time, clk_fixed_t step, clk_t clock)
+{
+    if(clockAtOrAfter(time) < clock) {
+        clk_fixed_t limit = fixedClock(clock - 1);
+        time += ((limit - time) / step + 1) * step;
+    }
+    return time;
+}
+
+constexpr int XOChipAudioSampleRate = 4000;
+constexpr int XOChipAudioSampleSamples = 128;
+constexpr int XOChipAudioSampleSize = XOChipAudioSampleSamples / 8;
+
+constexpr int DEBUG_STATE = 0x01;
+constexpr int DEBUG_ASM = 0x02;
+constexpr int DEBUG_DRAW = 0x04;
+constexpr int DEBUG_FAIL_UNSUPPORTED_INSN = 0x08;
+constexpr int DEBUG_KEYS = 0x10;
+constexpr int DEBUG_AUDIO = 0x20;
+constexpr int DEBUG_TIMING = 0x40;
+
+constexpr uint32_t QUIRKS_NONE = 0x00;
+constexpr uint32_t QUIRKS_SHIFT = 0x01;           /* shift VX instead of VY */
+constexpr uint32_t QUIRKS_LOAD_STORE = 0x02;      /* don't add X + 1 to I */
+constexpr uint32_t QUIRKS_JUMP = 0x04;            /* VX is used as offset *and* X used as address high nybble */
+constexpr uint32_t QUIRKS_CLIP = 0x08;            /* no draw or collide wrapped, VX += rows off bottom */
+constexpr uint32_t QUIRKS_VFORDER = 0x10;         /* VF is set first in ADD, SUB, SH ALU operations */
+constexpr uint32_t QUIRKS_LOGIC = 0x20;           /* VF is cleared after logic ALU operations */
+constexpr uint32_t QUIRKS_VBLANK = 0x40;          /* Dxyn waits for the next field */
+
+enum ChipPlatform
+{
+    CHIP8,
+    SCHIP_1_1,
+    XOCHIP
+};
+
+// Per-opcode-class execution counts and times for --stats.  Only built
+// with XOCHIP_STATS defined; otherwise every hook is an empty inline
+// function and the interpreter carries no instrumentation at all.
+#ifdef XOCHIP_STATS
+
+struct ExecutionStatistics
+{
+    typedef std::chrono::steady_clock::time_point Timestamp;
+
+    // Counters are indexed by the instruction word with its operand
+    // nybbles masked off, except those that distinguish interesting
+    // variants (Dxyn height, Fx55/Fx65 length).
+    std::vector<uint64_t> counts = std::vector<uint64_t>(65536, 0);
+    std::vector<uint64_t> nanoseconds = std::vector<uint64_t>(65536, 0);
+    uint64_t instructions = 0;
+    uint64_t scrolls = 0;
+    uint64_t clears = 0;
+    uint64_t keyWaitStallCycles = 0;
+
+    static uint16_t opcodeClassMask(uint16_t instructionWord)
+    {
+        switch(instructionWord >> 12) {
+            case 0x0: return (((instructionWord & 0xFFF0) == 0x00C0) || ((instructionWord & 0xFFF0) == 0x00D0)) ? 0xFFF0 : 0xFFFF;
+            case 0x5: case 0x8: case 0x9: case 0xD: return 0xF00F;
+            case 0xE: return 0xF0FF;
+            case 0xF: {
+                uint8_t low = instructionWord & 0xFF;
+                return ((low == 0x55) || (low == 0x65) || (low == 0x75) || (low == 0x85) || (instructionWord == 0xF000)) ? 0xFFFF : 0xF0FF;
+            }
+            default: return 0xF000;
+        }
+    }
+
+    static std::string opcodeClassName(uint16_t opcodeClass)
+    {
+        uint16_t mask = opcodeClassMask(opcodeClass);
+        static const char *hex = "0123456789ABCDEF";
+        const char *operandNames = "xyn";
+        if(mask == 0xF000) {
+            switch(opcodeClass >> 12) {
+                case 0x3: case 0x4: case 0x6: case 0x7: case 0xC:
+                    operandNames = "xkk";
+                    break;
+                default:
+                    operandNames = "nnn";
+                    break;
+            }
+        }
+        std::string name;
+        for(int nybble = 0; nybble < 4; nybble++) {
+            int shift = 12 - nybble * 4;
+            if((mask >> shift) & 0xF) {
+                name += hex[(opcodeClass >> shift) & 0xF];
+            } else {
+                name += operandNames[nybble - 1];
+            }
+        }
+        return name;
+    }
+
+    Timestamp now() { return std::chrono::steady_clock::now(); }
+
+    void countInstruction(uint16_t instructionWord, Timestamp started)
+    {
+        uint16_t opcodeClass = instructionWord & opcodeClassMask(instructionWord);
+        counts[opcodeClass]++;
+        nanoseconds[opcodeClass] += std::chrono::duration_cast<std::chrono::nanoseconds>(now() - started).count();
+        instructions++;
+    }
+
+    void countScroll() { scrolls++; }
+    void countClear() { clears++; }
+    void countKeyWaitStall() { keyWaitStallCycles++; }
+
+    bool writeJSON(const char *filename, uint64_t romHash)
+    {
+        FILE *fp = fopen(filename, "w");
+        if(fp == nullptr) {
+            return false;
+        }
+        fprintf(fp, "{\n");
+        fprintf(fp, "    \"romHash\": \"%016llx\",\n", (unsigned long long)romHash);
+        fprintf(fp, "    \"instructions\": %llu,\n", (unsigned long long)instructions);
+        fprintf(fp, "    \"scrolls\": %llu,\n", (unsigned long long)scrolls);
+        fprintf(fp, "    \"clears\": %llu,\n", (unsigned long long)clears);
+        fprintf(fp, "    \"keyWaitStallCycles\": %llu,\n", (unsigned long long)keyWaitStallCycles);
+        fprintf(fp, "    \"opcodes\": {");
+        bool first = true;
+        for(uint32_t opcodeClass = 0; opcodeClass < 65536; opcodeClass++) {
+            if(counts[opcodeClass] > 0) {
+                fprintf(fp, "%s\n        \"%s\": { \"count\": %llu, \"nanoseconds\": %llu }", first ? "" : ",",
+                    opcodeClassName(opcodeClass).c_str(), (unsigned long long)counts[opcodeClass], (unsigned long long)nanoseconds[opcodeClass]);
+                first = false;
+            }
+        }
+        fprintf(fp, "\n    }\n}\n");
+        fclose(fp);
+        return true;
+    }
+};
+
+#else
+
+struct ExecutionStatistics
+{
+    typedef int Timestamp;
+    Timestamp now() { return 0; }
+    void countInstruction(uint16_t, Timestamp) {}
+    void countScroll() {}
+    void countClear() {}
+    void countKeyWaitStall() {}
+    bool writeJSON(const char *, uint64_t) { return false; }
+};
+
+#endif
+
+
+// Samples the emulated PC at a fixed emulated-time interval and builds
+// histograms by address and by the basic block being executed.  Blocks
+// are detected dynamically: any instruction that doesn't fall through to
+// the next one starts a new block at its destination.
+struct PCProfiler
+{
+    clk_t sampleInterval;
+    clk_t nextSampleClock;
+    uint16_t blockStart = 0;
+    uint64_t samples = 0;
+    std::vector<uint64_t> addressSamples = std::vector<uint64_t>(65536, 0);
+    std::vector<uint64_t> blockSamples = std::vector<uint64_t>(65536, 0);
+
+    PCProfiler(const Clock& systemClock, int samplesPerSecond, uint16_t initialPC) :
+        sampleInterval(std::max((clk_t)1, systemClock.rate / samplesPerSecond)),
+        nextSampleClock(systemClock.clocks),
+        blockStart(initialPC)
+    {}
+
+    void step(clk_t clock, uint16_t pc)
+    {
+        while(clock >= nextSampleClock) {
+            addressSamples[pc]++;
+            blockSamples[blockStart]++;
+            samples++;
+            nextSampleClock += sampleInterval;
+        }
+    }
+
+    void stepped(uint16_t previousPC, int instructionSize, uint16_t pc)
+    {
+        if(pc != (uint16_t)(previousPC + instructionSize)) {
+            blockStart = pc;
+        }
+    }
+
+    static std::vector<uint16_t> hottest(const std::vector<uint64_t>& histogram, size_t count)
+    {
+        std::vector<uint16_t> addresses;
+        for(uint32_t address = 0; address < histogram.size(); address++) {
+            if(histogram[address] > 0) {
+                addresses.push_back(address);
+            }
+        }
+        std::sort(addresses.begin(), addresses.end(), [&](uint16_t a, uint16_t b) { return histogram[a] > histogram[b]; });
+        if(addresses.size() > count) {
+            addresses.resize(count);
+        }
+        return addresses;
+    }
+
+    template <class MEMORY>
+    void printReport(MEMORY& memory, size_t count, uint64_t romHash)
+    {
+        auto readU16 = [&](uint16_t addr) { return (uint16_t)(memory.read(addr) * 256 + memory.read(addr + 1)); };
+
+        printf("profile: ROM %016llx, %llu samples\n", (unsigned long long)romHash, (unsigned long long)samples);
+        if(samples == 0) {
+            return;
+        }
+
+        printf("profile: hottest addresses\n");
+        for(uint16_t address : hottest(addressSamples, count)) {
+            printf("%6.2f%% %8llu  ", addressSamples[address] * 100.0 / samples, (unsigned long long)addressSamples[address]);
+            disassemble(address, readU16(address), readU16(address + 2));
+        }
+
+        printf("profile: hottest blocks\n");
+        for(uint16_t address : hottest(blockSamples, count)) {
+            printf("%6.2f%% %8llu  block at %04X\n", blockSamples[address] * 100.0 / samples, (unsigned long long)blockSamples[address], address);
+            // Show the block up to its first control transfer, as far as we can tell statically
+            uint16_t pc = address;
+            for(int i = 0; i < 16; i++) {
+                uint16_t instructionWord = readU16(pc);
+                printf("                   ");
+                disassemble(pc, instructionWord, readU16(pc + 2));
+                int high = instructionWord >> 12;
+                if((high == 0x1) || (high == 0x2) || (high == 0xB) || (instructionWord == 0x00EE) ||
+                    (high == 0x3) || (high == 0x4) || (high == 0x5) || (high == 0x9) || (high == 0xE)) {
+                    break;
+                }
+                pc += (instructionWord == 0xF000) ? 4 : 2;
+            }
+        }
+    }
+};
+
+template <class MEMORY, class INTERFACE>
+struct Chip8Interpreter
+{
+    ChipPlatform platform;
+    uint32_t quirks;
+
+    uint64_t insnNumber = 0;
+
+    std::array<uint8_t, 16> registers = {0};
+    std::array<uint8_t, 8> RPL = {0};
+    std::vector<uint16_t> stack;
+    uint16_t I = 0;
+    uint16_t pc = 0;
+    uint8_t DT = 0;
+    clk_fixed_t DTNextDecrementTime = 0;
+    uint8_t ST = 0;
+    clk_fixed_t STNextDecrementTime = 0;
+    bool extendedScreenMode = false;
+    uint32_t screenPlaneMask = 0x1;
+ 
+    // The next CPU cycle is due at nextCycleTime; cycles are cpuClockStep apart.
+    clk_fixed_t cpuClockStep;
+    clk_fixed_t nextCycleTime;
+    clk_fixed_t timerStep = clockPeriod(Chip8TimerFrequency);
+    clk_t displayWaitClock = 0;     // with QUIRKS_VBLANK, no cycle runs before this
+
+    std::random_device r;
+    std::default_random_engine e1;
+    std::uniform_int_distribution<int> uniform_dist;
+
+    ExecutionStatistics statistics;
+    PCProfiler *profiler = nullptr;
+    TraceBuffer *trace = nullptr;
+    int debug = 0;
+
+    bool waitingForKeyPress = false;
+    bool waitingForKeyRelease = false;
+    uint8_t keyPressed;
+    int keyDestinationRegister;
+
+    Chip8Interpreter(uint16_t initialPC, ChipPlatform platform, uint32_t quirks, uint64_t cpuClockRate, const Clock& systemClock) :
+        platform(platform),
+        quirks(quirks),
+        e1(r()),
+        uniform_dist(0, 255)
+    {
+        reset(initialPC, cpuClockRate, systemClock);
+    }
+
+    // Return to the power-on state at systemClock.  Platform, quirks, the
+    // random number engine, and any statistics, profiler, or trace are kept.
+    void reset(uint16_t initialPC, uint64_t cpuClockRate, const Clock& systemClock)
+    {
+        setCPURate(cpuClockRate);
+        nextCycleTime = fixedClock(systemClock.clocks);
+        displayWaitClock = 0;
+        insnNumber = 0;
+        registers.fill(0);
+        RPL.fill(0);
+        stack.clear();
+        I = 0;
+        pc = initialPC;
+        DT = 0;
+        DTNextDecrementTime = 0;
+        ST = 0;
+        STNextDecrementTime = 0;
+        extendedScreenMode = false;
+        screenPlaneMask = 0x1;
+        waitingForKeyPress = false;
+        waitingForKeyRelease = false;
+    }
+
+    enum InstructionHighNybble
+    {
+        INSN_SYS = 0x0,
+        INSN_JP = 0x1,
+        INSN_CALL = 0x2,
+        INSN_SE_IMM = 0x3,
+        INSN_SNE_IMM = 0x4,
+        INSN_HIGH5 = 0x5,
+        INSN_LD_IMM = 0x6,
+        INSN_ADD_IMM = 0x7,
+        INSN_ALU = 0x8,
+        INSN_SNE_REG = 0x9,
+        INSN_LD_I = 0xA,
+        INSN_JP_V0 = 0xB,
+        INSN_RND = 0xC,
+        INSN_DRW = 0xD,
+        INSN_SKP = 0xE,
+        INSN_LD_SPECIAL = 0xF,
+    };
+
+    enum Series5Opcode // 5XYN low nybble
+    {
+        HIGH5_SE_REG = 0x0,
+        HIGH5_LD_I_VXVY = 0x2,
+        HIGH5_LD_VXVY_I = 0x3,
+    };
+
+    enum SYSOpcode
+    {
+        SYS_CLS = 0x0E0,
+        SYS_RET = 0x0EE,
+        SYS_SCROLL_DOWN = 0x0C0,
+        SYS_SCROLL_UP = 0x0D0,
+        SYS_SCROLL_RIGHT_4 = 0xFB,
+        SYS_SCROLL_LEFT_4 = 0xFC,
+        SYS_EXIT = 0xFD,
+        SYS_ORIGINAL_SCREEN = 0xFE,
+        SYS_EXTENDED_SCREEN = 0xFF,
+    };
+
+    enum SPECIALOpcode
+    {
+        SPECIAL_GET_DELAY = 0x07,
+        SPECIAL_KEYWAIT = 0x0A,
+        SPECIAL_SET_DELAY = 0x15,
+        SPECIAL_SET_SOUND = 0x18,
+        SPECIAL_ADD_INDEX = 0x1E,
+        SPECIAL_LD_DIGIT = 0x29,
+        SPECIAL_LD_BCD = 0x33,
+        SPECIAL_LD_IVX = 0x55,
+        SPECIAL_LD_VXI = 0x65,
+        SPECIAL_STORE_RPL = 0x75,
+        SPECIAL_LD_RPL = 0x85,
+        SPECIAL_LD_BIGDIGIT = 0x30,
+        SPECIAL_LD_I_16BIT = 0x00,
+        SPECIAL_SET_PLANES = 0x01,
+        SPECIAL_SET_AUDIO = 0x02,
+    };
+
+    enum SKPOpcode {
+        SKP_KEY = 0x9E,
+        SKNP_KEY = 0xA1,
+    };
+
+    enum ALUOpcode {
+        ALU_LD = 0x0,
+        ALU_OR = 0x1,
+        ALU_AND = 0x2,
+        ALU_XOR = 0x3,
+        ALU_ADD = 0x4,
+        ALU_SUB = 0x5,
+        ALU_SHR = 0x6,
+        ALU_SUBN = 0x7,
+        ALU_SHL = 0xE,
+    };
+
+    enum StepResult {
+        CONTINUE,
+        EXIT_INTERPRETER,
+        UNSUPPORTED_INSTRUCTION,
+    };
+
+    uint16_t readU16(MEMORY& memory, uint16_t addr)
+    {
+        uint8_t hiByte = memory.read(addr);
+        uint8_t loByte = memory.read(addr + 1);
+        return hiByte * 256 + loByte;
+    }
+
+    int getInstructionSize(MEMORY& memory, uint16_t addr)
+    {
+        if(platform == XOCHIP) {
+            if(readU16(memory, addr) == 0xF000) {
+                return 4;
+            } else {
+                return 2;
+            }
+        } else {
+            return 2;
+        }
+    }
+
+    void storeALUResult(int destination, uint8_t result, bool f)
+    {
+        if(quirks & QUIRKS_VFORDER) {
+            registers[0xF] = f ? 1 : 0;
+            registers[destination] = result;
+        } else {
+            registers[destination] = result;
+            registers[0xF] = f ? 1 : 0;
+        }
+    }
+
+    StepResult step(MEMORY& memory, INTERFACE& interface, const Clock& systemClock)
+    {
+        StepResult stepResult = CONTINUE;
+        uint16_t instructionWord = readU16(memory, pc);
+        uint8_t imm8Argument = instructionWord & 0x00FF;
+        uint8_t imm4Argument = instructionWord & 0x000F;
+        uint16_t imm12Argument = instructionWord & 0x0FFF;
+        uint16_t xArgument = (instructionWord & 0x0F00) >> 8;
+        uint16_t yArgument = (instructionWord & 0x00F0) >> 4;
+        int highNybble = instructionWord >> 12;
+        bool issueInstruction = true;
+
+        if(waitingForKeyPress) {
+
+            bool isPressed = false;
+            uint8_t whichKey;
+
+            for(uint8_t i = 0; i < 16; i++) {
+                if(interface.pressed(i)) {
+                    isPressed = true;
+                    whichKey = i;
+                }
+            }
+
+            if(isPressed) {
+                if(debug & DEBUG_KEYS) {
+                    printf("pressed %d now wait for release\n", whichKey);
+                }
+                keyPressed = whichKey;
+                waitingForKeyPress = false;
+                waitingForKeyRelease = true;
+            } else {
+                issueInstruction = false;
+            }
+        }
+
+        if(waitingForKeyRelease) {
+            if(!interface.pressed(keyPressed)) {
+                if(debug & DEBUG_KEYS) {
+                    printf("key wait over\n");
+                }
+                waitingForKeyRelease = false;
+                registers[keyDestinationRegister] = keyPressed;
+            } else {
+                issueInstruction = false;
+            }
+        }
+
+        if(!issueInstruction) {
+            statistics.countKeyWaitStall();
+        }
+
+        if(issueInstruction) {
+
+            ExecutionStatistics::Timestamp started = statistics.now();
+
+            uint16_t issuedPC = pc;
+            std::array<uint8_t, 16> registersBefore;
+            if(trace != nullptr) {
+                registersBefore = registers;
+            }
+
+            if(false) {
+                if(false && (insnNumber >= 43757)) {
+                    for(int row = 0; row < 32; row++) {
+                        for(int col = 0; col < 64; col++) {
+                            printf("%c", interface.display.at(row * 2).at(col * 2) ? '#' : '.');
+                        }
+                        puts("");
+                    }
+                }
+            }
+
+            uint16_t nextPC = pc + getInstructionSize(memory, pc);
+
+            switch(highNybble) {
+                case INSN_SYS: {
+                                   uint16_t sysOpcode = instructionWord & 0xFFF;
+                                   switch(sysOpcode) {
+                                       case SYS_CLS: { // 00E0 - CLS - Clear the display.
+                                                         interface.clear();
+                                                         statistics.countClear();
+                                                         break;
+                                                     }
+                                       case SYS_RET: { //  00EE - RET - Return from a subroutine.  The interpreter sets the program counter to the address at the top of the stack, then subtracts 1 from the stack pointer.
+                                                         nextPC = stack.back();
+                                                         stack.pop_back();
+                                                         break;
+                                                     }
+                                       case SYS_SCROLL_RIGHT_4: { // 00FB*    Scroll display 4 pixels right
+                                                                    if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
+                                                                        interface.scroll(-4, 0);
+                                                                        statistics.countScroll();
+                                                                    } else {
+                                                                        fprintf(stderr, "unsupported 0XXX instruction %04X (SCROLL RIGHT 4) - does this ROM require \"schip\" platform?\n", instructionWord);
+                                                                        stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                    }
+                                                                    break;
+                                                                }
+                                       case SYS_SCROLL_LEFT_4: { // 00FC*    Scroll display 4 pixels left
+                                                                   if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
+                                                                       interface.scroll(4, 0);
+                                                                       statistics.countScroll();
+                                                                   } else {
+                                                                       fprintf(stderr, "unsupported 0XXX instruction %04X (SCROLL ELFT 4) - does this ROM require \"schip\" platform?\n", instructionWord);
+                                                                       stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                   }
+                                                                   break;
+                                                               }
+                                       case SYS_EXIT: { // 00FD*    Exit CHIP interpreter
+                                                          if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
+                                                              stepResult = EXIT_INTERPRETER;
+                                                          } else {
+                                                              fprintf(stderr, "unsupported 0XXX instruction %04X (EXIT) - does this ROM require \"schip\" platform?\n", instructionWord);
+                                                              stepResult = UNSUPPORTED_INSTRUCTION;
+                                                          }
+                                                          break;
+                                                      }
+                                       case SYS_EXTENDED_SCREEN: { // 00FF*    Enable extended screen mode for full-screen graphics
+                                                                     if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
+                                                                         extendedScreenMode = true;
+                                                                         interface.clear();
+                                                                         statistics.countClear();
+                                                                     } else {
+                                                                         fprintf(stderr, "unsupported 0XXX instruction %04X (EXTENDEDSCREEN) - does this ROM require \"schip\" platform?\n", instructionWord);
+                                                                         stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                     }
+                                                                     break;
+                                                                 }
+                                       case SYS_ORIGINAL_SCREEN: { // 00FE*    Disable extended screen mode
+                                                                     if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
+                                                                         extendedScreenMode = false;
+                                                                         interface.clear();
+                                                                         statistics.countClear();
+                                                                     } else {
+                                                                         fprintf(stderr, "unsupported 0XXX instruction %04X (ORIGINALSCREEN) - does this ROM require \"schip\" platform?\n", instructionWord);
+                                                                         stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                     }
+                                                                     break;
+                                                                 }
+                                       default : { // Opcode undefined or is a range
+                                                     if((sysOpcode & 0xFF0) == SYS_SCROLL_UP) {
+                                                         // scroll-up n (0x00DN) scroll the contents of the display up by 0-15 pixels.
+                                                         if(platform == XOCHIP) {
+                                                             interface.scroll(0, imm4Argument);
+                                                             statistics.countScroll();
+                                                         } else {
+                                                             fprintf(stderr, "unsupported 0XXX instruction %04X (SCROLL UP) - does this ROM require \"xochip\" platform?\n", instructionWord);
+                                                             stepResult = UNSUPPORTED_INSTRUCTION;
+                                                         }
+                                                     } else if((sysOpcode & 0xFF0) == SYS_SCROLL_DOWN) {
+                                                         // 00CN*    Scroll display N lines down
+                                                         if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
+                                                             interface.scroll(0, -imm4Argument);
+                                                             statistics.countScroll();
+                                                         } else {
+                                                             fprintf(stderr, "unsupported 0XXX instruction %04X (SCROLL DOWN) - does this ROM require \"schip\" platform?\n", instructionWord);
+                                                             stepResult = UNSUPPORTED_INSTRUCTION;
+                                                         }
+                                                     } else {
+                                                         fprintf(stderr, "%04X: unsupported 0NNN instruction %04X \n", pc, instructionWord);
+                                                         stepResult = UNSUPPORTED_INSTRUCTION;
+                                                     }
+                                                     break;
+                                                 }
+                                   }
+                                   break;
+                               }
+                case INSN_JP: { // 1nnn - JP addr - Jump to location nnn.  The interpreter sets the program counter to nnn.
+                                  nextPC = imm12Argument;
+                                  break;
+                              }
+                case INSN_CALL: { // 2nnn - CALL addr - Call subroutine at nnn.  The interpreter increments the stack pointer, then puts the current PC on the top of the stack. The PC is then set to nnn.
+                                    stack.push_back(nextPC);
+                                    nextPC = imm12Argument;
+                                    break;
+                                }
+                case INSN_SE_IMM: { // 3xkk - SE Vx, byte - Skip next instruction if Vx = kk.  The interpreter compares register Vx to kk, and if they are equal, increments the program counter by 2.
+                                      if(registers[xArgument] == imm8Argument) {
+                                          nextPC = nextPC + getInstructionSize(memory, nextPC);
+                                      }
+                                      break;
+                                  }
+                case INSN_SNE_IMM: { // 4xkk - SNE Vx, byte - Skip next instruction if Vx != kk.  The interpreter compares register Vx to kk, and if they are not equal, increments the program counter by 2.
+                                       if(registers[xArgument] != imm8Argument) {
+                                           nextPC = nextPC + getInstructionSize(memory, nextPC);
+                                       }
+                                       break;
+                                   }
+                case INSN_HIGH5: {
+                                     uint8_t opcode = instructionWord & 0xF;
+                                     switch(opcode) {
+                                         case HIGH5_LD_I_VXVY : { // save vx - vy (0x5XY2) save an inclusive range of registers to memory starting at i.
+                                                                    if(platform == XOCHIP) {
+                                                                        if(xArgument < yArgument) {
+                                                                            for(int i = 0; i <= yArgument - xArgument; i++) {
+                                                                                memory.write(I + i, registers[xArgument + i]);
+                                                                            }
+                                                                        } else {
+                                                                            for(int i = 0; i <= xArgument - yArgument; i++) {
+                                                                                memory.write(I + i, registers[xArgument - i]);
+                                                                            }
+                                                                        }
+                                                                    } else {
+                                                                        fprintf(stderr, "unsupported 0XXX instruction %04X (LD I Vx-Vy ) - does this ROM require \"xochip\" platform?\n", instructionWord);
+                                                                        stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                    }
+                                                                    break;
+                                                                }
+                                         case HIGH5_LD_VXVY_I : { // load vx - vy (0x5XY3) load an inclusive range of registers from memory starting at i.
+                                                                    if(platform == XOCHIP) {
+                                                                        if(xArgument < yArgument) {
+                                                                            for(int i = 0; i <= yArgument - xArgument; i++) {
+                                                                                registers[xArgument + i] = memory.read(I + i);
+                                                                            }
+                                                                        } else {
+                                                                            for(int i = 0; i <= xArgument - yArgument; i++) {
+                                                                                registers[xArgument - i] = memory.read(I + i);
+                                                                            }
+                                                                        }
+                                                                    } else {
+                                                                        fprintf(stderr, "unsupported 0XXX instruction %04X (LD I Vx-Vy ) - does this ROM require \"xochip\" platform?\n", instructionWord);
+                                                                        stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                    }
+                                                                    break;
+                                                                }
+                                         case HIGH5_SE_REG : { // 5xy0 - SE Vx, Vy - Skip next instruction if Vx = Vy.  The interpreter compares register Vx to register Vy, and if they are equal, increments the program counter by 2.
+                                                                 if(registers[xArgument] == registers[yArgument]) {
+                                                                     nextPC = nextPC + getInstructionSize(memory, nextPC);
+                                                                 }
+                                                                 break;
+                                                             }
+                                         default : {
+                                                       if(opcode != 0) {
+                                                           fprintf(stderr, "%04X: unsupported instruction %04X\n", pc, instructionWord);
+                                                           stepResult = UNSUPPORTED_INSTRUCTION;
+                                                       }
+                                                       break;
+                                                   }
+                                     }
+                                     break;
+                                 }
+                case INSN_LD_IMM: { // 6xkk - LD Vx, byte - Set Vx = kk.  The interpreter puts the value kk into register Vx.  
+                                      registers[xArgument] = imm8Argument;
+                                      break;
+                                  }
+                case INSN_ADD_IMM: { // 7xkk - ADD Vx, byte - Set Vx = Vx + kk.  Adds the value kk to the value of register Vx, then stores the result in Vx.
+                                       registers[xArgument] = registers[xArgument] + imm8Argument;
+                                       break;
+                                   }
+                case INSN_ALU: {
+                                   int opcode = instructionWord & 0x000F;
+                                   switch(opcode) {
+                                       case ALU_LD: { // 8xy0 - LD Vx, Vy - Set Vx = Vy.  Stores the value of register Vy in register Vx.  
+                                                        registers[xArgument] = registers[yArgument];
+                                                        break;
+                                                    }
+                                       case ALU_OR: { // 8xy1 - OR Vx, Vy - Set Vx = Vx OR Vy.
+                                                        registers[xArgument] |= registers[yArgument];
+                                                        if(quirks & QUIRKS_LOGIC) {
+                                                            registers[0xF] = 0;
+                                                        }
+                                                        break;
+                                                    }
+                                       case ALU_AND: { // 8xy2 - AND Vx, Vy - Set Vx = Vx AND Vy.
+                                                         registers[xArgument] &= registers[yArgument];
+                                                         if(quirks & QUIRKS_LOGIC) {
+                                                             registers[0xF] = 0;
+                                                         }
+                                                         break;
+                                                     }
+                                       case ALU_XOR: { // 8xy3 - XOR Vx, Vy -  Set Vx = Vx XOR Vy.
+                                                         registers[xArgument] ^= registers[yArgument];
+                                                         if(quirks & QUIRKS_LOGIC) {
+                                                             registers[0xF] = 0;
+                                                         }
+                                                         break;
+                                                     }
+                                       case ALU_ADD: { // 8xy4 - ADD Vx, Vy - Set Vx = Vx + Vy, set VF = carry.  The values of Vx and Vy are added together. If the result is greater than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept, and stored in Vx.
+                                                         uint8_t result = registers[xArgument] + registers[yArgument];
+                                                         storeALUResult(xArgument, result, (registers[xArgument] + registers[yArgument]) > 0xFF);
+                                                         break;
+                                                     }
+                                       case ALU_SUB: { // 8xy5 - SUB Vx, Vy - Set Vx = Vx - Vy, set VF = NOT borrow.  If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
+                                                         uint8_t result = registers[xArgument] - registers[yArgument];
+                                                         storeALUResult(xArgument, result, registers[xArgument] >= registers[yArgument]);
+                                                         break;
+                                                     }
+                                       case ALU_SUBN: { // 8xy7 - SUBN Vx, Vy - Set Vx = Vy - Vx, set VF = NOT borrow.  If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
+                                                          uint8_t result = registers[yArgument] - registers[xArgument];
+                                                          storeALUResult(xArgument, result, registers[yArgument] >= registers[xArgument]);
+                                                          break;
+                                                      }
+                                       case ALU_SHR: { // 8xy6 - SHR Vx {, Vy} - Set Vx = Vy SHR 1.  If the least-significant bit of Vy is 1, then VF is set to 1, otherwise 0. Then Vx is Vy divided by 2. (if shift.quirk, Vx = Vx SHR 1)
+                                                         if(quirks & QUIRKS_SHIFT) {
+                                                             yArgument = xArgument;
+                                                         }
+                                                         uint8_t result = registers[yArgument] / 2;
+                                                         storeALUResult(xArgument, result, registers[yArgument] & 0x1);
+                                                         break;
+                                                     }
+                                       case ALU_SHL: { // 8xyE - SHL Vx {, Vy} - Set Vx = Vx SHL 1.  If the most-significant bit of Vy is 1, then VF is set to 1, otherwise to 0. Then Vx is Vy multiplied by 2.   (if shift.quirk, Vx = Vx SHL 1)
+                                                         if(quirks & QUIRKS_SHIFT) {
+                                                             yArgument = xArgument;
+                                                         }
+                                                         uint8_t result = registers[yArgument] * 2;
+                                                         storeALUResult(xArgument, result, registers[yArgument] & 0x80);
+                                                         break;
+                                                     }
+                                       default : {
+                                                     fprintf(stderr, "%04X: unsupported 8xyN instruction %04X\n", pc, instructionWord);
+                                                     stepResult = UNSUPPORTED_INSTRUCTION;
+                                                     break;
+                                                 }
+                                   }
+                                   break;
+                               }
+                case INSN_SNE_REG: { // 9xy0 - SNE Vx, Vy - Skip next instruction if Vx != Vy.  The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.  
+                                       if(imm4Argument != 0) {
+                                           fprintf(stderr, "%04X: unsupported 9XY0 instruction %04X\n", pc, instructionWord);
+                                           stepResult = UNSUPPORTED_INSTRUCTION;
+                                       }
+                                       if(registers[xArgument] != registers[yArgument]) {
+                                           nextPC = nextPC + getInstructionSize(memory, nextPC);
+                                       }
+                                       break;
+                                   }
+                case INSN_LD_I: { // Annn - LD I, addr - Set I = nnn.  
+                                    I = imm12Argument;
+                                    break;
+                                }
+                case INSN_JP_V0: { // Bnnn - JP V0, addr - Jump to location nnn + V0.
+                                     if(quirks & QUIRKS_JUMP) { // Ugh!
+                                         nextPC = (imm12Argument & 0xFF) + registers[xArgument] + (xArgument << 8);
+                                     } else {
+                                         nextPC = imm12Argument + registers[0];
+                                     }
+                                     break;
+                                 }
+                case INSN_RND: { // Cxkk - RND Vx, byte - Set Vx = random byte AND kk.  The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk. The results are stored in Vx. See instruction 8xy2 for more information on AND.
+                                   registers[xArgument] = uniform_dist(e1) & imm8Argument;
+                                   break;
+                               }
+                case INSN_DRW: { // Dxyn - DRW Vx, Vy, nibble
+                                   // Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
+                                   // The interpreter reads n bytes from memory, starting at the address stored in
+                                   // I. These bytes are then displayed as sprites on screen at coordinates (Vx, Vy).
+                                   // Sprites are XORed onto the existing screen. If this causes any pixels to be erased,
+                                   // VF is set to 1, otherwise it is set to 0. If the sprite is positioned so part of it
+                                   // is outside the coordinates of the display, it wraps around to the opposite side of
+                                   // the screen. See instruction 8xy3 for more information on XOR, and section 2.4,
+                                   // Display, for more information on the Chip-8 screen and sprites.
+                                   registers[0xF] = 0;
+                                   uint32_t screenWidth = extendedScreenMode ? 128 : 64;
+                                   uint32_t screenHeight = extendedScreenMode ? 64 : 32;
+                                   uint32_t pixelScale = extendedScreenMode ? 1 : 2;
+                                   uint16_t spriteByteAddress = I;
+                                   uint32_t byteCount = 1;
+                                   uint32_t rowCount = imm4Argument;
+                                   if(((platform == SCHIP_1_1) || (platform == XOCHIP)) && (imm4Argument == 0)) {
+                                       // 16x16 sprite
+                                       rowCount = 16;
+                                       byteCount = 2;
+                                   }
+                                   for(int bitplane = 0; bitplane < 2; bitplane++) {
+                                       uint8_t planeMask = 1 << bitplane;
+                                       if(screenPlaneMask & planeMask) {
+                                           for(uint32_t rowIndex = 0; rowIndex < rowCount; rowIndex++) {
+                                               for(uint32_t byteIndex = 0; byteIndex < byteCount; byteIndex++) {
+                                                   uint8_t byte = memory.read(spriteByteAddress++);
+                                                   for(uint32_t bitIndex = 0; bitIndex < 8; bitIndex++) {
+                                                       bool hasPixel = (byte >> (7 - bitIndex)) & 0x1;
+                                                       uint32_t colIndex = bitIndex + byteIndex * 8;
+                                                       if(quirks & QUIRKS_CLIP) {
+                                                           hasPixel &= (((registers[xArgument] % screenWidth) + colIndex) < screenWidth) &&
+                                                               (((registers[yArgument] % screenHeight) + rowIndex) < screenHeight);
+                                                       }
+                                                       if(hasPixel) {
+                                                           uint32_t x = (registers[xArgument] + colIndex) % screenWidth;
+                                                           uint32_t y = (registers[yArgument] + rowIndex) % screenHeight;
+                                                           if(debug & DEBUG_DRAW) {
+                                                               printf("draw %d %d (%d)\n", x, y, x + y * 64);
+                                                           }
+                                                           for(uint32_t ygrid = 0; ygrid < pixelScale; ygrid++) {
+                                                               for(uint32_t xgrid = 0; xgrid < pixelScale; xgrid++) {
+                                                                   int x2 = x * pixelScale + xgrid;
+                                                                   int y2 = y * pixelScale + ygrid;
+                                                                   if(interface.draw(x2, y2, planeMask)) {
+                                                                       registers[0xF] = 1;
+                                                                   }
+                                                               }
+                                                           }
+                                                       }
+                                                   }
+                                               }
+                                           }
+                                       }
+                                   }
+                                   if(quirks & QUIRKS_VBLANK) {
+                                       // The VIP's sprite routine waits for the display interrupt; idle until the next field.
+                                       displayWaitClock = (systemClock.clocks / SystemClocksPerField + 1) * SystemClocksPerField;
+                                   }
+                                   break;
+                               }
+                case INSN_SKP: {
+                                   int opcode = instructionWord & 0xFF;
+                                   switch(opcode) {
+                                       case SKP_KEY: { // Ex9E - SKP Vx - Skip next instruction if key with the value of Vx is pressed.  Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, PC is increased by 2.
+                                                         if(interface.pressed(registers[xArgument])) {
+                                                             if(debug & DEBUG_KEYS) {
+                                                                 printf("clock %llu, pc %04X, SKP_KEY, key %d pressed\n", insnNumber, pc, registers[xArgument]);
+                                                             }
+                                                             nextPC = nextPC + getInstructionSize(memory, nextPC);
+                                                         }
+                                                         break;
+                                                     }
+                                       case SKNP_KEY: { // ExA1 - SKNP Vx - Skip next instruction if key with the value of Vx is not pressed.  Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.
+                                                          if(!interface.pressed(registers[xArgument])) {
+                                                              nextPC = nextPC + getInstructionSize(memory, nextPC);
+                                                          } else {
+                                                              if(debug & DEBUG_KEYS) {
+                                                                  printf("clock %llu, pc %04X, SKNP_KEY, key %d pressed\n", insnNumber, pc, registers[xArgument]);
+                                                              }
+                                                          }
+                                                          break;
+                                                      }
+                                       default : {
+                                                     fprintf(stderr, "%04X: unsupported ExNN instruction %04X\n", pc, instructionWord);
+                                                     stepResult = UNSUPPORTED_INSTRUCTION;
+                                                     break;
+                                                 }
+                                   }
+                                   break;
+                               }
+                case INSN_LD_SPECIAL :{
+                                          int opcode = instructionWord & 0xFF;
+                                          switch(opcode) {
+                                              case SPECIAL_GET_DELAY: { // Fx07 - LD Vx, DT - Set Vx = delay timer value.  The value of DT is placed into Vx.
+                                                                          registers[xArgument] = DT;
+                                                                          break;
+                                                                      }
+                                              case SPECIAL_KEYWAIT: { // Fx0A - LD Vx, K - Wait for a key press, store the value of the key in Vx.  All execution stops until a key is pressed, then the value of that key is stored in Vx.  
+                                                                        if(debug & DEBUG_KEYS) {
+                                                                            printf("waiting for key\n");
+                                                                        }
+                                                                        waitingForKeyPress = true;
+                                                                        keyDestinationRegister = xArgument;
+                                                                        break;
+                                                                    }
+                                              case SPECIAL_SET_DELAY: { // Fx15 - LD DT, Vx - Set delay timer = Vx.  DT is set equal to the value of Vx.
+
+                                                                          DT = registers[xArgument];
+                                                                          DTNextDecrementTime = fixedClock(systemClock.clocks) + timerStep;
+                                                                          break;
+                                                                      }
+                                              case SPECIAL_SET_SOUND: { // Fx18 - LD ST, Vx - Set sound timer = Vx.  ST is set equal to the value of Vx.  
+                                                                          ST = registers[xArgument];
+                                                                          if(ST > 0) {
+                                                                              interface.startAudio(systemClock);
+                                                                          }
+                                                                          STNextDecrementTime = fixedClock(systemClock.clocks) + timerStep;
+                                                                          break;
+                                                                      }
+                                              case SPECIAL_ADD_INDEX: { // Fx1E - ADD I, Vx - Set I = I + Vx.  The values of I and Vx are added, and the results are stored in I.  
+                                                                          I += registers[xArgument];
+                                                                          break;
+                                                                      }
+                                              case SPECIAL_LD_DIGIT: { // Fx29 - LD F, Vx - Set I = location of sprite for digit Vx.  The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the Chip-8 hexadecimal font.  
+                                                                         I = memory.getDigitLocation(registers[xArgument]);
+                                                                         break;
+                                                                     }
+                                              case SPECIAL_LD_BIGDIGIT: { // FX30* - Point I to 10-byte font sprite for digit VX (0..9)
+                                                                            if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
+                                                                                I = memory.getBigDigitLocation(registers[xArgument]);
+                                                                            } else {
+                                                                                fprintf(stderr, "unsupported 0XXX instruction %04X (LD BIGF) - does this ROM require \"schip\" platform?\n", instructionWord);
+                                                                                stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                            }
+                                                                            break;
+                                                                        }
+                                              case SPECIAL_LD_BCD: { // Fx33 - LD B, Vx - Store BCD representation of Vx in memory locations I, I+1, and I+2.  The interpreter takes the decimal value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.
+                                                                       memory.write(I + 0, registers[xArgument] / 100);
+                                                                       memory.write(I + 1, (registers[xArgument] % 100) / 10);
+                                                                       memory.write(I + 2, registers[xArgument] % 10);
+                                                                       break;
+                                                                   }
+                                              case SPECIAL_LD_IVX: { // Fx55 - LD [I], Vx - Store registers V0 through Vx in memory starting at location I.  The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.  
+                                                                       for(int i = 0; i <= xArgument; i++) {
+                                                                           memory.write(I + i, registers[i]);
+                                                                       }
+                                                                       if(!(quirks & QUIRKS_LOAD_STORE)) {
+                                                                           I = I + xArgument + 1;
+                                                                       }
+                                                                       break;
+                                                                   }
+                                              case SPECIAL_LD_VXI: { // Fx65 - LD Vx, [I] - Read registers V0 through Vx from memory starting at location I.  The interpreter reads values from memory starting at location I into registers V0 through Vx.
+                                                                       for(int i = 0; i <= xArgument; i++) {
+                                                                           registers[i] = memory.read(I + i);
+                                                                       }
+                                                                       if(!(quirks & QUIRKS_LOAD_STORE)) {
+                                                                           I = I + xArgument + 1;
+                                                                       }
+                                                                       break;
+                                                                   }
+                                              case SPECIAL_STORE_RPL: {
+                                                                          if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
+                                                                              for(int i = 0; i <= std::min((uint16_t)7, xArgument); i++) {
+                                                                                  RPL[i] = registers[i];
+                                                                              }
+                                                                          } else {
+                                                                              fprintf(stderr, "unsupported FXNN instruction %04X (STORE_RPL) - does this ROM require \"schip\" platform?\n", instructionWord);
+                                                                              stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                          }
+                                                                          break;
+                                                                      }
+                                              case SPECIAL_LD_RPL: {
+                                                                       if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
+                                                                           for(int i = 0; i <= std::min((uint16_t)7, xArgument); i++) {
+                                                                               registers[i] = RPL[i];
+                                                                           }
+                                                                       } else {
+                                                                           fprintf(stderr, "unsupported FXNN instruction %04X (LD_RPL) - does this ROM require \"schip\" platform?\n", instructionWord);
+                                                                           stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                       }
+                                                                       break;
+                                                                   }
+                                              case SPECIAL_LD_I_16BIT: { // F000 NNNN
+                                                                           if(platform == XOCHIP) {
+                                                                               I = readU16(memory, pc + 2);
+                                                                           } else {
+                                                                               fprintf(stderr, "unsupported 0XXX instruction %04X (LD I NNNN) - does this ROM require \"xochip\" platform?\n", instructionWord);
+                                                                               stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                           }
+                                                                           break;
+                                                                       }
+                                              case SPECIAL_SET_PLANES: { // plane n (0xFN01) select zero or more drawing planes by bitmask (0 <= n <= 3).
+                                                                           if(platform == XOCHIP) {
+                                                                               screenPlaneMask = xArgument;
+                                                                           } else {
+                                                                               fprintf(stderr, "unsupported 0XXX instruction %04X (SET PLANES) - does this ROM require \"xochip\" platform?\n", instructionWord);
+                                                                               stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                           }
+                                                                           break;
+                                                                       }
+                                              case SPECIAL_SET_AUDIO: { // audio (0xF002) store 16 bytes starting at i in the audio pattern buffer. 
+                                                                          if(platform == XOCHIP) {
+                                                                              std::array<uint8_t, 16> audioSample;
+                                                                              for(int i = 0; i < 16; i++) {
+                                                                                  audioSample.at(i) = memory.read(I + i);
+                                                                              }
+                                                                              interface.loadAudio(audioSample.data(), systemClock);
+                                                                          } else {
+                                                                              fprintf(stderr, "unsupported 0XXX instruction %04X (SET AUDIO) - does this ROM require \"xochip\" platform?\n", instructionWord);
+                                                                              stepResult = UNSUPPORTED_INSTRUCTION;
+                                                                          }
+                                                                          break;
+                                                                      }
+                                              default : {
+                                                            fprintf(stderr, "unsupported FxNN instruction %04X\n", instructionWord);
+                                                            stepResult = UNSUPPORTED_INSTRUCTION;
+                                                            break;
+                                                        }
+                                          }
+                                          break;
+                                      }
+            }
+
+            pc = nextPC;
+
+            if(trace != nullptr) {
+                trace->record(systemClock.clocks, issuedPC, instructionWord, I, registersBefore, registers);
+            }
+            insnNumber++;
+
+            statistics.countInstruction(instructionWord, started);
+        }
+
+        clk_fixed_t now = fixedClock(systemClock.clocks);
+        while((DT > 0) && (DTNextDecrementTime <= now)) {
+            DT--;
+            DTNextDecrementTime += timerStep;
+        }
+
+        while((ST > 0) && (STNextDecrementTime <= now)) {
+            ST--;
+            STNextDecrementTime += timerStep;
+            if(ST == 0) {
+                interface.stopAudio(systemClock);
+            }
+        }
+
+        return stepResult;
+    }
+
+    // Change the CPU rate from the next cycle on.
+    void setCPURate(uint64_t cpuClockRate)
+    {
+        assert(cpuClockRate > 0);
+        cpuClockStep = clockPeriod(cpuClockRate);
+    }
+
+    // Return the next system clock tick at which the CPU will have transitioned one CPU clock,
+    // that is to say return the least clock for which the CPU has to do some work.
+    clk_t calculateNextActivity()
+    {
+        return clockAtOrAfter(nextCycleTime);
+    }
+
+    // Do work associated with CPU clock transitioning to active, up to and including systemClock.
+    // Do not repeat work if called twice with same clock.
+    StepResult updatePastClock(MEMORY& memory, INTERFACE& interface, const Clock& systemClock)
+    {
+        for(clk_t clock = calculateNextActivity(); clock <= systemClock.clocks; clock = calculateNextActivity()) {
+            uint16_t previousPC = pc;
+            if(profiler != nullptr) {
+                profiler->step(clock, pc);
+            }
+            StepResult result = step(memory, interface, Clock(systemClock, clock));
+            if(profiler != nullptr) {
+                profiler->stepped(previousPC, getInstructionSize(memory, previousPC), pc);
+            }
+            if(result != CONTINUE) {
+                return result;
+            }
+            // A wait for the display skips the idle cycles instead of running
+            // them; it happens at most once a field, so the division is cheap.
+            nextCycleTime = stepToClock(nextCycleTime + cpuClockStep, cpuClockStep, displayWaitClock);
+        }
+        return CONTINUE;
+    }
+};
+
+inline std::vector<uint8_t> digitSprites = {
+#if 0
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80, // F
+#else
+    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+    0x20, 0x60, 0x20, 0x20, 0x70, // 1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+    0xF0, 0x80, 0xF0, 0x80, 0x80, // F
+#endif
+};
+
+
+inline std::vector<uint8_t> largeDigitSprites = {
+#if 0
+The MIT License (MIT)
+
+Copyright (c) 2015, John Earnest
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+#endif
+    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+};
+
+struct Memory
+{
+    std::array<uint8_t, 65536> memory;
+
+    std::array<uint16_t, 16> digitAddresses = {0};
+
+    std::array<uint16_t, 16> largeDigitAddresses = {0};
+
+    ChipPlatform platform;
+
+    // One bit per page written since the bit was last cleared, so a consumer
+    // only has to look at the pages that changed.  Each run has a single
+    // owner that clears it: per-field state hashing, the fuzzer's reset to
+    // the start state, or --diff.
+    static constexpr size_t pageSize = 256;
+    static constexpr size_t pageCount = 65536 / pageSize;
+    std::array<uint64_t, pageCount / 64> dirtyPages;
+
+    Memory(ChipPlatform platform) :
+        platform(platform)
+    {
+        memory.fill(0);
+        dirtyPages.fill(~0ULL);
+        for(uint16_t i = 0; i < digitSprites.size(); i++) {
+            uint16_t address = i;
+            write(address, digitSprites[i]);
+            if(i % 5 == 0) {
+                digitAddresses[i / 5] = address;
+            }
+        }
+        if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
+            for(uint16_t i = 0; i < largeDigitSprites.size(); i++) {
+                uint16_t address = (uint16_t)digitSprites.size() + i;
+                write(address, largeDigitSprites[i]);
+                if(i % 10 == 0) {
+                    largeDigitAddresses[i / 10] = address;
+                }
+            }
+        }
+    }
+
+    uint8_t read(uint16_t addr)
+    {
+        if(false)printf("read(%x) -> %x\n", addr, memory[addr]);
+        if((platform != SCHIP_1_1) && (platform != XOCHIP)) {
+            assert(addr < 4096);
+        }
+        return memory[addr];
+    }
+
+    void write(uint16_t addr, uint8_t v)
+    {
+        if((platform != SCHIP_1_1) && (platform != XOCHIP)) {
+            assert(addr < 4096);
+        }
+        memory[addr] = v;
+        dirtyPages[addr / pageSize / 64] |= 1ULL << (addr / pageSize % 64);
+    }
+
+    // Undo every write since the dirty bits were last cleared by copying
+    // those pages back from pristine, an earlier copy of this memory.
+    void restoreDirtyPages(const Memory& pristine)
+    {
+        for(size_t word = 0; word < dirtyPages.size(); word++) {
+            if(dirtyPages[word] == 0) {
+                continue;
+            }
+            for(size_t bit = 0; bit < 64; bit++) {
+                if(dirtyPages[word] & (1ULL << bit)) {
+                    size_t page = word * 64 + bit;
+                    memcpy(memory.data() + page * pageSize, pristine.memory.data() + page * pageSize, pageSize);
+                }
+            }
+            dirtyPages[word] = 0;
+        }
+    }
+
+    void markDirty(size_t addr, size_t size)
+    {
+        for(size_t page = addr / pageSize; page < (addr + size + pageSize - 1) / pageSize; page++) {
+            dirtyPages[page / 64] |= 1ULL << (page % 64);
+        }
+    }
+
+    size_t addressSpaceSize() const
+    {
+        return ((platform == SCHIP_1_1) || (platform == XOCHIP)) ? memory.size() : 4096;
+    }
+
+    // Copy an image into memory at addr in one operation; false if it doesn't fit.
+    bool load(uint16_t addr, const uint8_t *data, size_t size)
+    {
+        if((addr > addressSpaceSize()) || (size > addressSpaceSize() - addr)) {
+            return false;
+        }
+        std::copy(data, data + size, memory.begin() + addr);
+        markDirty(addr, size);
+        return true;
+    }
+
+    uint16_t getDigitLocation(uint8_t digit)
+    {
+        return digitAddresses[digit];
+    }
+
+    uint16_t getBigDigitLocation(uint8_t digit)
+    {
+        if((platform != SCHIP_1_1) && (platform != XOCHIP)) {
+            abort();
+        }
+        if(platform != XOCHIP) {
+            assert(digit < 10);
+        }
+        return largeDigitAddresses[digit];
+    }
+};
+
+typedef std::array<std::array<uint8_t, 128>, 64> DisplayImage;
+
+constexpr int AOSamplingRate = 44100;
+
+// Display, keypad, and audio synthesis state used by the interpreter,
+// shared by the windowed Interface and the HeadlessInterface.  Each
+// completed output buffer of audio samples is handed to emitAudio().
+struct EmulatedInterface
+{
+    ChipPlatform platform;
+    DisplayImage display;
+    std::array<uint8_t, XOChipAudioSampleSize> audioSample;
+    bool displayChanged = true;
+    std::array<std::atomic<bool>, 16> keyPressed;
+    std::atomic<bool> aKeyWasPressed{false};
+
+    bool audioActive = false;
+    bool audioMuted = false; // Running faster than real time or headless; keep time but don't output
+    bool audioRecorded = false; // Synthesize and emit samples even while muted
+    uint8_t currentAudioSample = 128 - 16;
+
+    // Output samples are synthesized in blocks between audio state changes.
+    // nextOutputSample is due at nextOutputSampleTime; samples are
+    // outputSampleStep apart, which is nominalOutputSampleStep adjusted by
+    // the dynamic rate control ratio.  outputSampleReciprocal is
+    // 2^OutputSampleReciprocalBits / outputSampleStep, so that samples can be
+    // counted without dividing.
+    static constexpr int OutputSampleReciprocalBits = 64;
+    uint32_t outputSampleRate = AOSamplingRate;
+    uint64_t nextOutputSample = 0;
+    clk_fixed_t nextOutputSampleTime;
+    clk_fixed_t nominalOutputSampleStep;
+    clk_fixed_t outputSampleStep;
+    clk_fixed_t outputSampleReciprocal;
+    uint64_t audioStartOutputSample = 0;
+
+    // The pattern buffer resampled to the output rate, one full period long,
+    // cached by pattern so that repeated patterns are only resampled once.
+    static constexpr size_t waveformPeriodLimit = 16384;
+    static constexpr size_t waveformCacheLimit = 256;
+    size_t waveformPeriod = waveformPeriodAt(AOSamplingRate);
+    std::map<std::array<uint8_t, XOChipAudioSampleSize>, std::vector<uint8_t>> waveformCache;
+    const std::vector<uint8_t> *currentWaveform = nullptr;
+
+    static constexpr size_t audioOutputBufferSize = AOSamplingRate / 240;
+    uint8_t audioOutputBuffer[audioOutputBufferSize];
+
+    EmulatedInterface(ChipPlatform platform, const Clock& systemClock) :
+        platform(platform)
+    {
+        reset(systemClock);
+    }
+
+    virtual ~EmulatedInterface() {}
+
+    // Return to the power-on state at systemClock, keeping the waveform cache.
+    void reset(const Clock& systemClock)
+    {
+        for(auto& key : keyPressed) {
+            key = false;
+        }
+        aKeyWasPressed = false;
+
+        clear();
+        displayChanged = true;
+
+	// XXX is this correct?  John's spec says it but feels like
+	// an error.  Do all XOCHIP variants always set buffer before
+	// calling audio?
+	audioSample.fill(0);
+
+        if(platform != XOCHIP) {
+            audioSample[0] = 0xff;
+            audioSample[2] = 0xff;
+            audioSample[4] = 0xff;
+            audioSample[6] = 0xff;
+            audioSample[8] = 0xff;
+            audioSample[10] = 0xff;
+            audioSample[12] = 0xff;
+            audioSample[14] = 0xff;
+        }
+
+        audioActive = false;
+        currentAudioSample = 128 - 16;
+        nextOutputSample = 0;
+        audioStartOutputSample = 0;
+        nextOutputSampleTime = fixedClock(systemClock.clocks);
+        setOutputSampleRate(outputSampleRate);
+    }
+
+    virtual void emitAudio(const uint8_t *samples, size_t count) = 0;
+
+    // Output samples in the shortest run that holds a whole number of
+    // patterns.  At rates where that run is longer than waveformPeriodLimit,
+    // it is instead as many patterns as fit, rounded to a whole sample, and
+    // the pattern slips by under half a sample each time the run repeats.
+    static size_t waveformPeriodAt(uint32_t rate)
+    {
+        uint64_t patternLength = (uint64_t)XOChipAudioSampleSamples * rate;     // in 1/XOChipAudioSampleRate samples
+        uint64_t exact = patternLength / std::gcd(patternLength, (uint64_t)XOChipAudioSampleRate);
+        if(exact <= waveformPeriodLimit) {
+            return exact;
+        }
+        uint64_t patterns = std::max<uint64_t>(1, waveformPeriodLimit * XOChipAudioSampleRate / patternLength);
+        return (patterns * patternLength + XOChipAudioSampleRate / 2) / XOChipAudioSampleRate;
+    }
+
+    // Change the output sample rate from the next sample on.  Resampled
+    // waveforms are for the old rate, so the cache starts over.
+    void setOutputSampleRate(uint32_t rate)
+    {
+        assert((rate > 0) && (rate < SystemClockRate));
+        if(rate != outputSampleRate) {
+            outputSampleRate = rate;
+            waveformPeriod = waveformPeriodAt(rate);
+            waveformCache.clear();
+        }
+        nominalOutputSampleStep = clockPeriod(rate);
+        setOutputSampleStep(nominalOutputSampleStep);
+        currentWaveform = &cachedWaveform(audioSample);
+    }
+
+    void setOutputSampleStep(clk_fixed_t step)
+    {
+        outputSampleStep = step;
+        outputSampleReciprocal = ((clk_fixed_t)1 << OutputSampleReciprocalBits) / step;
+    }
+
+    uint64_t firstOutputSampleAtOrAfter(clk_t clock)
+    {
+        clk_fixed_t time = fixedClock(clock);
+        if(time <= nextOutputSampleTime) {
+            return nextOutputSample;
+        }
+        // The reciprocal is rounded down, so the estimate is never more
+        // than the answer and at most a sample or two less.
+        clk_fixed_t elapsed = time - nextOutputSampleTime;
+        uint64_t count = (uint64_t)((elapsed * outputSampleReciprocal) >> OutputSampleReciprocalBits);
+        while(outputSampleStep * count < elapsed) {
+            count++;
+        }
+        return nextOutputSample + count;
+    }
+
+    const std::vector<uint8_t>& cachedWaveform(const std::array<uint8_t, XOChipAudioSampleSize>& pattern)
+    {
+        auto found = waveformCache.find(pattern);
+        if(found != waveformCache.end()) {
+            return found->second;
+        }
+        if(waveformCache.size() >= waveformCacheLimit) {
+            waveformCache.clear();
+        }
+        std::vector<uint8_t>& waveform = waveformCache[pattern];
+        waveform.resize(waveformPeriod);
+        for(size_t i = 0; i < waveformPeriod; i++) {
+            uint64_t audioInputSampleIndex = (i * XOChipAudioSampleRate / outputSampleRate) % XOChipAudioSampleSamples;
+            int byteIndex = audioInputSampleIndex / 8;
+            int bitIndex = audioInputSampleIndex % 8;
+            waveform[i] = ((pattern[byteIndex] << bitIndex) & 0x80) ? (128 - 16) : (128 + 16);
+        }
+        return waveform;
+    }
+
+    void loadAudio(const uint8_t* audioSampleSrc, const Clock& clk)
+    {
+        synthesizeAudioBefore(clk);
+        std::copy(audioSampleSrc, audioSampleSrc + 16, std::begin(audioSample));
+        currentWaveform = &cachedWaveform(audioSample);
+        audioStartOutputSample = std::max(nextOutputSample, firstOutputSampleAtOrAfter(clk.clocks));
+    }
+
+    void scroll(int dx, int dy)
+    {
+        DisplayImage source = display;
+        for(int y = 0; y < 64; y++) {
+            int srcy = y + dy;
+            for(int x = 0; x < 128; x++) {
+                int srcx = x + dx;
+                if((srcx >= 0) && (srcx < 128) && (srcy >= 0) && (srcy < 64)) {
+                    display.at(y).at(x) = source.at(srcy).at(srcx);
+                } else {
+                    display.at(y).at(x) = 0;
+                }
+            }
+        }
+    }
+
+    void startAudio(const Clock& clk)
+    {
+        synthesizeAudioBefore(clk);
+        audioStartOutputSample = std::max(nextOutputSample, firstOutputSampleAtOrAfter(clk.clocks));
+        audioActive = true;
+    }
+
+    void stopAudio(const Clock& clk)
+    {
+        synthesizeAudioBefore(clk);
+        audioActive = false;
+    }
+
+    bool pressed(uint8_t key)
+    {
+        return keyPressed[key];
+    }
+
+    bool anyKeyPressed()
+    {
+        return aKeyWasPressed.exchange(false);
+    }
+
+    void setKey(uint8_t key, bool isPressed)
+    {
+        keyPressed[key] = isPressed;
+        if(isPressed) {
+            aKeyWasPressed = true;
+        }
+    }
+
+    bool draw(uint8_t x, uint8_t y, uint8_t planeMask)
+    {
+        bool erased = false;
+
+        displayChanged = true; /* pixel will either be set or cleared... */
+
+        if((x < 128) && (y < 64)) {
+            uint8_t& pixel = display.at(y).at(x);
+            uint8_t oldValue = pixel;
+            for(int i = 0; i < 2; i++) {
+                uint8_t bit = (0x1 << i);
+                if(planeMask & bit) {
+                    pixel = pixel ^ bit;
+                }
+                if(((oldValue & bit) != 0) && ((pixel & bit) == 0)) {
+                    erased = true;
+                }
+            }
+        }
+
+        return erased;
+    }
+
+    void clear()
+    {
+        for(auto& rowOfPixels : display) {
+            for(auto& pixel : rowOfPixels) {
+                pixel = 0;
+            }
+        }
+    }
+
+    // Fill the output buffer from sample nextOutputSample up to but not including endSample with the current
+    // audio state, handing the buffer to emitAudio each time it fills.
+    void synthesizeAudio(uint64_t endSample)
+    {
+        if(audioMuted && !audioRecorded && (nextOutputSample < endSample)) {
+            nextOutputSampleTime += outputSampleStep * (endSample - nextOutputSample);
+            nextOutputSample = endSample;
+            return;
+        }
+        while(nextOutputSample < endSample) {
+            size_t bufferIndex = nextOutputSample % audioOutputBufferSize;
+            size_t count = std::min(endSample - nextOutputSample, (uint64_t)(audioOutputBufferSize - bufferIndex));
+            if(audioActive) {
+                const std::vector<uint8_t>& waveform = *currentWaveform;
+                size_t phase = (nextOutputSample - audioStartOutputSample) % waveformPeriod;
+                size_t copied = 0;
+                while(copied < count) {
+                    size_t run = std::min(count - copied, waveformPeriod - phase);
+                    memcpy(audioOutputBuffer + bufferIndex + copied, waveform.data() + phase, run);
+                    copied += run;
+                    phase = 0;
+                }
+                currentAudioSample = audioOutputBuffer[bufferIndex + count - 1];
+            } else {
+                memset(audioOutputBuffer + bufferIndex, currentAudioSample, count);
+            }
+            nextOutputSample += count;
+            nextOutputSampleTime += outputSampleStep * count;
+            if(bufferIndex + count == audioOutputBufferSize) {
+                emitAudio(audioOutputBuffer, audioOutputBufferSize);
+            }
+        }
+    }
+
+    // Emit every output sample strictly before clk so a state change at clk starts on the right sample.
+    void synthesizeAudioBefore(const Clock& clk)
+    {
+        synthesizeAudio(firstOutputSampleAtOrAfter(clk.clocks));
+    }
+
+    // Return the system clock of the last sample in the current output
+    // buffer, which is the next time the interface has to do any work.
+    clk_t calculateNextActivity()
+    {
+        uint64_t lastSampleInBuffer = (nextOutputSample / audioOutputBufferSize + 1) * audioOutputBufferSize - 1;
+        clk_fixed_t time = nextOutputSampleTime + outputSampleStep * (lastSampleInBuffer - nextOutputSample);
+        return (clk_t)((time + ((clk_fixed_t)1 << ClockFractionBits) - 1) >> ClockFractionBits);
+    }
+
+    // Synthesize all output samples at or before systemClock.
+    // Does not repeat work if called twice with same clock.
+    void updatePastClock(const Clock& systemClock)
+    {
+        synthesizeAudio(firstOutputSampleAtOrAfter(systemClock.clocks + 1));
+    }
+};
+
+// No window and no audio device; the host drives the keys with setKey()
+// and reads display directly.  Audio timing is kept but samples are dropped.
+struct HeadlessInterface : public EmulatedInterface
+{
+    HeadlessInterface(ChipPlatform platform, const Clock& systemClock) :
+        EmulatedInterface(platform, systemClock)
+    {
+        audioMuted = true;
+    }
+
+    void emitAudio(const uint8_t *, size_t) override {}
+};
+
+// Advance one instance until its system clock reaches endClock, doing CPU
+// and interface work in clock order.  Returns early, with the clock just
+// past the offending instruction, on an unsupported instruction.
+template <class INTERFACE>
+typename Chip8Interpreter<Memory,INTERFACE>::StepResult emulateUntil(Chip8Interpreter<Memory,INTERFACE>& chip8, Memory& memory, INTERFACE& interface, Clock& systemClock, clk_t endClock)
+{
+    while(systemClock.clocks < endClock) {
+        clk_t nextCPU = chip8.calculateNextActivity();
+        clk_t nextInterface = interface.calculateNextActivity();
+        if(nextCPU < nextInterface) {
+            typename Chip8Interpreter<Memory,INTERFACE>::StepResult result = chip8.updatePastClock(memory, interface, systemClock);
+            systemClock.clocks = nextCPU;
+            if(result == Chip8Interpreter<Memory,INTERFACE>::UNSUPPORTED_INSTRUCTION) {
+                return result;
+            }
+        } else {
+            interface.updatePastClock(systemClock);
+            systemClock.clocks = nextInterface;
+        }
+    }
+    return Chip8Interpreter<Memory,INTERFACE>::CONTINUE;
+}
+
+#endif /* CHIP8_H */
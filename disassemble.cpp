@@ -0,0 +1,365 @@
+#include <cstdio>
+#include <cstdint>
+#include "disassemble.h"
+
+InstructionShape instructionShape(uint16_t instructionWord)
+{
+    uint8_t low = instructionWord & 0xFF;
+
+    switch(instructionWord >> 12) {
+        case 0x0: {
+            uint16_t sysOpcode = instructionWord & 0xFFF;
+            if(sysOpcode == 0x0EE) {
+                return {FLOW_RETURN, 2};
+            } else if(sysOpcode == 0x0FD) {
+                return {FLOW_EXIT, 2};
+            }
+            return {FLOW_NEXT, 2};
+        }
+        case 0x1: return {FLOW_JUMP, 2};
+        case 0x2: return {FLOW_CALL, 2};
+        case 0x3: case 0x4: case 0x9: return {FLOW_SKIP, 2};
+        case 0x5: return {((instructionWord & 0xF) == 0x0) ? FLOW_SKIP : FLOW_NEXT, 2};
+        case 0xB: return {FLOW_JUMP_V0, 2};
+        case 0xE: return {((low == 0x9E) || (low == 0xA1)) ? FLOW_SKIP : FLOW_NEXT, 2};
+        case 0xF: return {FLOW_NEXT, (instructionWord == 0xF000) ? 4 : 2};
+        default: return {FLOW_NEXT, 2};
+    }
+}
+
+void disassemble(uint16_t pc, uint16_t instructionWord, uint16_t wordAfter)
+{
+    enum InstructionHighNybble
+    {
+        INSN_SYS = 0x0,
+        INSN_JP = 0x1,
+        INSN_CALL = 0x2,
+        INSN_SE_IMM = 0x3,
+        INSN_SNE_IMM = 0x4,
+        INSN_HIGH5 = 0x5,
+        INSN_LD_IMM = 0x6,
+        INSN_ADD_IMM = 0x7,
+        INSN_ALU = 0x8,
+        INSN_SNE_REG = 0x9,
+        INSN_LD_I = 0xA,
+        INSN_JP_V0 = 0xB,
+        INSN_RND = 0xC,
+        INSN_DRW = 0xD,
+        INSN_SKP = 0xE,
+        INSN_LD_SPECIAL = 0xF,
+    };
+
+    enum Series5Opcode // 5XYN low nybble
+    {
+        HIGH5_SE_REG = 0x0,
+        HIGH5_LD_I_VXVY = 0x2,
+        HIGH5_LD_VXVY_I = 0x3,
+    };
+
+    enum SYSOpcode
+    {
+        SYS_CLS = 0x0E0,
+        SYS_RET = 0x0EE,
+        SYS_SCROLL_DOWN = 0x0C0,
+        SYS_SCROLL_UP = 0x0D0,
+        SYS_SCROLL_RIGHT_4 = 0xFB,
+        SYS_SCROLL_LEFT_4 = 0xFC,
+        SYS_EXIT = 0xFD,
+        SYS_ORIGINAL_SCREEN = 0xFE,
+        SYS_EXTENDED_SCREEN = 0xFF,
+    };
+
+    enum SPECIALOpcode
+    {
+        SPECIAL_GET_DELAY = 0x07,
+        SPECIAL_KEYWAIT = 0x0A,
+        SPECIAL_SET_DELAY = 0x15,
+        SPECIAL_SET_SOUND = 0x18,
+        SPECIAL_ADD_INDEX = 0x1E,
+        SPECIAL_LD_DIGIT = 0x29,
+        SPECIAL_LD_BCD = 0x33,
+        SPECIAL_LD_IVX = 0x55,
+        SPECIAL_LD_VXI = 0x65,
+        SPECIAL_STORE_RPL = 0x75, // XXX ignored 
+        SPECIAL_LD_RPL = 0x85, // XXX ignored 
+        SPECIAL_LD_BIGDIGIT = 0x30,
+        SPECIAL_LD_I_16BIT = 0x00,
+        SPECIAL_SET_PLANES = 0x01,
+        SPECIAL_SET_AUDIO = 0x02,
+    };
+
+    enum SKPOpcode {
+        SKP_KEY = 0x9E,
+        SKNP_KEY = 0xA1,
+    };
+
+    enum ALUOpcode {
+        ALU_LD = 0x0,
+        ALU_OR = 0x1,
+        ALU_AND = 0x2,
+        ALU_XOR = 0x3,
+        ALU_ADD = 0x4,
+        ALU_SUB = 0x5,
+        ALU_SHR = 0x6,
+        ALU_SUBN = 0x7,
+        ALU_SHL = 0xE,
+    };
+
+    uint8_t imm8Argument = instructionWord & 0x00FF;
+    uint8_t imm4Argument = instructionWord & 0x000F;
+    uint16_t imm12Argument = instructionWord & 0x0FFF;
+    uint16_t xArgument = (instructionWord & 0x0F00) >> 8;
+    uint16_t yArgument = (instructionWord & 0x00F0) >> 4;
+    int highNybble = instructionWord >> 12;
+
+    switch(highNybble) {
+        case INSN_SYS: {
+            uint16_t sysOpcode = instructionWord & 0xFFF;
+            switch(sysOpcode) {
+                case SYS_CLS: { // 00E0 - CLS - Clear the display.
+                    printf("%04X: (%04X) CLS\n", pc, instructionWord);
+                    break;
+                }
+                case SYS_RET: { //  00EE - RET - Return from a subroutine.  The interpreter sets the program counter to the address at the top of the stack, then subtracts 1 from the stack pointer.
+                    printf("%04X: (%04X) RET\n", pc, instructionWord);
+                    break;
+                }
+                case SYS_SCROLL_RIGHT_4: { // 00FB*    Scroll display 4 pixels right
+                    printf("%04X: (%04X) SCROLLRIGHT 4\n", pc, instructionWord);
+                    break;
+                }
+                case SYS_SCROLL_LEFT_4: { // 00FC*    Scroll display 4 pixels left
+                    printf("%04X: (%04X) SCROLLLEFT 4\n", pc, instructionWord);
+                    break;
+                }
+                case SYS_EXIT: { // 00FD*    Exit CHIP interpreter
+                    printf("%04X: (%04X) EXIT\n", pc, instructionWord);
+                    break;
+                }
+                case SYS_EXTENDED_SCREEN: { // 00FF*    Enable extended screen mode for full-screen graphics
+                    printf("%04X: (%04X) EXTENDEDSCREEN\n", pc, instructionWord);
+                    break;
+                }
+                case SYS_ORIGINAL_SCREEN: { // 00FE*    Disable extended screen mode
+                    printf("%04X: (%04X) ORIGINALSCREEN\n", pc, instructionWord);
+                    break;
+                }
+                default : { // Opcode undefined or is a range
+                    if((sysOpcode & 0xFF0) == SYS_SCROLL_UP) {
+                        printf("%04X: (%04X) SCROLLUP %d\n", pc, instructionWord, imm4Argument);
+                    } else if((sysOpcode & 0xFF0) == SYS_SCROLL_DOWN) {
+                        printf("%04X: (%04X) SCROLLDN %d\n", pc, instructionWord, imm4Argument);
+                    } else {
+                        printf("%04X: (%04X) ???\n", pc, instructionWord);
+                    }
+                    break;
+                }
+            }
+            break;
+        }
+        case INSN_JP: { // 1nnn - JP addr - Jump to location nnn.  The interpreter sets the program counter to nnn.
+            printf("%04X: (%04X) JP %X\n", pc, instructionWord, imm12Argument);
+            break;
+        }
+        case INSN_CALL: { // 2nnn - CALL addr - Call subroutine at nnn.  The interpreter increments the stack pointer, then puts the current PC on the top of the stack. The PC is then set to nnn.
+            printf("%04X: (%04X) CALL %X\n", pc, instructionWord, imm12Argument);
+            break;
+        }
+        case INSN_SE_IMM: { // 3xkk - SE Vx, byte - Skip next instruction if Vx = kk.  The interpreter compares register Vx to kk, and if they are equal, increments the program counter by 2.
+            printf("%04X: (%04X) SE V%X %X\n", pc, instructionWord, xArgument, imm8Argument);
+            break;
+        }
+        case INSN_SNE_IMM: { // 4xkk - SNE Vx, byte - Skip next instruction if Vx != kk.  The interpreter compares register Vx to kk, and if they are not equal, increments the program counter by 2.
+            printf("%04X: (%04X) SNE V%X %X\n", pc, instructionWord, xArgument, imm8Argument);
+            break;
+        }
+        case INSN_HIGH5: {
+            uint8_t opcode = instructionWord & 0xF;
+            switch(opcode) {
+                case HIGH5_LD_I_VXVY : { // save vx - vy (0x5XY2) save an inclusive range of registers to memory starting at i.
+                    printf("%04X: (%04X) LD I V%X %X\n", pc, instructionWord, xArgument, imm8Argument);
+                    break;
+                }
+                case HIGH5_LD_VXVY_I : { // load vx - vy (0x5XY3) load an inclusive range of registers from memory starting at i.
+                    printf("%04X: (%04X) LD V%X %X I\n", pc, instructionWord, xArgument, imm8Argument);
+                    break;
+                }
+                case HIGH5_SE_REG : { // 5xy0 - SE Vx, Vy - Skip next instruction if Vx = Vy.  The interpreter compares register Vx to register Vy, and if they are equal, increments the program counter by 2.
+                    printf("%04X: (%04X) SE V%X V%X\n", pc, instructionWord, xArgument, yArgument);
+                    break;
+                }
+                default : {
+                    printf("%04X: (%04X) ???\n", pc, instructionWord);
+                    break;
+                }
+            }
+            break;
+        }
+        case INSN_LD_IMM: { // 6xkk - LD Vx, byte - Set Vx = kk.  The interpreter puts the value kk into register Vx.  
+            printf("%04X: (%04X) LD V%X %X\n", pc, instructionWord, xArgument, imm8Argument);
+            break;
+        }
+        case INSN_ADD_IMM: { // 7xkk - ADD Vx, byte - Set Vx = Vx + kk.  Adds the value kk to the value of register Vx, then stores the result in Vx.
+            printf("%04X: (%04X) ADD V%X, %X\n", pc, instructionWord, xArgument, imm8Argument);
+            break;
+        }
+        case INSN_ALU: {
+            int opcode = instructionWord & 0x000F;
+            switch(opcode) {
+                case ALU_LD: { // 8xy0 - LD Vx, Vy - Set Vx = Vy.  Stores the value of register Vy in register Vx.  
+                    printf("%04X: (%04X) LD V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
+                    break;
+                }
+                case ALU_OR: { // 8xy1 - OR Vx, Vy - Set Vx = Vx OR Vy.
+                    printf("%04X: (%04X) OR V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
+                    break;
+                }
+                case ALU_AND: { // 8xy2 - AND Vx, Vy - Set Vx = Vx AND Vy.
+                    printf("%04X: (%04X) AND V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
+                    break;
+                }
+                case ALU_XOR: { // 8xy3 - XOR Vx, Vy -  Set Vx = Vx XOR Vy.
+                    printf("%04X: (%04X) XOR V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
+                    break;
+                }
+                case ALU_ADD: { // 8xy4 - ADD Vx, Vy - Set Vx = Vx + Vy, set VF = carry.  The values of Vx and Vy are added together. If the result is greater than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept, and stored in Vx.
+                    printf("%04X: (%04X) ADD V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
+                    break;
+                }
+                case ALU_SUB: { // 8xy5 - SUB Vx, Vy - Set Vx = Vx - Vy, set VF = NOT borrow.  If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
+                    printf("%04X: (%04X) SUB V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
+                    break;
+                }
+                case ALU_SUBN: { // 8xy7 - SUBN Vx, Vy - Set Vx = Vy - Vx, set VF = NOT borrow.  If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
+                    printf("%04X: (%04X) SUBN V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
+                    break;
+                }
+                case ALU_SHR: { // 8xy6 - SHR Vx {, Vy} - Set Vx = Vy SHR 1.  If the least-significant bit of Vy is 1, then VF is set to 1, otherwise 0. Then Vx is Vy divided by 2. (if shift.quirk, Vx = Vx SHR 1)
+                    printf("%04X: (%04X) SHR V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
+                    break;
+                }
+                case ALU_SHL: { // 8xyE - SHL Vx {, Vy} - Set Vx = Vx SHL 1.  If the most-significant bit of Vy is 1, then VF is set to 1, otherwise to 0. Then Vx is Vy multiplied by 2.   (if shift.quirk, Vx = Vx SHL 1)
+                    printf("%04X: (%04X) SHL V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
+                    break;
+                }
+                default : {
+                    printf("%04X: (%04X) ???\n", pc, instructionWord);
+                    break;
+                }
+            }
+            break;
+        }
+        case INSN_SNE_REG: { // 9xy0 - SNE Vx, Vy - Skip next instruction if Vx != Vy.  The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.  
+            printf("%04X: (%04X) SNE V%X V%X\n", pc, instructionWord, xArgument, yArgument);
+            break;
+        }
+        case INSN_LD_I: { // Annn - LD I, addr - Set I = nnn.  
+            printf("%04X: (%04X) LD I %X\n", pc, instructionWord, imm12Argument);
+            break;
+        }
+        case INSN_JP_V0: { // Bnnn - JP V0, addr - Jump to location nnn + V0.
+            printf("%04X: (%04X) JP V0, %X\n", pc, instructionWord, imm12Argument);
+            break;
+        }
+        case INSN_RND: { // Cxkk - RND Vx, byte - Set Vx = random byte AND kk.  The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk. The results are stored in Vx. See instruction 8xy2 for more information on AND.
+            printf("%04X: (%04X) RND V%X, %X\n", pc, instructionWord, xArgument, imm8Argument);
+            break;
+        }
+        case INSN_DRW: { // Dxyn - DRW Vx, Vy, nibble
+            printf("%04X: (%04X) DRW V%X, V%X, %X\n", pc, instructionWord, xArgument, yArgument, imm4Argument);
+            break;
+        }
+        case INSN_SKP: {
+            int opcode = instructionWord & 0xFF;
+            switch(opcode) {
+                case SKP_KEY: { // Ex9E - SKP Vx - Skip next instruction if key with the value of Vx is pressed.  Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, PC is increased by 2.
+                    printf("%04X: (%04X) SKP V%X\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SKNP_KEY: { // ExA1 - SKNP Vx - Skip next instruction if key with the value of Vx is not pressed.  Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.
+                    printf("%04X: (%04X) SKNP V%X\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                default : {
+                    printf("%04X: (%04X) ???\n", pc, instructionWord);
+                    break;
+                }
+            }
+            break;
+        }
+        case INSN_LD_SPECIAL :{
+            int opcode = instructionWord & 0xFF;
+            switch(opcode) {
+                case SPECIAL_GET_DELAY: { // Fx07 - LD Vx, DT - Set Vx = delay timer value.  The value of DT is placed into Vx.
+                    printf("%04X: (%04X) LD V%X, DT\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_KEYWAIT: { // Fx0A - LD Vx, K - Wait for a key press, store the value of the key in Vx.  All execution stops until a key is pressed, then the value of that key is stored in Vx.  
+                    printf("%04X: (%04X) LD V%X, K\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_SET_DELAY: { // Fx15 - LD DT, Vx - Set delay timer = Vx.  DT is set equal to the value of Vx.
+                    printf("%04X: (%04X) LD DT, V%X\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_SET_SOUND: { // Fx18 - LD ST, Vx - Set sound timer = Vx.  ST is set equal to the value of Vx.  
+                    printf("%04X: (%04X) LD ST, V%X\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_ADD_INDEX: { // Fx1E - ADD I, Vx - Set I = I + Vx.  The values of I and Vx are added, and the results are stored in I.  
+                    printf("%04X: (%04X) ADD I, V%X\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_LD_DIGIT: { // Fx29 - LD F, Vx - Set I = location of sprite for digit Vx.  The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the Chip-8 hexadecimal font.  
+                    printf("%04X: (%04X) LD F, V%X\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_LD_BIGDIGIT: { // FX30* - Point I to 10-byte font sprite for digit VX (0..9)
+                    printf("%04X: (%04X) LD BIGF, V%X\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_LD_BCD: { // Fx33 - LD B, Vx - Store BCD representation of Vx in memory locations I, I+1, and I+2.  The interpreter takes the decimal value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.
+                    printf("%04X: (%04X) LD B, V%X\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_LD_IVX: { // Fx55 - LD [I], Vx - Store registers V0 through Vx in memory starting at location I.  The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.  
+                    printf("%04X: (%04X) LD [I], V%X\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_LD_VXI: { // Fx65 - LD Vx, [I] - Read registers V0 through Vx from memory starting at location I.  The interpreter reads values from memory starting at location I into registers V0 through Vx.
+                    printf("%04X: (%04X) LD V%X, [I]\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_STORE_RPL: {
+                    printf("%04X: (%04X) ???\n", pc, instructionWord);
+                    break;
+                }
+                case SPECIAL_LD_RPL: {
+                    printf("%04X: (%04X) ???\n", pc, instructionWord);
+                    break;
+                }
+                case SPECIAL_LD_I_16BIT: { // F000 NNNN
+                    if(instructionShape(instructionWord).size == 4) {
+                        printf("%04X: (%04X) LD I %04X\n", pc, instructionWord, wordAfter);
+                    } else {
+                        printf("%04X: (%04X) ???\n", pc, instructionWord);
+                    }
+                    break;
+                }
+                case SPECIAL_SET_PLANES: { // plane n (0xFN01) select zero or more drawing planes by bitmask (0 <= n <= 3).
+                    printf("%04X: (%04X) PLANES %04X\n", pc, instructionWord, xArgument);
+                    break;
+                }
+                case SPECIAL_SET_AUDIO: { // audio (0xF002) store 16 bytes starting at i in the audio pattern buffer. 
+                    printf("%04X: (%04X) AUDIO\n", pc, instructionWord);
+                    break;
+                }
+                default : {
+                    printf("%04X: (%04X) ???\n", pc, instructionWord);
+                    break;
+                }
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef DISASSEMBLE_H
+#define DISASSEMBLE_H
+
+#include <cstdint>
+
+// How execution continues after an instruction.
+enum InstructionFlow
+{
+    FLOW_NEXT,          // continues at the following instruction
+    FLOW_SKIP,          // continues at the following instruction or skips it
+    FLOW_JUMP,          // 1NNN
+    FLOW_CALL,          // 2NNN
+    FLOW_JUMP_V0,       // BNNN
+    FLOW_RETURN,        // 00EE
+    FLOW_EXIT,          // 00FD
+};
+
+struct InstructionShape
+{
+    InstructionFlow flow;
+    int size;           // in bytes; 4 for F000 NNNN, otherwise 2
+};
+
+// Length and control flow of the instruction starting with instructionWord.
+// disassemble() and the ROM analysis both take instruction boundaries from
+// here, so an opcode's length only has to be described once.
+InstructionShape instructionShape(uint16_t instructionWord);
+
+// Print one line of CHIP-8/SCHIP/XO-CHIP disassembly for the instruction at pc.
+// wordAfter is only used by the 4-byte XO-CHIP "F000 NNNN" instruction.
+void disassemble(uint16_t pc, uint16_t instructionWord, uint16_t wordAfter);
+
+#endif /* DISASSEMBLE_H */
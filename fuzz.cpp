@@ -0,0 +1,103 @@
+#include <array>
+#include <memory>
+#include "chip8.h"
+
+// libFuzzer target for the interpreter, built by the XOCHIP_FUZZ CMake
+// option with AddressSanitizer and UndefinedBehaviorSanitizer.  Asserts
+// stay enabled, so a failed assert is reported as a crash like any other.
+// The interpreter reports unsupported instructions on stderr; run with
+// -close_fd_mask=2 to keep them from slowing the fuzzer down, e.g.
+//     xochip_fuzz -close_fd_mask=2 -max_len=4096 corpus/
+//
+// Input layout:
+//   byte 0      platform, modulo 3 (ChipPlatform)
+//   byte 1      quirk bits (QUIRKS_*)
+//   byte 2      instructions per field, minus 1
+//   byte 3      fields to run, minus 1, modulo FuzzMaximumFields
+//   byte 4      key event count, modulo FuzzMaximumKeyEvents
+//   then        two bytes per key event: the field it happens in (modulo
+//               the field count) and the key in the low nybble, pressed
+//               if bit 7 is set
+//   the rest    the ROM, loaded at 0x200 and truncated to fit
+//
+// One instance per platform lives for the whole run.  Between inputs,
+// memory is reset by copying back only the pages written since the last
+// reset, and the interpreter and interface are reset in place, so an
+// execution costs about as much as the instructions it runs.
+
+constexpr int FuzzMaximumFields = 8;
+constexpr int FuzzMaximumKeyEvents = 16;
+constexpr size_t FuzzHeaderSize = 5;
+constexpr uint32_t FuzzSeed = 1;
+
+struct FuzzInstance
+{
+    typedef Chip8Interpreter<Memory,HeadlessInterface> Interpreter;
+
+    Memory pristine;
+    Memory memory;
+    Clock systemClock;
+    HeadlessInterface interface;
+    Interpreter chip8;
+
+    FuzzInstance(ChipPlatform platform) :
+        pristine(platform),
+        memory(pristine),
+        systemClock(SystemClockRate),
+        interface(platform, systemClock),
+        chip8(0x200, platform, QUIRKS_NONE, FieldsPerSecond, systemClock)
+    {
+        memory.dirtyPages.fill(0);
+    }
+
+    void reset(uint32_t quirks, int ticksPerField)
+    {
+        memory.restoreDirtyPages(pristine);
+        systemClock = Clock(SystemClockRate);
+        interface.reset(systemClock);
+        chip8.reset(0x200, ticksPerField * FieldsPerSecond, systemClock);
+        chip8.quirks = quirks;
+        chip8.e1.seed(FuzzSeed);
+    }
+};
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static std::array<std::unique_ptr<FuzzInstance>, 3> instances;
+
+    if(size < FuzzHeaderSize) {
+        return 0;
+    }
+    ChipPlatform platform = (ChipPlatform)(data[0] % 3);
+    uint32_t quirks = data[1] & (QUIRKS_SHIFT | QUIRKS_LOAD_STORE | QUIRKS_JUMP | QUIRKS_CLIP | QUIRKS_VFORDER | QUIRKS_LOGIC | QUIRKS_VBLANK);
+    int ticksPerField = 1 + data[2];
+    int fields = 1 + data[3] % FuzzMaximumFields;
+    size_t keyEvents = data[4] % FuzzMaximumKeyEvents;
+    if(size < FuzzHeaderSize + keyEvents * 2) {
+        return 0;
+    }
+    const uint8_t *events = data + FuzzHeaderSize;
+    const uint8_t *rom = events + keyEvents * 2;
+    size_t romSize = size - (rom - data);
+
+    if(!instances[platform]) {
+        instances[platform] = std::make_unique<FuzzInstance>(platform);
+    }
+    FuzzInstance& instance = *instances[platform];
+    instance.reset(quirks, ticksPerField);
+    instance.memory.load(0x200, rom, std::min(romSize, instance.memory.addressSpaceSize() - 0x200));
+
+    for(int field = 0; field < fields; field++) {
+        for(size_t i = 0; i < keyEvents; i++) {
+            if(events[i * 2] % fields == field) {
+                instance.interface.setKey(events[i * 2 + 1] & 0xf, (events[i * 2 + 1] & 0x80) != 0);
+            }
+        }
+        clk_t fieldEnd = (field + 1) * SystemClocksPerField;
+        if(emulateUntil(instance.chip8, instance.memory, instance.interface, instance.systemClock, fieldEnd) ==
+            FuzzInstance::Interpreter::UNSUPPORTED_INSTRUCTION) {
+            break;
+        }
+    }
+    return 0;
+}
@@ -4,6 +4,11 @@
 #include <sstream>
 #include <nlohmann/json.hpp>
 #include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "pack.h"
 
 std::map<std::string, uint32_t> colorsByName = {
     {"aquamarine", 0x7fffd4},
@@ -32,7 +37,7 @@ uint32_t expand12BitColorTo24(uint32_t color)
     return (r << 16) | (g << 8) | (b << 0);
 }
 
-std::string convertToHexColor(const std::string& name)
+uint32_t convertToColor(const std::string& name)
 {
     uint32_t color;
 
@@ -52,6 +57,11 @@ std::string convertToHexColor(const std::string& name)
         }
     }
 
+    return color;
+}
+
+std::string hexColor(uint32_t color)
+{
     std::stringstream ss;
     ss << std::setfill('0') << std::setw(6) << std::hex << color;
     return ss.str();
@@ -70,103 +80,171 @@ bool hasTrueOption(const nlohmann::json& options, const std::string& name)
     }
 }
 
-int main(int argc, char **argv)
+// Launch settings for one program as resolved from programs.json; also
+// the contents of a pack file entry.
+PackEntry launchSettings(const nlohmann::json& program)
 {
-    if(argc < 2) {
-        std::cerr << "usage: " << argv[0] << " programs.json [romsdir programToRun]\n";
-        exit(EXIT_FAILURE);
-    }
-
-    std::ifstream programsFile(argv[1]);
-    nlohmann::json programs;
-    programsFile >> programs;
-
-    if(argc < 4) {
-        size_t maxlength = 0;
-        for (const auto& [program, specifics] : programs.items()) {
-            maxlength = std::max(program.length(), maxlength);
-        }
-        for (const auto& [program, specifics] : programs.items()) {
-            std::cout << std::setw(maxlength) << program << std::setw(0) << " : " << specifics["title"] << "\n";
-            std::cout << std::setw(maxlength) << "" << std::setw(0) << "   " << specifics["desc"] << "\n";
-        }
-        exit(EXIT_SUCCESS);
-    }
-
-    std::string romsDir = argv[2];
-    std::string chosenProgram = argv[3];
-
-    if(!programs.contains(chosenProgram)) {
-        std::cerr << "unknown program \"" << chosenProgram << "\"\n";
-        exit(EXIT_FAILURE);
-    }
-
-    const auto& program = programs[chosenProgram];
-
-    std::vector<std::string> emulatorArgs;
-
-    emulatorArgs.push_back("xochip");
+    PackEntry settings;
+    memset(&settings, 0, sizeof(settings));
 
     if(program["platform"] == "schip") {
-        emulatorArgs.push_back("--platform schip");
+        settings.platform = PACK_PLATFORM_SCHIP;
     } else if(program["platform"] == "xochip") {
-        emulatorArgs.push_back("--platform xochip");
+        settings.platform = PACK_PLATFORM_XOCHIP;
+    } else {
+        settings.platform = PACK_PLATFORM_CHIP8;
     }
 
     const auto& options = program["options"];
     if(options.contains("tickrate")) {
         if(options["tickrate"].type() == nlohmann::json::value_t::string) {
-            emulatorArgs.push_back("--rate " + options["tickrate"].get<std::string>());
+            settings.ticksPerField = atoi(options["tickrate"].get<std::string>().c_str());
         } else {
-            emulatorArgs.push_back("--rate " + std::to_string(options["tickrate"].get<int>()));
+            settings.ticksPerField = options["tickrate"].get<int>();
         }
     }
 
-    if(options.contains("backgroundColor")) {
-        emulatorArgs.push_back("--color 0 " + convertToHexColor(options["backgroundColor"]));
-    }
-    if(options.contains("fillColor")) {
-        emulatorArgs.push_back("--color 1 " + convertToHexColor(options["fillColor"]));
-    }
-    if(options.contains("fillColor2")) {
-        emulatorArgs.push_back("--color 2 " + convertToHexColor(options["fillColor2"]));
-    }
-    if(options.contains("blendColor")) {
-        emulatorArgs.push_back("--color 3 " + convertToHexColor(options["blendColor"]));
+    static const char *colorOptions[4] = {"backgroundColor", "fillColor", "fillColor2", "blendColor"};
+    for(int i = 0; i < 4; i++) {
+        if(options.contains(colorOptions[i])) {
+            settings.colors[i] = convertToColor(options[colorOptions[i]]);
+            settings.colorsSet |= 1 << i;
+        }
     }
     if(options.contains("screenRotation")) {
-        emulatorArgs.push_back("--rotation " + std::to_string(options["screenRotation"].get<int>()));
+        settings.rotation = options["screenRotation"].get<int>();
     }
 
     if(hasTrueOption(options, "shiftQuirks")) {
-        emulatorArgs.push_back("--quirk shift");
+        settings.quirks |= PACK_QUIRK_SHIFT;
     }
 
     if(hasTrueOption(options, "loadStoreQuirks")) {
-        emulatorArgs.push_back("--quirk loadstore");
+        settings.quirks |= PACK_QUIRK_LOAD_STORE;
     }
 
     if(hasTrueOption(options, "logicQuirks")) {
-        emulatorArgs.push_back("--quirk logic");
+        settings.quirks |= PACK_QUIRK_LOGIC;
     }
 
     if(hasTrueOption(options, "vfOrderQuirks")) {
-        emulatorArgs.push_back("--quirk vforder");
+        settings.quirks |= PACK_QUIRK_VFORDER;
     }
 
     if(hasTrueOption(options, "clipQuirks")) {
-        emulatorArgs.push_back("--quirk clip");
+        settings.quirks |= PACK_QUIRK_CLIP;
     }
 
     if(hasTrueOption(options, "jumpQuirks")) {
-        emulatorArgs.push_back("--quirk jump");
+        settings.quirks |= PACK_QUIRK_JUMP;
     }
 
-    // "vfOrderQuirks": false,
-    // "vBlankQuirks": false,
+    if(hasTrueOption(options, "vBlankQuirks")) {
+        settings.quirks |= PACK_QUIRK_VBLANK;
+    }
 
-    emulatorArgs.push_back(romsDir + "/" + chosenProgram + ".ch8");
+    return settings;
+}
+
+// Returns the xochip command line for one program as separate arguments,
+// so it can be passed to exec without being re-split by a shell.
+std::vector<std::string> emulatorArguments(const nlohmann::json& program, const std::string& xochipPath, const std::string& romsDir, const std::string& programName)
+{
+    PackEntry settings = launchSettings(program);
+    std::vector<std::string> emulatorArgs;
+
+    emulatorArgs.push_back(xochipPath);
+
+    if(settings.platform == PACK_PLATFORM_SCHIP) {
+        emulatorArgs.insert(emulatorArgs.end(), {"--platform", "schip"});
+    } else if(settings.platform == PACK_PLATFORM_XOCHIP) {
+        emulatorArgs.insert(emulatorArgs.end(), {"--platform", "xochip"});
+    }
+
+    if(settings.ticksPerField != 0) {
+        emulatorArgs.insert(emulatorArgs.end(), {"--rate", std::to_string(settings.ticksPerField)});
+    }
+
+    for(int i = 0; i < 4; i++) {
+        if(settings.colorsSet & (1 << i)) {
+            emulatorArgs.insert(emulatorArgs.end(), {"--color", std::to_string(i), hexColor(settings.colors[i])});
+        }
+    }
+    if(program["options"].contains("screenRotation")) {
+        emulatorArgs.insert(emulatorArgs.end(), {"--rotation", std::to_string(settings.rotation)});
+    }
+
+    static const std::pair<uint32_t, const char *> quirkNames[] = {
+        {PACK_QUIRK_SHIFT, "shift"},
+        {PACK_QUIRK_LOAD_STORE, "loadstore"},
+        {PACK_QUIRK_LOGIC, "logic"},
+        {PACK_QUIRK_VFORDER, "vforder"},
+        {PACK_QUIRK_CLIP, "clip"},
+        {PACK_QUIRK_JUMP, "jump"},
+        {PACK_QUIRK_VBLANK, "vblank"},
+    };
+    for(const auto& [quirk, name] : quirkNames) {
+        if(settings.quirks & quirk) {
+            emulatorArgs.insert(emulatorArgs.end(), {"--quirk", name});
+        }
+    }
+
+    emulatorArgs.push_back(romsDir + "/" + programName + ".ch8");
 
+    return emulatorArgs;
+}
+
+// Write a pack file holding the chosen programs' ROM images and launch settings.
+bool writePack(const std::string& packFilename, const nlohmann::json& programs, const std::string& romsDir, std::vector<std::string> chosenPrograms)
+{
+    std::sort(chosenPrograms.begin(), chosenPrograms.end());
+
+    std::vector<PackEntry> entries;
+    std::vector<std::vector<char>> images;
+    uint64_t offset = sizeof(PackFileHeader) + chosenPrograms.size() * sizeof(PackEntry);
+    for(const auto& chosenProgram: chosenPrograms) {
+        if(chosenProgram.length() >= PackNameLength) {
+            std::cerr << "program name \"" << chosenProgram << "\" is too long for a pack file\n";
+            return false;
+        }
+        std::string romFilename = romsDir + "/" + chosenProgram + ".ch8";
+        std::ifstream romFile(romFilename, std::ios::binary);
+        if(!romFile) {
+            std::cerr << "couldn't read \"" << romFilename << "\"\n";
+            return false;
+        }
+        images.emplace_back(std::istreambuf_iterator<char>(romFile), std::istreambuf_iterator<char>());
+
+        PackEntry entry = launchSettings(programs[chosenProgram]);
+        strcpy(entry.name, chosenProgram.c_str());
+        entry.offset = offset;
+        entry.size = images.back().size();
+        entries.push_back(entry);
+        offset += entry.size;
+    }
+
+    PackFileHeader header;
+    memcpy(header.magic, PackFileMagic, sizeof(header.magic));
+    header.version = PackFileVersion;
+    header.entryCount = entries.size();
+    header.entrySize = sizeof(PackEntry);
+
+    std::ofstream packFile(packFilename, std::ios::binary | std::ios::trunc);
+    packFile.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    packFile.write(reinterpret_cast<const char *>(entries.data()), entries.size() * sizeof(PackEntry));
+    for(const auto& image: images) {
+        packFile.write(image.data(), image.size());
+    }
+    packFile.close();
+    if(!packFile) {
+        std::cerr << "couldn't write \"" << packFilename << "\"\n";
+        return false;
+    }
+    return true;
+}
+
+void printCommandLine(const std::vector<std::string>& emulatorArgs)
+{
     bool first = true;
     for(const auto& arg: emulatorArgs) {
         if(!first) {
@@ -176,6 +254,173 @@ int main(int argc, char **argv)
         first = false;
     }
     std::cout << "\n";
+}
+
+std::vector<char *> makeArgv(const std::vector<std::string>& emulatorArgs)
+{
+    std::vector<char *> execArgs;
+    for(const auto& arg: emulatorArgs) {
+        execArgs.push_back(const_cast<char *>(arg.c_str()));
+    }
+    execArgs.push_back(nullptr);
+    return execArgs;
+}
+
+// Run xochip as a child and wait for it; returns true if it exited successfully.
+bool runEmulator(const std::vector<std::string>& emulatorArgs)
+{
+    pid_t pid = fork();
+    if(pid < 0) {
+        std::cerr << "fork failed: " << strerror(errno) << "\n";
+        return false;
+    }
+    if(pid == 0) {
+        std::vector<char *> execArgs = makeArgv(emulatorArgs);
+        execvp(execArgs[0], execArgs.data());
+        std::cerr << "couldn't run \"" << emulatorArgs[0] << "\": " << strerror(errno) << "\n";
+        _exit(127);
+    }
+    int status;
+    while(waitpid(pid, &status, 0) < 0) {
+        if(errno != EINTR) {
+            std::cerr << "waitpid failed: " << strerror(errno) << "\n";
+            return false;
+        }
+    }
+    return WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
+void usage(const char *name)
+{
+    std::cerr << "usage: " << name << " [options] programs.json [romsdir program [program...]]\n";
+    std::cerr << "options:\n";
+    std::cerr << "\t--exec             - run xochip directly instead of printing its command line;\n";
+    std::cerr << "\t                     several programs are run one after another\n";
+    std::cerr << "\t--all              - launch every program in programs.json\n";
+    std::cerr << "\t--xochip path      - emulator to run or print (default \"xochip\", found in PATH)\n";
+    std::cerr << "\t--pack file        - write the chosen ROMs and their settings to a pack file for xochip --pack\n";
+}
+
+int main(int argc, char **argv)
+{
+    const char *progname = argv[0];
+    argc -= 1;
+    argv += 1;
+
+    bool execEmulator = false;
+    bool allPrograms = false;
+    std::string xochipPath = "xochip";
+    const char *packFilename = nullptr;
+
+    while((argc > 0) && (argv[0][0] == '-')) {
+        if(strcmp(argv[0], "--exec") == 0) {
+            execEmulator = true;
+            argv += 1;
+            argc -= 1;
+
+        } else if(strcmp(argv[0], "--all") == 0) {
+            allPrograms = true;
+            argv += 1;
+            argc -= 1;
+
+        } else if(strcmp(argv[0], "--xochip") == 0) {
+            if(argc < 2) {
+                std::cerr << "--xochip requires an emulator path.\n";
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            xochipPath = argv[1];
+            argv += 2;
+            argc -= 2;
+
+        } else if(strcmp(argv[0], "--pack") == 0) {
+            if(argc < 2) {
+                std::cerr << "--pack requires an output filename.\n";
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            packFilename = argv[1];
+            argv += 2;
+            argc -= 2;
+
+        } else if(
+            (strcmp(argv[0], "-help") == 0) ||
+            (strcmp(argv[0], "-h") == 0) ||
+            (strcmp(argv[0], "-?") == 0))
+        {
+            usage(progname);
+            exit(EXIT_SUCCESS);
+
+        } else {
+            std::cerr << "unknown parameter \"" << argv[0] << "\"\n";
+            usage(progname);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(argc < 1) {
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    std::ifstream programsFile(argv[0]);
+    nlohmann::json programs;
+    programsFile >> programs;
+
+    if((argc < 3) && !((argc == 2) && allPrograms)) {
+        size_t maxlength = 0;
+        for (const auto& [program, specifics] : programs.items()) {
+            maxlength = std::max(program.length(), maxlength);
+        }
+        for (const auto& [program, specifics] : programs.items()) {
+            std::cout << std::setw(maxlength) << program << std::setw(0) << " : " << specifics["title"] << "\n";
+            std::cout << std::setw(maxlength) << "" << std::setw(0) << "   " << specifics["desc"] << "\n";
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    std::string romsDir = argv[1];
+
+    std::vector<std::string> chosenPrograms;
+    if(allPrograms) {
+        for (const auto& [program, specifics] : programs.items()) {
+            chosenPrograms.push_back(program);
+        }
+    }
+    for(int i = 2; i < argc; i++) {
+        if(!programs.contains(argv[i])) {
+            std::cerr << "unknown program \"" << argv[i] << "\"\n";
+            exit(EXIT_FAILURE);
+        }
+        chosenPrograms.push_back(argv[i]);
+    }
+
+    if(packFilename != nullptr) {
+        exit(writePack(packFilename, programs, romsDir, chosenPrograms) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // With one program, replace this process so signals and the exit status go straight to xochip
+    if(execEmulator && (chosenPrograms.size() == 1)) {
+        std::vector<std::string> emulatorArgs = emulatorArguments(programs[chosenPrograms[0]], xochipPath, romsDir, chosenPrograms[0]);
+        std::vector<char *> execArgs = makeArgv(emulatorArgs);
+        execvp(execArgs[0], execArgs.data());
+        std::cerr << "couldn't run \"" << emulatorArgs[0] << "\": " << strerror(errno) << "\n";
+        exit(EXIT_FAILURE);
+    }
+
+    int failures = 0;
+    for(const auto& chosenProgram: chosenPrograms) {
+        std::vector<std::string> emulatorArgs = emulatorArguments(programs[chosenProgram], xochipPath, romsDir, chosenProgram);
+        if(execEmulator) {
+            std::cerr << chosenProgram << "\n";
+            if(!runEmulator(emulatorArgs)) {
+                std::cerr << chosenProgram << ": xochip failed\n";
+                failures++;
+            }
+        } else {
+            printCommandLine(emulatorArgs);
+        }
+    }
 
-    exit(EXIT_SUCCESS);
+    exit((failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
 }
@@ -0,0 +1,311 @@
+#include <memory>
+#include <sstream>
+#include <string>
+
+#include "libxochip.h"
+#include "chip8.h"
+
+static_assert((XOCHIP_PLATFORM_CHIP8 == CHIP8) && (XOCHIP_PLATFORM_SCHIP == SCHIP_1_1) && (XOCHIP_PLATFORM_XOCHIP == XOCHIP), "library platforms must match ChipPlatform");
+static_assert((XOCHIP_QUIRK_SHIFT == QUIRKS_SHIFT) && (XOCHIP_QUIRK_LOAD_STORE == QUIRKS_LOAD_STORE) && (XOCHIP_QUIRK_JUMP == QUIRKS_JUMP) &&
+    (XOCHIP_QUIRK_CLIP == QUIRKS_CLIP) && (XOCHIP_QUIRK_VFORDER == QUIRKS_VFORDER) && (XOCHIP_QUIRK_LOGIC == QUIRKS_LOGIC) &&
+    (XOCHIP_QUIRK_VBLANK == QUIRKS_VBLANK), "library quirks must match QUIRKS_");
+
+// Keeps the audio generated during one xochip_step_frames call for the caller to read.
+struct LibraryInterface : public EmulatedInterface
+{
+    std::vector<uint8_t> audio;
+
+    LibraryInterface(ChipPlatform platform, const Clock& systemClock) :
+        EmulatedInterface(platform, systemClock)
+    {
+    }
+
+    void emitAudio(const uint8_t *samples, size_t count) override
+    {
+        audio.insert(audio.end(), samples, samples + count);
+    }
+};
+
+struct xochip
+{
+    typedef Chip8Interpreter<Memory,LibraryInterface> Interpreter;
+
+    uint32_t ticksPerField;
+    Clock systemClock;
+    clk_t fieldEnd;
+    Memory memory;
+    LibraryInterface interface;
+    Interpreter chip8;
+
+    xochip(ChipPlatform platform, uint32_t quirks, uint32_t ticksPerField) :
+        ticksPerField(ticksPerField),
+        systemClock(SystemClockRate),
+        fieldEnd(SystemClocksPerField),
+        memory(platform),
+        interface(platform, systemClock),
+        chip8(0x200, platform, quirks, ticksPerField * FieldsPerSecond, systemClock)
+    {
+    }
+};
+
+// Saved state layout: SavedStateHeader, then the fields in the order
+// visitState() visits them, in host byte order.
+constexpr char SavedStateMagic[4] = {'X', '8', 'S', 'T'};
+constexpr uint32_t SavedStateVersion = 3;
+
+struct SavedStateHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t platform;
+    uint32_t quirks;
+    uint32_t ticksPerField;
+    uint32_t reserved;
+};
+
+// Visits every saved field in order.  IO is StateWriter or StateReader.
+template <class IO>
+void visitState(IO& io, xochip& instance)
+{
+    xochip::Interpreter& chip8 = instance.chip8;
+    LibraryInterface& interface = instance.interface;
+
+    io.value(instance.systemClock.clocks);
+    io.value(instance.fieldEnd);
+    io.bytes(instance.memory.memory.data(), instance.memory.memory.size());
+
+    io.value(chip8.insnNumber);
+    io.bytes(chip8.registers.data(), chip8.registers.size());
+    io.bytes(chip8.RPL.data(), chip8.RPL.size());
+    io.stack(chip8.stack);
+    io.value(chip8.I);
+    io.value(chip8.pc);
+    io.value(chip8.DT);
+    io.value(chip8.DTNextDecrementTime);
+    io.value(chip8.ST);
+    io.value(chip8.STNextDecrementTime);
+    io.value(chip8.extendedScreenMode);
+    io.value(chip8.screenPlaneMask);
+    io.value(chip8.nextCycleTime);
+    io.value(chip8.displayWaitClock);
+    io.value(chip8.waitingForKeyPress);
+    io.value(chip8.waitingForKeyRelease);
+    io.value(chip8.keyPressed);
+    io.value(chip8.keyDestinationRegister);
+    io.random(chip8.e1);
+
+    io.bytes(&interface.display[0][0], sizeof(interface.display));
+    io.bytes(interface.audioSample.data(), interface.audioSample.size());
+    io.value(interface.audioActive);
+    io.value(interface.currentAudioSample);
+    io.value(interface.nextOutputSample);
+    io.value(interface.nextOutputSampleTime);
+    io.value(interface.audioStartOutputSample);
+    io.bytes(interface.audioOutputBuffer, sizeof(interface.audioOutputBuffer));
+}
+
+struct StateWriter
+{
+    uint8_t *buffer;
+    size_t capacity;
+    size_t size = 0;
+
+    void bytes(const void *data, size_t count)
+    {
+        if(size + count <= capacity) {
+            memcpy(buffer + size, data, count);
+        }
+        size += count;
+    }
+
+    template <class T>
+    void value(const T& v)
+    {
+        bytes(&v, sizeof(v));
+    }
+
+    void stack(const std::vector<uint16_t>& stack)
+    {
+        value((uint32_t)stack.size());
+        bytes(stack.data(), stack.size() * sizeof(uint16_t));
+    }
+
+    template <class ENGINE>
+    void random(const ENGINE& engine)
+    {
+        std::ostringstream text;
+        text << engine;
+        std::string state = text.str();
+        value((uint32_t)state.size());
+        bytes(state.data(), state.size());
+    }
+};
+
+struct StateReader
+{
+    const uint8_t *buffer;
+    size_t size;
+    size_t offset = 0;
+    bool failed = false;
+
+    void bytes(void *data, size_t count)
+    {
+        if(failed || (count > size - offset)) {
+            failed = true;
+            return;
+        }
+        memcpy(data, buffer + offset, count);
+        offset += count;
+    }
+
+    template <class T>
+    void value(T& v)
+    {
+        bytes(&v, sizeof(v));
+    }
+
+    void stack(std::vector<uint16_t>& stack)
+    {
+        uint32_t depth = 0;
+        value(depth);
+        if(failed || (depth > (size - offset) / sizeof(uint16_t))) {
+            failed = true;
+            return;
+        }
+        stack.resize(depth);
+        bytes(stack.data(), depth * sizeof(uint16_t));
+    }
+
+    template <class ENGINE>
+    void random(ENGINE& engine)
+    {
+        uint32_t length = 0;
+        value(length);
+        if(failed || (length > size - offset)) {
+            failed = true;
+            return;
+        }
+        std::istringstream text(std::string((const char *)buffer + offset, length));
+        text >> engine;
+        failed = text.fail();
+        offset += length;
+    }
+};
+
+extern "C" {
+
+void xochip_default_settings(xochip_settings *settings)
+{
+    settings->platform = XOCHIP_PLATFORM_CHIP8;
+    settings->quirks = 0;
+    settings->ticks_per_field = 7;
+    settings->seed = 0;
+}
+
+xochip *xochip_create(const uint8_t *rom, size_t size, const xochip_settings *settings)
+{
+    if((settings->platform < XOCHIP_PLATFORM_CHIP8) || (settings->platform > XOCHIP_PLATFORM_XOCHIP) || (settings->ticks_per_field < 1)) {
+        return nullptr;
+    }
+    xochip *instance = new xochip((ChipPlatform)settings->platform, settings->quirks, settings->ticks_per_field);
+    if(!instance->memory.load(0x200, rom, size)) {
+        delete instance;
+        return nullptr;
+    }
+    if(settings->seed != 0) {
+        instance->chip8.e1.seed(settings->seed);
+    }
+    return instance;
+}
+
+void xochip_destroy(xochip *instance)
+{
+    delete instance;
+}
+
+void xochip_set_key(xochip *instance, int key, int pressed)
+{
+    if((key >= 0) && (key < 16)) {
+        instance->interface.setKey(key, pressed != 0);
+    }
+}
+
+int xochip_step_frames(xochip *instance, unsigned frames)
+{
+    instance->interface.audio.clear();
+    for(; frames > 0; frames--) {
+        if(emulateUntil(instance->chip8, instance->memory, instance->interface, instance->systemClock, instance->fieldEnd) ==
+            xochip::Interpreter::UNSUPPORTED_INSTRUCTION) {
+            return XOCHIP_UNSUPPORTED_INSTRUCTION;
+        }
+        instance->fieldEnd += SystemClocksPerField;
+    }
+    return XOCHIP_OK;
+}
+
+const uint8_t *xochip_framebuffer(const xochip *instance)
+{
+    return &instance->interface.display[0][0];
+}
+
+const uint8_t *xochip_audio(const xochip *instance, size_t *count)
+{
+    *count = instance->interface.audio.size();
+    return instance->interface.audio.data();
+}
+
+int xochip_audio_rate(void)
+{
+    return AOSamplingRate;
+}
+
+uint64_t xochip_instruction_count(const xochip *instance)
+{
+    return instance->chip8.insnNumber;
+}
+
+size_t xochip_save_state(const xochip *instance, void *buffer, size_t capacity)
+{
+    SavedStateHeader header;
+    memcpy(header.magic, SavedStateMagic, sizeof(header.magic));
+    header.version = SavedStateVersion;
+    header.platform = instance->chip8.platform;
+    header.quirks = instance->chip8.quirks;
+    header.ticksPerField = instance->ticksPerField;
+    header.reserved = 0;
+
+    StateWriter writer{static_cast<uint8_t *>(buffer), capacity};
+    writer.value(header);
+    visitState(writer, const_cast<xochip&>(*instance));
+    return writer.size;
+}
+
+int xochip_restore_state(xochip *instance, const void *buffer, size_t size)
+{
+    StateReader reader{static_cast<const uint8_t *>(buffer), size};
+    SavedStateHeader header;
+    reader.value(header);
+    if(reader.failed || (memcmp(header.magic, SavedStateMagic, sizeof(header.magic)) != 0) ||
+        (header.version != SavedStateVersion) || (header.platform != (uint32_t)instance->chip8.platform) ||
+        (header.quirks != instance->chip8.quirks) || (header.ticksPerField != instance->ticksPerField)) {
+        return XOCHIP_BAD_STATE;
+    }
+
+    // Parse into a scratch instance first so a truncated or corrupt
+    // state leaves this one untouched; the second pass can't fail.
+    std::unique_ptr<xochip> scratch(new xochip(instance->chip8.platform, instance->chip8.quirks, instance->ticksPerField));
+    StateReader check = reader;
+    visitState(check, *scratch);
+    if(check.failed || (check.offset != size)) {
+        return XOCHIP_BAD_STATE;
+    }
+    visitState(reader, *instance);
+
+    LibraryInterface& interface = instance->interface;
+    interface.currentWaveform = &interface.cachedWaveform(interface.audioSample);
+    interface.displayChanged = true;
+    interface.audio.clear();
+    return XOCHIP_OK;
+}
+
+}
@@ -0,0 +1,101 @@
+#ifndef LIBXOCHIP_H
+#define LIBXOCHIP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * C interface to the xochip emulator core for embedding in other
+ * processes.  An instance runs headless: the caller sets keys, steps
+ * whole 60Hz frames, and reads the framebuffer and the audio generated
+ * during the step straight out of the instance's own buffers.
+ *
+ * Instances are independent; one instance must not be used from two
+ * threads at once.
+ */
+
+#if defined(_WIN32)
+#define XOCHIP_API __declspec(dllexport)
+#else
+#define XOCHIP_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct xochip xochip;
+
+/* Platforms, same values as the pack file and xochip --platform */
+#define XOCHIP_PLATFORM_CHIP8 0
+#define XOCHIP_PLATFORM_SCHIP 1
+#define XOCHIP_PLATFORM_XOCHIP 2
+
+/* Quirk bits, same meaning as xochip --quirk */
+#define XOCHIP_QUIRK_SHIFT 0x01
+#define XOCHIP_QUIRK_LOAD_STORE 0x02
+#define XOCHIP_QUIRK_JUMP 0x04
+#define XOCHIP_QUIRK_CLIP 0x08
+#define XOCHIP_QUIRK_VFORDER 0x10
+#define XOCHIP_QUIRK_LOGIC 0x20
+#define XOCHIP_QUIRK_VBLANK 0x40
+
+/* Results of xochip_step_frames and xochip_restore_state */
+#define XOCHIP_OK 0
+#define XOCHIP_UNSUPPORTED_INSTRUCTION 1
+#define XOCHIP_BAD_STATE 2
+
+#define XOCHIP_FRAMEBUFFER_WIDTH 128
+#define XOCHIP_FRAMEBUFFER_HEIGHT 64
+
+typedef struct xochip_settings
+{
+    int platform;               /* XOCHIP_PLATFORM_* */
+    uint32_t quirks;            /* XOCHIP_QUIRK_* bits */
+    int ticks_per_field;        /* instructions per 60Hz frame */
+    uint64_t seed;              /* random number seed for Cxkk, or 0 to seed from the system */
+} xochip_settings;
+
+/* Fill settings with xochip's defaults: CHIP-8, no quirks, 7 instructions per frame. */
+XOCHIP_API void xochip_default_settings(xochip_settings *settings);
+
+/* Create an instance with the ROM loaded at 0x200.  Returns NULL if the
+ * settings are invalid or the ROM doesn't fit the platform's memory. */
+XOCHIP_API xochip *xochip_create(const uint8_t *rom, size_t size, const xochip_settings *settings);
+XOCHIP_API void xochip_destroy(xochip *instance);
+
+/* key is 0 through 15 */
+XOCHIP_API void xochip_set_key(xochip *instance, int key, int pressed);
+
+/* Run frames 60Hz frames.  Stops early, just past the instruction, with
+ * XOCHIP_UNSUPPORTED_INSTRUCTION; calling again resumes the frame. */
+XOCHIP_API int xochip_step_frames(xochip *instance, unsigned frames);
+
+/* XOCHIP_FRAMEBUFFER_HEIGHT rows of XOCHIP_FRAMEBUFFER_WIDTH bytes, one
+ * byte per pixel with bit 0 set for plane 1 and bit 1 for plane 2.  In
+ * low-resolution mode every CHIP-8 pixel covers 2x2 bytes.  The pointer
+ * stays valid for the life of the instance and is updated in place. */
+XOCHIP_API const uint8_t *xochip_framebuffer(const xochip *instance);
+
+/* Unsigned 8-bit mono samples at xochip_audio_rate(), silence at 128,
+ * completed during the last xochip_step_frames call.  Valid until the
+ * next call that steps or restores the instance. */
+XOCHIP_API const uint8_t *xochip_audio(const xochip *instance, size_t *count);
+XOCHIP_API int xochip_audio_rate(void);
+
+XOCHIP_API uint64_t xochip_instruction_count(const xochip *instance);
+
+/* Write the instance's state into buffer if it holds capacity bytes or
+ * more.  Returns the size of the state either way, so a call with
+ * capacity 0 sizes the buffer.  Keys are not part of the state. */
+XOCHIP_API size_t xochip_save_state(const xochip *instance, void *buffer, size_t capacity);
+
+/* Restore state saved from an instance created with the same settings.
+ * Returns XOCHIP_BAD_STATE, leaving the instance unchanged, if it wasn't. */
+XOCHIP_API int xochip_restore_state(xochip *instance, const void *buffer, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBXOCHIP_H */
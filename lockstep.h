@@ -0,0 +1,213 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// Kernels for executing one CHIP-8 instruction across many emulator
+// copies at once.  State is structure-of-arrays: one array per register
+// holding that register for every lane.  mask[lane] is 0xFF for lanes
+// executing the instruction and 0 for lanes that must be left alone.
+// Lane counts are padded to LockstepLaneMultiple so the vector loops need
+// no remainder handling; padding lanes always have a zero mask.
+
+constexpr size_t LockstepLaneMultiple = 32;
+
+enum LockstepALUOp
+{
+    LOCKSTEP_MOV_IMM,   // 6xkk
+    LOCKSTEP_ADD_IMM,   // 7xkk
+    LOCKSTEP_MOV,       // 8xy0
+    LOCKSTEP_OR,        // 8xy1
+    LOCKSTEP_AND,       // 8xy2
+    LOCKSTEP_XOR,       // 8xy3
+    LOCKSTEP_ADD,       // 8xy4
+    LOCKSTEP_SUB,       // 8xy5
+    LOCKSTEP_SHR,       // 8xy6, source already chosen by the shift quirk
+    LOCKSTEP_SUBN,      // 8xy7
+    LOCKSTEP_SHL,       // 8xyE, source already chosen by the shift quirk
+};
+
+// Whether the op writes VF, and whether that happens only under the logic quirk
+inline bool lockstepWritesFlag(LockstepALUOp op, bool logicQuirk)
+{
+    switch(op) {
+        case LOCKSTEP_OR: case LOCKSTEP_AND: case LOCKSTEP_XOR: return logicQuirk;
+        case LOCKSTEP_ADD: case LOCKSTEP_SUB: case LOCKSTEP_SHR: case LOCKSTEP_SUBN: case LOCKSTEP_SHL: return true;
+        default: return false;
+    }
+}
+
+inline void lockstepALUScalar(LockstepALUOp op, uint8_t a, uint8_t b, uint8_t& result, uint8_t& flag)
+{
+    flag = 0;
+    switch(op) {
+        case LOCKSTEP_MOV_IMM: case LOCKSTEP_MOV: result = b; break;
+        case LOCKSTEP_ADD_IMM: result = a + b; break;
+        case LOCKSTEP_OR: result = a | b; break;
+        case LOCKSTEP_AND: result = a & b; break;
+        case LOCKSTEP_XOR: result = a ^ b; break;
+        case LOCKSTEP_ADD: result = a + b; flag = (a + b) > 0xFF; break;
+        case LOCKSTEP_SUB: result = a - b; flag = a >= b; break;
+        case LOCKSTEP_SUBN: result = b - a; flag = b >= a; break;
+        case LOCKSTEP_SHR: result = b / 2; flag = b & 0x1; break;
+        case LOCKSTEP_SHL: result = b * 2; flag = (b & 0x80) ? 1 : 0; break;
+    }
+}
+
+#if defined(__AVX2__)
+
+inline void lockstepALU32(LockstepALUOp op, __m256i a, __m256i b, __m256i& result, __m256i& flag)
+{
+    const __m256i one = _mm256_set1_epi8(1);
+    flag = _mm256_setzero_si256();
+    switch(op) {
+        case LOCKSTEP_MOV_IMM: case LOCKSTEP_MOV: result = b; break;
+        case LOCKSTEP_ADD_IMM: result = _mm256_add_epi8(a, b); break;
+        case LOCKSTEP_OR: result = _mm256_or_si256(a, b); break;
+        case LOCKSTEP_AND: result = _mm256_and_si256(a, b); break;
+        case LOCKSTEP_XOR: result = _mm256_xor_si256(a, b); break;
+        case LOCKSTEP_ADD: {
+            result = _mm256_add_epi8(a, b);
+            // carry if the sum wrapped below a
+            __m256i noCarry = _mm256_cmpeq_epi8(_mm256_max_epu8(result, a), result);
+            flag = _mm256_andnot_si256(noCarry, one);
+            break;
+        }
+        case LOCKSTEP_SUB: {
+            result = _mm256_sub_epi8(a, b);
+            flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a), one);
+            break;
+        }
+        case LOCKSTEP_SUBN: {
+            result = _mm256_sub_epi8(b, a);
+            flag = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(a, b), b), one);
+            break;
+        }
+        case LOCKSTEP_SHR: {
+            result = _mm256_and_si256(_mm256_srli_epi16(b, 1), _mm256_set1_epi8(0x7F));
+            flag = _mm256_and_si256(b, one);
+            break;
+        }
+        case LOCKSTEP_SHL: {
+            result = _mm256_add_epi8(b, b);
+            flag = _mm256_and_si256(_mm256_srli_epi16(b, 7), one);
+            break;
+        }
+    }
+}
+
+#endif
+
+// Vx op= (Vy or immediate) with VF semantics matching the interpreter:
+// arithmetic and shifts store through storeALUResult, so the VF order
+// quirk decides whether VF or Vx is written last, while the logic quirk
+// always clears VF after the result.  vy may be null for the immediate
+// forms.  Any of vx, vy, vf may alias.
+inline void lockstepALU(LockstepALUOp op, uint8_t *vx, const uint8_t *vy, uint8_t immediate, uint8_t *vf, bool vfOrder, bool logicQuirk, const uint8_t *mask, size_t lanes)
+{
+    bool writesFlag = lockstepWritesFlag(op, logicQuirk);
+    vfOrder = vfOrder && (op != LOCKSTEP_OR) && (op != LOCKSTEP_AND) && (op != LOCKSTEP_XOR);
+    size_t lane = 0;
+#if defined(__AVX2__)
+    for(; lane < lanes; lane += 32) {
+        __m256i m = _mm256_loadu_si256((const __m256i *)(mask + lane));
+        if(_mm256_testz_si256(m, m)) {
+            continue;
+        }
+        __m256i a = _mm256_loadu_si256((const __m256i *)(vx + lane));
+        __m256i b = (vy != nullptr) ? _mm256_loadu_si256((const __m256i *)(vy + lane)) : _mm256_set1_epi8(immediate);
+        __m256i result, flag;
+        lockstepALU32(op, a, b, result, flag);
+        if(writesFlag && vfOrder) {
+            __m256i f = _mm256_loadu_si256((const __m256i *)(vf + lane));
+            _mm256_storeu_si256((__m256i *)(vf + lane), _mm256_blendv_epi8(f, flag, m));
+        }
+        __m256i x = _mm256_loadu_si256((const __m256i *)(vx + lane));
+        _mm256_storeu_si256((__m256i *)(vx + lane), _mm256_blendv_epi8(x, result, m));
+        if(writesFlag && !vfOrder) {
+            __m256i f = _mm256_loadu_si256((const __m256i *)(vf + lane));
+            _mm256_storeu_si256((__m256i *)(vf + lane), _mm256_blendv_epi8(f, flag, m));
+        }
+    }
+#else
+    for(; lane < lanes; lane++) {
+        if(!mask[lane]) {
+            continue;
+        }
+        uint8_t result, flag;
+        lockstepALUScalar(op, vx[lane], (vy != nullptr) ? vy[lane] : immediate, result, flag);
+        if(writesFlag && vfOrder) {
+            vf[lane] = flag;
+        }
+        vx[lane] = result;
+        if(writesFlag && !vfOrder) {
+            vf[lane] = flag;
+        }
+    }
+#endif
+}
+
+// pc += (condition(a, b) == skipIfEqual) ? skipSize : 2, with b from vy or the immediate
+inline void lockstepSkip(uint16_t *pc, const uint8_t *vx, const uint8_t *vy, uint8_t immediate, bool skipIfEqual, int skipSize, const uint8_t *mask, size_t lanes)
+{
+    for(size_t lane = 0; lane < lanes; lane++) {
+        uint8_t b = (vy != nullptr) ? vy[lane] : immediate;
+        bool skip = ((vx[lane] == b) == skipIfEqual);
+        uint16_t step = mask[lane] ? (skip ? 2 + skipSize : 2) : 0;
+        pc[lane] += step;
+    }
+}
+
+inline void lockstepSet16(uint16_t *dst, uint16_t value, const uint8_t *mask, size_t lanes)
+{
+    for(size_t lane = 0; lane < lanes; lane++) {
+        dst[lane] = mask[lane] ? value : dst[lane];
+    }
+}
+
+inline void lockstepAdd16(uint16_t *dst, uint16_t value, const uint8_t *mask, size_t lanes)
+{
+    for(size_t lane = 0; lane < lanes; lane++) {
+        dst[lane] += mask[lane] ? value : 0;
+    }
+}
+
+// dst = base + src[lane] (Bnnn and Fx1E)
+inline void lockstepSet16PlusByte(uint16_t *dst, uint16_t base, const uint8_t *src, const uint8_t *mask, size_t lanes)
+{
+    for(size_t lane = 0; lane < lanes; lane++) {
+        dst[lane] = mask[lane] ? (uint16_t)(base + src[lane]) : dst[lane];
+    }
+}
+
+inline void lockstepAdd16Byte(uint16_t *dst, const uint8_t *src, const uint8_t *mask, size_t lanes)
+{
+    for(size_t lane = 0; lane < lanes; lane++) {
+        dst[lane] += mask[lane] ? src[lane] : 0;
+    }
+}
+
+inline void lockstepCopy8(uint8_t *dst, const uint8_t *src, const uint8_t *mask, size_t lanes)
+{
+    for(size_t lane = 0; lane < lanes; lane++) {
+        dst[lane] = mask[lane] ? src[lane] : dst[lane];
+    }
+}
+
+// mask = candidates && (pc == value)
+inline size_t lockstepMatchPC(uint8_t *mask, const uint8_t *candidates, const uint16_t *pc, uint16_t value, size_t lanes)
+{
+    size_t count = 0;
+    for(size_t lane = 0; lane < lanes; lane++) {
+        mask[lane] = (candidates[lane] && (pc[lane] == value)) ? 0xFF : 0;
+        count += mask[lane] & 1;
+    }
+    return count;
+}
+
+#endif /* LOCKSTEP_H */
@@ -0,0 +1,138 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// ROM pack file.  One file holds a set of ROM images together with the
+// launch settings "launcher" derives from programs.json, so xochip can
+// start any of them after mapping a single file.
+//
+// File layout, host byte order: one PackFileHeader, then entryCount
+// PackEntry records sorted by name, then the ROM images, each at the
+// offset its entry records.
+
+constexpr char PackFileMagic[4] = {'X', '8', 'P', 'K'};
+constexpr uint32_t PackFileVersion = 1;
+constexpr size_t PackNameLength = 48;
+
+// Same values as xochip's ChipPlatform
+enum PackPlatform
+{
+    PACK_PLATFORM_CHIP8 = 0,
+    PACK_PLATFORM_SCHIP = 1,
+    PACK_PLATFORM_XOCHIP = 2,
+};
+
+// Same bits as xochip's QUIRKS_ values
+constexpr uint32_t PACK_QUIRK_SHIFT = 0x01;
+constexpr uint32_t PACK_QUIRK_LOAD_STORE = 0x02;
+constexpr uint32_t PACK_QUIRK_JUMP = 0x04;
+constexpr uint32_t PACK_QUIRK_CLIP = 0x08;
+constexpr uint32_t PACK_QUIRK_VFORDER = 0x10;
+constexpr uint32_t PACK_QUIRK_LOGIC = 0x20;
+constexpr uint32_t PACK_QUIRK_VBLANK = 0x40;
+
+struct PackFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t entrySize;
+};
+
+struct PackEntry
+{
+    char name[PackNameLength];  // NUL-terminated program name
+    uint64_t offset;            // of the ROM image from the start of the file
+    uint32_t size;
+    uint32_t quirks;
+    uint16_t ticksPerField;     // 0 if programs.json didn't specify one
+    uint16_t rotation;          // degrees
+    uint8_t platform;
+    uint8_t colorsSet;          // bit N set if colors[N] was specified
+    uint8_t reserved[2];
+    uint32_t colors[4];         // 0xRRGGBB
+};
+static_assert(sizeof(PackEntry) == 88, "PackEntry must stay 88 bytes");
+
+struct ROMPack
+{
+    const uint8_t *base = nullptr;
+    size_t length = 0;
+    const PackEntry *entries = nullptr;
+    uint32_t entryCount = 0;
+
+    ROMPack() {}
+    ROMPack(const ROMPack&) = delete;
+    ROMPack& operator=(const ROMPack&) = delete;
+
+    ~ROMPack()
+    {
+        if(base != nullptr) {
+            munmap(const_cast<uint8_t *>(base), length);
+        }
+    }
+
+    // Maps the file and checks the header and every entry's bounds.
+    bool open(const char *filename)
+    {
+        int fd = ::open(filename, O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if((fstat(fd, &info) != 0) || (info.st_size < (off_t)sizeof(PackFileHeader))) {
+            ::close(fd);
+            return false;
+        }
+        void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(mapped == MAP_FAILED) {
+            return false;
+        }
+        base = static_cast<const uint8_t *>(mapped);
+        length = info.st_size;
+
+        const PackFileHeader *header = reinterpret_cast<const PackFileHeader *>(base);
+        if((memcmp(header->magic, PackFileMagic, sizeof(header->magic)) != 0) ||
+            (header->version != PackFileVersion) ||
+            (header->entrySize != sizeof(PackEntry)) ||
+            (header->entryCount > (length - sizeof(PackFileHeader)) / sizeof(PackEntry))) {
+            return false;
+        }
+        entries = reinterpret_cast<const PackEntry *>(base + sizeof(PackFileHeader));
+        entryCount = header->entryCount;
+        for(uint32_t i = 0; i < entryCount; i++) {
+            if((entries[i].offset > length) || (entries[i].size > length - entries[i].offset) ||
+                (entries[i].name[PackNameLength - 1] != '\0')) {
+                entryCount = 0;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const PackEntry *find(const char *name) const
+    {
+        const PackEntry *end = entries + entryCount;
+        const PackEntry *found = std::lower_bound(entries, end, name,
+            [](const PackEntry& entry, const char *name) { return strcmp(entry.name, name) < 0; });
+        if((found == end) || (strcmp(found->name, name) != 0)) {
+            return nullptr;
+        }
+        return found;
+    }
+
+    const uint8_t *image(const PackEntry& entry) const
+    {
+        return base + entry.offset;
+    }
+};
+
+#endif /* PACK_H */
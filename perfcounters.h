@@ -0,0 +1,164 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <array>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// A group of hardware performance counters measured around a region of
+// code with start() and stop().  Counters count only the calling thread,
+// so open() must be called on the thread that runs the region.  Only
+// implemented on Linux, using perf_event_open; elsewhere open() fails.
+struct PerfCounterGroup
+{
+    enum Counter {
+        CYCLES,
+        INSTRUCTIONS,
+        BRANCH_MISSES,
+        L1D_READ_MISSES,
+        LLC_MISSES,
+        COUNTER_COUNT
+    };
+
+    static constexpr std::array<const char *, COUNTER_COUNT> counterNames = {
+        "cycles", "instructions", "branch-misses", "L1D-read-misses", "LLC-misses"
+    };
+
+    std::array<int, COUNTER_COUNT> fds;
+    std::array<uint64_t, COUNTER_COUNT> totals = {0};
+    std::array<bool, COUNTER_COUNT> available = {false};
+    uint64_t regions = 0;
+
+    PerfCounterGroup()
+    {
+        fds.fill(-1);
+    }
+
+    ~PerfCounterGroup()
+    {
+#ifdef __linux__
+        for(int fd : fds) {
+            if(fd >= 0) {
+                close(fd);
+            }
+        }
+#endif
+    }
+
+#ifdef __linux__
+    static int openCounter(uint32_t type, uint64_t config, int groupFd)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = (groupFd == -1) ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID;
+        return syscall(SYS_perf_event_open, &attr, 0 /* this thread */, -1 /* any CPU */, groupFd, 0);
+    }
+#endif
+
+    // Returns false if not even the cycle counter could be opened.
+    bool open()
+    {
+#ifdef __linux__
+        constexpr uint64_t L1DReadMiss = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        fds[CYCLES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, -1);
+        if(fds[CYCLES] < 0) {
+            fprintf(stderr, "PerfCounterGroup: perf_event_open failed: %s (check /proc/sys/kernel/perf_event_paranoid)\n", strerror(errno));
+            return false;
+        }
+        fds[INSTRUCTIONS] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, fds[CYCLES]);
+        fds[BRANCH_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, fds[CYCLES]);
+        fds[L1D_READ_MISSES] = openCounter(PERF_TYPE_HW_CACHE, L1DReadMiss, fds[CYCLES]);
+        fds[LLC_MISSES] = openCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, fds[CYCLES]);
+        for(int i = 0; i < COUNTER_COUNT; i++) {
+            available[i] = (fds[i] >= 0);
+        }
+        return true;
+#else
+        fprintf(stderr, "PerfCounterGroup: hardware performance counters are only supported on Linux\n");
+        return false;
+#endif
+    }
+
+    void start()
+    {
+#ifdef __linux__
+        if(fds[CYCLES] >= 0) {
+            ioctl(fds[CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(fds[CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+#endif
+    }
+
+    void stop()
+    {
+#ifdef __linux__
+        if(fds[CYCLES] < 0) {
+            return;
+        }
+        ioctl(fds[CYCLES], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        // PERF_FORMAT_GROUP | PERF_FORMAT_ID: nr, then {value, id} per counter
+        struct { uint64_t value; uint64_t id; } values[COUNTER_COUNT];
+        uint64_t buffer[1 + 2 * COUNTER_COUNT];
+        ssize_t got = read(fds[CYCLES], buffer, sizeof(buffer));
+        if(got < (ssize_t)sizeof(uint64_t)) {
+            return;
+        }
+        uint64_t count = std::min<uint64_t>(buffer[0], COUNTER_COUNT);
+        memcpy(values, buffer + 1, count * sizeof(values[0]));
+        for(int i = 0; i < COUNTER_COUNT; i++) {
+            if(!available[i]) {
+                continue;
+            }
+            uint64_t id;
+            if(ioctl(fds[i], PERF_EVENT_IOC_ID, &id) != 0) {
+                continue;
+            }
+            for(uint64_t j = 0; j < count; j++) {
+                if(values[j].id == id) {
+                    totals[i] += values[j].value;
+                }
+            }
+        }
+        regions++;
+#endif
+    }
+
+    // Print totals and the ratios per emulated second and per emulated instruction.
+    void printReport(const char *name, double emulatedSeconds, uint64_t emulatedInstructions)
+    {
+        fprintf(stderr, "perf %s: %llu regions, %.2f emulated seconds, %llu emulated instructions\n",
+            name, (unsigned long long)regions, emulatedSeconds, (unsigned long long)emulatedInstructions);
+        for(int i = 0; i < COUNTER_COUNT; i++) {
+            if(!available[i]) {
+                fprintf(stderr, "perf %s: %16s: not available\n", name, counterNames[i]);
+                continue;
+            }
+            fprintf(stderr, "perf %s: %16s: %14llu total, %14.0f per emulated second, %10.2f per emulated instruction\n",
+                name, counterNames[i], (unsigned long long)totals[i],
+                (emulatedSeconds > 0) ? (totals[i] / emulatedSeconds) : 0.0,
+                (emulatedInstructions > 0) ? ((double)totals[i] / emulatedInstructions) : 0.0);
+        }
+        if(available[CYCLES] && available[INSTRUCTIONS] && (totals[CYCLES] > 0)) {
+            fprintf(stderr, "perf %s: host IPC %.2f\n", name, (double)totals[INSTRUCTIONS] / totals[CYCLES]);
+        }
+    }
+};
+
+#endif /* PERFCOUNTERS_H */
@@ -0,0 +1,108 @@
+#ifndef STATEHASH_H
+#define STATEHASH_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include "chip8.h"
+
+// Per-field hashes of emulator state for golden-output regression runs.
+// "xochip --frames N --hash file" writes one record per 60Hz field, and
+// "--golden file" runs the ROM again and reports the first field whose
+// record differs.  Each record has a hash of the display planes and, with
+// STATEHASH_STATE, one of memory and the CPU registers.  Memory is hashed
+// a page at a time and only pages written since the previous field are
+// rehashed, so hashing costs little more than the display.
+//
+// File layout, host byte order: one StateHashFileHeader, then one
+// StateHashRecord per field.  The header carries everything that decides
+// the run, including the seed for Cxkk's random numbers.
+
+constexpr char StateHashFileMagic[4] = {'X', '8', 'S', 'H'};
+constexpr uint32_t StateHashFileVersion = 1;
+
+constexpr uint32_t StateHashDefaultSeed = 1;
+
+enum {
+    STATEHASH_STATE = 0x1,          // records include memory and registers
+};
+
+struct StateHashFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t romHash;
+    uint32_t platform;
+    uint32_t quirks;
+    uint32_t ticksPerField;
+    uint32_t flags;
+    uint32_t seed;
+    uint32_t reserved;
+};
+
+struct StateHashRecord
+{
+    uint64_t display;
+    uint64_t state;                 // 0 without STATEHASH_STATE
+};
+
+// FNV-1a over 64-bit words, then over any trailing bytes
+inline uint64_t hashWords(const void *data, size_t size, uint64_t hash = 0xcbf29ce484222325ULL)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        hash ^= word;
+        hash *= 0x100000001b3ULL;
+    }
+    for(; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+struct StateHasher
+{
+    std::array<uint64_t, Memory::pageCount> pageHashes = {0};
+
+    uint64_t hashDisplay(const DisplayImage& display)
+    {
+        return hashWords(&display[0][0], sizeof(display));
+    }
+
+    // Rehash the pages written since the last call and clear their dirty bits.
+    uint64_t hashMemory(Memory& memory)
+    {
+        for(size_t word = 0; word < memory.dirtyPages.size(); word++) {
+            if(memory.dirtyPages[word] == 0) {
+                continue;
+            }
+            for(size_t bit = 0; bit < 64; bit++) {
+                if(memory.dirtyPages[word] & (1ULL << bit)) {
+                    size_t page = word * 64 + bit;
+                    pageHashes[page] = hashWords(memory.memory.data() + page * Memory::pageSize, Memory::pageSize);
+                }
+            }
+            memory.dirtyPages[word] = 0;
+        }
+        return hashWords(pageHashes.data(), sizeof(pageHashes));
+    }
+
+    template <class INTERPRETER>
+    uint64_t hashState(Memory& memory, const INTERPRETER& chip8)
+    {
+        uint64_t hash = hashMemory(memory);
+        hash = hashWords(chip8.registers.data(), chip8.registers.size(), hash);
+        hash = hashWords(chip8.RPL.data(), chip8.RPL.size(), hash);
+        hash = hashWords(chip8.stack.data(), chip8.stack.size() * sizeof(uint16_t), hash);
+        uint16_t words[4] = {chip8.I, chip8.pc, chip8.DT, chip8.ST};
+        hash = hashWords(words, sizeof(words), hash);
+        uint32_t modes[2] = {chip8.screenPlaneMask, chip8.extendedScreenMode ? 1u : 0u};
+        return hashWords(modes, sizeof(modes), hash);
+    }
+};
+
+#endif /* STATEHASH_H */
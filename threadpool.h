@@ -0,0 +1,150 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing thread pool.  Each worker owns a deque of tasks; it takes
+// its own work from the back and, when that runs dry, steals from the
+// front of another worker's deque.  A task submitted from a worker goes
+// on that worker's own deque, so a task that resubmits itself (e.g. to
+// advance an instance by another frame) stays on the same core and keeps
+// its data in that core's cache unless another worker is idle.
+//
+// The task counts are atomics so that submitting, taking and finishing a
+// task only lock the deque involved; the shared mutex is taken only to
+// park or wake an idle worker and to signal waitIdle().
+struct WorkStealingPool
+{
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    std::mutex stateMutex;
+    std::condition_variable workAvailable;
+    std::condition_variable allDone;
+    std::atomic<size_t> queued{0};          // in a deque; changed only under that deque's mutex
+    std::atomic<size_t> outstanding{0};     // submitted and not yet finished
+    std::atomic<size_t> idleWorkers{0};     // parked, or about to park, on workAvailable
+    bool stopping = false;
+
+    std::atomic<size_t> nextWorker{0};
+    std::atomic<uint64_t> steals{0};
+
+    static inline thread_local WorkStealingPool *currentPool = nullptr;
+    static inline thread_local size_t currentWorker = 0;
+
+    WorkStealingPool(size_t threadCount)
+    {
+        threadCount = std::max<size_t>(threadCount, 1);
+        for(size_t i = 0; i < threadCount; i++) {
+            workers.push_back(std::make_unique<Worker>());
+        }
+        for(size_t i = 0; i < threadCount; i++) {
+            threads.emplace_back([this, i]() { run(i); });
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    ~WorkStealingPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for(auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    void submit(std::function<void()> task)
+    {
+        size_t index = (currentPool == this) ? currentWorker : (nextWorker++ % workers.size());
+        outstanding++;
+        {
+            std::lock_guard<std::mutex> lock(workers[index]->mutex);
+            workers[index]->tasks.push_back(std::move(task));
+            queued++;
+        }
+        // A worker counts itself idle before checking queued, so one of
+        // the two sides always sees the other's update.
+        if(idleWorkers > 0) {
+            std::lock_guard<std::mutex> lock(stateMutex);
+            workAvailable.notify_one();
+        }
+    }
+
+    // Block until every submitted task, including tasks those tasks submit, has finished.
+    void waitIdle()
+    {
+        std::unique_lock<std::mutex> lock(stateMutex);
+        allDone.wait(lock, [this]() { return outstanding == 0; });
+    }
+
+    bool take(size_t self, std::function<void()>& task)
+    {
+        {
+            Worker& own = *workers[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if(!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        for(size_t i = 1; i < workers.size(); i++) {
+            Worker& victim = *workers[(self + i) % workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if(!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                queued--;
+                steals++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t self)
+    {
+        currentPool = this;
+        currentWorker = self;
+        for(;;) {
+            std::function<void()> task;
+            if(take(self, task)) {
+                task();
+                if(--outstanding == 0) {
+                    std::lock_guard<std::mutex> lock(stateMutex);
+                    allDone.notify_all();
+                }
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(stateMutex);
+            idleWorkers++;
+            workAvailable.wait(lock, [this]() { return stopping || (queued > 0); });
+            idleWorkers--;
+            if(stopping && (queued == 0)) {
+                return;
+            }
+        }
+    }
+};
+
+#endif /* THREADPOOL_H */
@@ -0,0 +1,100 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Binary execution trace.  The interpreter appends one fixed-size record
+// per executed instruction to an in-memory ring with no formatting; the
+// ring is written to a file on demand, on an unsupported instruction, or
+// from the crash handler, and printed later by the "tracedump" tool.
+//
+// File layout: one TraceFileHeader followed by recordCount TraceRecords,
+// oldest first, in host byte order.
+
+constexpr char TraceFileMagic[4] = {'X', '8', 'T', 'R'};
+constexpr uint32_t TraceFileVersion = 1;
+
+struct TraceRecord
+{
+    uint64_t clock;             // system clock at which the instruction issued
+    uint16_t pc;
+    uint16_t instructionWord;
+    uint16_t I;                 // I after the instruction
+    uint16_t changedRegisters;  // bit N set if VN was changed by the instruction
+    uint8_t registers[16];      // V0-VF after the instruction
+};
+static_assert(sizeof(TraceRecord) == 32, "TraceRecord must stay 32 bytes");
+
+struct TraceFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t recordCount;
+    uint64_t systemClockRate;
+};
+
+struct TraceBuffer
+{
+    std::vector<TraceRecord> records;
+    size_t mask;
+    uint64_t written = 0;
+    uint64_t systemClockRate;
+
+    TraceBuffer(size_t minimumRecords, uint64_t systemClockRate) :
+        systemClockRate(systemClockRate)
+    {
+        size_t capacity = 1;
+        while(capacity < minimumRecords) {
+            capacity *= 2;
+        }
+        records.resize(capacity);
+        mask = capacity - 1;
+    }
+
+    void record(uint64_t clock, uint16_t pc, uint16_t instructionWord, uint16_t I, const std::array<uint8_t, 16>& before, const std::array<uint8_t, 16>& after)
+    {
+        TraceRecord& r = records[written & mask];
+        r.clock = clock;
+        r.pc = pc;
+        r.instructionWord = instructionWord;
+        r.I = I;
+        uint16_t changed = 0;
+        for(int i = 0; i < 16; i++) {
+            changed |= (before[i] != after[i]) << i;
+        }
+        r.changedRegisters = changed;
+        memcpy(r.registers, after.data(), 16);
+        written++;
+    }
+
+    // Uses only open/write/close so it may be called from a signal handler.
+    bool dump(const char *filename) const
+    {
+        int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0) {
+            return false;
+        }
+        size_t count = (written < records.size()) ? written : records.size();
+        size_t oldest = (written - count) & mask;
+        TraceFileHeader header;
+        memcpy(header.magic, TraceFileMagic, sizeof(header.magic));
+        header.version = TraceFileVersion;
+        header.recordSize = sizeof(TraceRecord);
+        header.recordCount = count;
+        header.systemClockRate = systemClockRate;
+        bool success = (write(fd, &header, sizeof(header)) == sizeof(header));
+        size_t firstPart = (oldest + count <= records.size()) ? count : (records.size() - oldest);
+        success = success && (write(fd, records.data() + oldest, firstPart * sizeof(TraceRecord)) == (ssize_t)(firstPart * sizeof(TraceRecord)));
+        success = success && (write(fd, records.data(), (count - firstPart) * sizeof(TraceRecord)) == (ssize_t)((count - firstPart) * sizeof(TraceRecord)));
+        close(fd);
+        return success;
+    }
+};
+
+#endif /* TRACE_H */
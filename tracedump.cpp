@@ -0,0 +1,97 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "disassemble.h"
+#include "trace.h"
+
+void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [options] xochip.trace\n", name);
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "\t--last N           - print only the last N records\n");
+    fprintf(stderr, "\t--registers        - print all registers, not only the changed ones\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *progname = argv[0];
+    argc -= 1;
+    argv += 1;
+
+    size_t last = 0;
+    bool allRegisters = false;
+
+    while((argc > 0) && (argv[0][0] == '-')) {
+        if(strcmp(argv[0], "--last") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--last option requires a record count.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            last = strtoul(argv[1], nullptr, 0);
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--registers") == 0) {
+            allRegisters = true;
+            argv += 1;
+            argc -= 1;
+        } else if(
+            (strcmp(argv[0], "-help") == 0) ||
+            (strcmp(argv[0], "-h") == 0) ||
+            (strcmp(argv[0], "-?") == 0))
+        {
+            usage(progname);
+            exit(EXIT_SUCCESS);
+        } else {
+            fprintf(stderr, "unknown parameter \"%s\"\n", argv[0]);
+            usage(progname);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if(argc < 1) {
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *fp = fopen(argv[0], "rb");
+    if(fp == nullptr) {
+        fprintf(stderr, "couldn't open \"%s\"\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    TraceFileHeader header;
+    if((fread(&header, sizeof(header), 1, fp) != 1) ||
+        (memcmp(header.magic, TraceFileMagic, sizeof(header.magic)) != 0) ||
+        (header.version != TraceFileVersion) ||
+        (header.recordSize != sizeof(TraceRecord)))
+    {
+        fprintf(stderr, "\"%s\" is not a version %u xochip trace\n", argv[0], TraceFileVersion);
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<TraceRecord> records(header.recordCount);
+    size_t count = fread(records.data(), sizeof(TraceRecord), records.size(), fp);
+    fclose(fp);
+    if(count < records.size()) {
+        fprintf(stderr, "trace is truncated, %zu of %u records present\n", count, header.recordCount);
+        records.resize(count);
+    }
+
+    size_t first = ((last > 0) && (last < records.size())) ? (records.size() - last) : 0;
+    for(size_t i = first; i < records.size(); i++) {
+        const TraceRecord& r = records[i];
+        printf("clk:%llu I:%04X ", (unsigned long long)r.clock, r.I);
+        for(int reg = 0; reg < 16; reg++) {
+            if(allRegisters || (r.changedRegisters & (1 << reg))) {
+                printf("V%X=%02X ", reg, r.registers[reg]);
+            }
+        }
+        printf("| ");
+        // F000 NNNN loads its operand into I, which is recorded after execution
+        disassemble(r.pc, r.instructionWord, (r.instructionWord == 0xF000) ? r.I : 0);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,196 @@
+#ifndef VIDEO_H
+#define VIDEO_H
+
+#include <array>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+
+// Lossless recording of the emulated display, one frame per 60Hz field.
+// Pixels are 2-bit palette indices (one bit per XO-CHIP plane) packed four
+// to a byte, most significant first.  Each frame is stored as one record:
+// a full key frame, a delta against the previous frame, or a count of
+// frames identical to the previous one.  "videoconvert" turns a recording
+// into a standard video file.
+//
+// File layout, host byte order: one VideoFileHeader, then records, each a
+// one-byte VideoRecordType followed by that record's payload:
+//   VIDEO_REPEAT   uint32_t count
+//   VIDEO_KEYFRAME VideoPackedFrameSize bytes
+//   VIDEO_DELTA    uint16_t runCount, then runCount runs of
+//                  {uint16_t skip, uint16_t length, length bytes}; each run
+//                  skips skip packed bytes and XORs length bytes into the
+//                  previous frame
+
+constexpr char VideoFileMagic[4] = {'X', '8', 'V', 'D'};
+constexpr uint32_t VideoFileVersion = 1;
+constexpr int VideoWidth = 128;
+constexpr int VideoHeight = 64;
+constexpr size_t VideoPackedFrameSize = VideoWidth * VideoHeight / 4;
+
+// A delta that wouldn't be meaningfully smaller than a key frame is written as one.
+constexpr size_t VideoDeltaLimit = VideoPackedFrameSize * 3 / 4;
+
+enum VideoRecordType
+{
+    VIDEO_REPEAT = 0,
+    VIDEO_KEYFRAME = 1,
+    VIDEO_DELTA = 2,
+};
+
+struct VideoFileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint16_t width;
+    uint16_t height;
+    uint16_t framesPerSecond;
+    uint16_t reserved;
+    uint8_t palette[4][3];      // RGB for each pixel value
+};
+
+typedef std::array<uint8_t, VideoPackedFrameSize> VideoPackedFrame;
+
+// rows is VideoHeight rows of VideoWidth pixel values
+inline void packVideoFrame(const uint8_t *rows, VideoPackedFrame& packed)
+{
+    for(size_t i = 0; i < VideoPackedFrameSize; i++) {
+        const uint8_t *p = rows + i * 4;
+        packed[i] = ((p[0] & 0x3) << 6) | ((p[1] & 0x3) << 4) | ((p[2] & 0x3) << 2) | (p[3] & 0x3);
+    }
+}
+
+inline uint8_t videoPixel(const VideoPackedFrame& packed, int x, int y)
+{
+    size_t index = y * VideoWidth + x;
+    return (packed[index / 4] >> (6 - (index % 4) * 2)) & 0x3;
+}
+
+// Append the VIDEO_DELTA payload turning previous into current to payload.
+// Returns false, leaving payload partly written, once it would exceed VideoDeltaLimit.
+inline bool encodeVideoDelta(const VideoPackedFrame& previous, const VideoPackedFrame& current, std::vector<uint8_t>& payload)
+{
+    auto put16 = [&payload](uint16_t v) {
+        uint8_t bytes[2];
+        memcpy(bytes, &v, 2);
+        payload.insert(payload.end(), bytes, bytes + 2);
+    };
+    payload.clear();
+    put16(0);
+    uint16_t runCount = 0;
+    size_t i = 0;
+    size_t lastEnd = 0;
+    while(i < VideoPackedFrameSize) {
+        if(previous[i] == current[i]) {
+            i++;
+            continue;
+        }
+        // Extend the run over short unchanged gaps, which cost less than a new run header.
+        size_t start = i;
+        size_t end = i;
+        while((end < VideoPackedFrameSize) && ((previous[end] != current[end]) ||
+            ((end + 4 < VideoPackedFrameSize) && (memcmp(&previous[end], &current[end], 4) != 0)))) {
+            end++;
+        }
+        put16(start - lastEnd);
+        put16(end - start);
+        for(size_t j = start; j < end; j++) {
+            payload.push_back(previous[j] ^ current[j]);
+        }
+        runCount++;
+        lastEnd = end;
+        i = end;
+        if(payload.size() > VideoDeltaLimit) {
+            return false;
+        }
+    }
+    memcpy(payload.data(), &runCount, 2);
+    return true;
+}
+
+// Reads records from a recording, keeping the current frame.
+struct VideoReader
+{
+    FILE *fp;
+    VideoFileHeader header;
+    VideoPackedFrame frame = {0};
+    uint32_t repeatsLeft = 0;
+
+    VideoReader(FILE *fp) :
+        fp(fp)
+    {}
+
+    bool readHeader()
+    {
+        return (fread(&header, sizeof(header), 1, fp) == 1) &&
+            (memcmp(header.magic, VideoFileMagic, sizeof(header.magic)) == 0) &&
+            (header.version == VideoFileVersion) &&
+            (header.width == VideoWidth) && (header.height == VideoHeight);
+    }
+
+    bool read16(uint16_t& v)
+    {
+        return fread(&v, sizeof(v), 1, fp) == 1;
+    }
+
+    // Advance to the next frame.  Returns false at the end of the file or
+    // on a damaged record, with error set in the latter case.
+    bool nextFrame(bool& error)
+    {
+        error = false;
+        if(repeatsLeft > 0) {
+            repeatsLeft--;
+            return true;
+        }
+        int type = fgetc(fp);
+        if(type == EOF) {
+            return false;
+        }
+        error = true;
+        switch(type) {
+            case VIDEO_REPEAT: {
+                uint32_t count;
+                if((fread(&count, sizeof(count), 1, fp) != 1) || (count == 0)) {
+                    return false;
+                }
+                repeatsLeft = count - 1;
+                break;
+            }
+            case VIDEO_KEYFRAME: {
+                if(fread(frame.data(), 1, frame.size(), fp) != frame.size()) {
+                    return false;
+                }
+                break;
+            }
+            case VIDEO_DELTA: {
+                uint16_t runCount;
+                if(!read16(runCount)) {
+                    return false;
+                }
+                size_t position = 0;
+                for(uint16_t run = 0; run < runCount; run++) {
+                    uint16_t skip, length;
+                    if(!read16(skip) || !read16(length) || (position + skip + length > frame.size())) {
+                        return false;
+                    }
+                    position += skip;
+                    for(uint16_t j = 0; j < length; j++) {
+                        int c = fgetc(fp);
+                        if(c == EOF) {
+                            return false;
+                        }
+                        frame[position++] ^= c;
+                    }
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+        error = false;
+        return true;
+    }
+};
+
+#endif /* VIDEO_H */
@@ -0,0 +1,131 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "video.h"
+
+// Converts an "xochip --record-video" recording to YUV4MPEG2 (.y4m), which
+// ffmpeg, mpv, and most encoders read directly, e.g.
+//     videoconvert game.x8v | ffmpeg -i - game.mp4
+
+void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [options] recording [output.y4m]\n", name);
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "\t--scale N          - scale each pixel to NxN (default 4)\n");
+    fprintf(stderr, "writes to standard output if no output file is given\n");
+}
+
+// BT.601 studio-swing Y'CbCr
+void rgbToYCbCr(const uint8_t rgb[3], uint8_t ycbcr[3])
+{
+    int r = rgb[0], g = rgb[1], b = rgb[2];
+    ycbcr[0] = (( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16;
+    ycbcr[1] = ((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128;
+    ycbcr[2] = ((112 * r -  94 * g -  18 * b + 128) >> 8) + 128;
+}
+
+int main(int argc, char **argv)
+{
+    const char *progname = argv[0];
+    argc -= 1;
+    argv += 1;
+
+    int scale = 4;
+
+    while((argc > 0) && (argv[0][0] == '-')) {
+        if(strcmp(argv[0], "--scale") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--scale option requires a pixel scale.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            scale = atoi(argv[1]);
+            if((scale < 1) || (scale > 16)) {
+                fprintf(stderr, "scale must be between 1 and 16.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 2;
+            argc -= 2;
+        } else if(
+            (strcmp(argv[0], "-help") == 0) ||
+            (strcmp(argv[0], "-h") == 0) ||
+            (strcmp(argv[0], "-?") == 0))
+        {
+            usage(progname);
+            exit(EXIT_SUCCESS);
+        } else {
+            fprintf(stderr, "unknown parameter \"%s\"\n", argv[0]);
+            usage(progname);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if((argc < 1) || (argc > 2)) {
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *fp = fopen(argv[0], "rb");
+    if(fp == nullptr) {
+        fprintf(stderr, "couldn't open \"%s\"\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    VideoReader reader(fp);
+    if(!reader.readHeader()) {
+        fprintf(stderr, "\"%s\" is not a version %u xochip video recording\n", argv[0], VideoFileVersion);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *out = stdout;
+    if(argc == 2) {
+        out = fopen(argv[1], "wb");
+        if(out == nullptr) {
+            fprintf(stderr, "couldn't open \"%s\" for writing\n", argv[1]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint8_t palette[4][3];
+    for(int i = 0; i < 4; i++) {
+        rgbToYCbCr(reader.header.palette[i], palette[i]);
+    }
+
+    const int width = VideoWidth * scale;
+    const int height = VideoHeight * scale;
+    fprintf(out, "YUV4MPEG2 W%d H%d F%u:1 Ip A1:1 C444\n", width, height, reader.header.framesPerSecond);
+
+    // One 4:4:4 frame: the Y, Cb, and Cr planes in turn.
+    std::vector<uint8_t> planes(width * height * 3);
+    uint64_t frames = 0;
+    bool error = false;
+    while(reader.nextFrame(error)) {
+        for(int plane = 0; plane < 3; plane++) {
+            uint8_t *p = planes.data() + plane * width * height;
+            for(int y = 0; y < height; y++) {
+                for(int x = 0; x < width; x++) {
+                    *p++ = palette[videoPixel(reader.frame, x / scale, y / scale)][plane];
+                }
+            }
+        }
+        fputs("FRAME\n", out);
+        if(fwrite(planes.data(), 1, planes.size(), out) != planes.size()) {
+            fprintf(stderr, "couldn't write frame %llu\n", (unsigned long long)frames);
+            exit(EXIT_FAILURE);
+        }
+        frames++;
+    }
+    fclose(fp);
+
+    if(error) {
+        fprintf(stderr, "recording is damaged after frame %llu\n", (unsigned long long)frames);
+    }
+    if((out != stdout) && (fclose(out) != 0)) {
+        fprintf(stderr, "couldn't finish writing \"%s\"\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(stderr, "%llu frames\n", (unsigned long long)frames);
+    exit(error ? EXIT_FAILURE : EXIT_SUCCESS);
+}
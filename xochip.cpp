@@ -12,6 +12,17 @@
 #include <chrono>
 #include <random>
 #include <numeric>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <limits>
+#include <pthread.h>
+#include <csignal>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <ao/ao.h>
 
 #ifdef __APPLE__
@@ -23,1414 +34,572 @@
 
 #include <MiniFB.h>
 
-typedef uint64_t clk_t;
+#include "chip8.h"
+#include "perfcounters.h"
+#include "analyze.h"
+#include "pack.h"
+#include "threadpool.h"
+#include "lockstep.h"
+#include "video.h"
+#include "statehash.h"
 
-struct Clock
-{
-    clk_t rate;
-    clk_t clocks;
-
-    Clock(clk_t rate) :
-        rate(rate),
-        clocks(0)
-    {}
-
-    Clock(const Clock& clock) :
-        rate(clock.rate), 
-        clocks(clock.clocks)
-    {}
-
-    Clock(const Clock& clock, clk_t newClocks) :
-        rate(clock.rate), 
-        clocks(newClocks)
-    {}
-
-    Clock& operator=(const Clock& clock)
-    {
-        clocks = clock.clocks;
-        rate = clock.rate;
-        return *this;
-    }
-
-    Clock& operator+=(clk_t inc)
-    {
-        clocks += inc;
-        return *this;
-    }
-
-    Clock operator+(clk_t inc) const
-    {
-        return Clock(rate, clocks + inc);
-    }
-
-    // operator clk_t() const { return clocks; }
-};
-
-constexpr int FieldsPerSecond = 60;
-constexpr int Chip8TimerFrequency = 60;
 constexpr int UIUpdateFrequency = 30;
 
-constexpr int XOChipAudioSampleRate = 4000;
-constexpr int XOChipAudioSampleSamples = 128;
-constexpr int XOChipAudioSampleSize = XOChipAudioSampleSamples / 8;
-
-constexpr int DEBUG_STATE = 0x01;
-constexpr int DEBUG_ASM = 0x02;
-constexpr int DEBUG_DRAW = 0x04;
-constexpr int DEBUG_FAIL_UNSUPPORTED_INSN = 0x08;
-constexpr int DEBUG_KEYS = 0x10;
 std::unordered_map<std::string, int> keywordsToDebugFlags = {
     {"state", DEBUG_STATE},
     {"asm", DEBUG_ASM},
     {"draw", DEBUG_DRAW},
     {"insn", DEBUG_FAIL_UNSUPPORTED_INSN},
     {"keys", DEBUG_KEYS},
+    {"audio", DEBUG_AUDIO},
+    {"timing", DEBUG_TIMING},
 };
-int debug = 0;
 
-constexpr uint32_t QUIRKS_NONE = 0x00;
-constexpr uint32_t QUIRKS_SHIFT = 0x01;           /* shift VX instead of VY */
-constexpr uint32_t QUIRKS_LOAD_STORE = 0x02;      /* don't add X + 1 to I */
-constexpr uint32_t QUIRKS_JUMP = 0x04;            /* VX is used as offset *and* X used as address high nybble */
-constexpr uint32_t QUIRKS_CLIP = 0x08;            /* no draw or collide wrapped, VX += rows off bottom */
-constexpr uint32_t QUIRKS_VFORDER = 0x10;         /* VF is set first in ADD, SUB, SH ALU operations */
-constexpr uint32_t QUIRKS_LOGIC = 0x20;           /* VF is cleared after logic ALU operations */
+constexpr size_t TraceRecordsKept = 65536;
 
-enum ChipPlatform
-{
-    CHIP8,
-    SCHIP_1_1,
-    XOCHIP
-};
+// Set from the F12 key or SIGUSR1; the emulation thread writes the trace
+// at the end of the current field.
+std::atomic<bool> traceDumpRequested{false};
 
 enum DisplayRotation
 {
     ROT_0, ROT_90, ROT_180, ROT_270
 };
 
-void disassemble(uint16_t pc, uint16_t instructionWord, uint16_t wordAfter);
+typedef std::array<uint8_t, 3> vec3ub;
 
-template <class MEMORY, class INTERFACE>
-struct Chip8Interpreter
+vec3ub vec3ubFromInts(int r, int g, int b)
 {
-    ChipPlatform platform;
-    uint32_t quirks;
+    return { (uint8_t)r, (uint8_t)g, (uint8_t)b };
+}
 
-    uint64_t insnNumber = 0;
-
-    std::array<uint8_t, 16> registers = {0};
-    std::array<uint8_t, 8> RPL = {0};
-    std::vector<uint16_t> stack;
-    uint16_t I = 0;
-    uint16_t pc = 0;
-    uint8_t DT = 0;
-    uint64_t DTNextDecrementClock = 0;
-    uint8_t ST = 0;
-    uint64_t STNextDecrementClock = 0;
-    bool extendedScreenMode = false;
-    uint32_t screenPlaneMask = 0x1;
- 
-    uint64_t cpuClockLengthInSystemClocks;
-    Clock mostRecentSystemClock;
-
-    std::random_device r;
-    std::default_random_engine e1;
-    std::uniform_int_distribution<int> uniform_dist;
-
-    bool waitingForKeyPress = false;
-    bool waitingForKeyRelease = false;
-    uint8_t keyPressed;
-    int keyDestinationRegister;
-
-    Chip8Interpreter(uint16_t initialPC, ChipPlatform platform, uint32_t quirks, uint64_t cpuClockRate, const Clock& systemClock) :
-        platform(platform),
-        quirks(quirks),
-        pc(initialPC),
-        mostRecentSystemClock(systemClock),
-        e1(r()),
-        uniform_dist(0, 255)
-    {
-        assert(systemClock.rate % cpuClockRate == 0);
-        cpuClockLengthInSystemClocks = systemClock.rate / cpuClockRate;
-    }
-
-    enum InstructionHighNybble
-    {
-        INSN_SYS = 0x0,
-        INSN_JP = 0x1,
-        INSN_CALL = 0x2,
-        INSN_SE_IMM = 0x3,
-        INSN_SNE_IMM = 0x4,
-        INSN_HIGH5 = 0x5,
-        INSN_LD_IMM = 0x6,
-        INSN_ADD_IMM = 0x7,
-        INSN_ALU = 0x8,
-        INSN_SNE_REG = 0x9,
-        INSN_LD_I = 0xA,
-        INSN_JP_V0 = 0xB,
-        INSN_RND = 0xC,
-        INSN_DRW = 0xD,
-        INSN_SKP = 0xE,
-        INSN_LD_SPECIAL = 0xF,
-    };
+// Lock-free single-producer/single-consumer triple buffer.  The producer
+// fills backBuffer() and publishes it; the consumer picks up the most
+// recently published buffer.  Neither side ever waits on the other.
+template <class T>
+struct TripleBuffer
+{
+    static constexpr int IndexMask = 0x3;
+    static constexpr int FreshBit = 0x4;
 
-    enum Series5Opcode // 5XYN low nybble
-    {
-        HIGH5_SE_REG = 0x0,
-        HIGH5_LD_I_VXVY = 0x2,
-        HIGH5_LD_VXVY_I = 0x3,
-    };
+    std::array<T, 3> buffers;
+    std::atomic<int> middle{1};
+    int back = 0;
+    int front = 2;
 
-    enum SYSOpcode
-    {
-        SYS_CLS = 0x0E0,
-        SYS_RET = 0x0EE,
-        SYS_SCROLL_DOWN = 0x0C0,
-        SYS_SCROLL_UP = 0x0D0,
-        SYS_SCROLL_RIGHT_4 = 0xFB,
-        SYS_SCROLL_LEFT_4 = 0xFC,
-        SYS_EXIT = 0xFD,
-        SYS_ORIGINAL_SCREEN = 0xFE,
-        SYS_EXTENDED_SCREEN = 0xFF,
-    };
+    T& backBuffer() { return buffers[back]; }
+    const T& frontBuffer() const { return buffers[front]; }
 
-    enum SPECIALOpcode
-    {
-        SPECIAL_GET_DELAY = 0x07,
-        SPECIAL_KEYWAIT = 0x0A,
-        SPECIAL_SET_DELAY = 0x15,
-        SPECIAL_SET_SOUND = 0x18,
-        SPECIAL_ADD_INDEX = 0x1E,
-        SPECIAL_LD_DIGIT = 0x29,
-        SPECIAL_LD_BCD = 0x33,
-        SPECIAL_LD_IVX = 0x55,
-        SPECIAL_LD_VXI = 0x65,
-        SPECIAL_STORE_RPL = 0x75,
-        SPECIAL_LD_RPL = 0x85,
-        SPECIAL_LD_BIGDIGIT = 0x30,
-        SPECIAL_LD_I_16BIT = 0x00,
-        SPECIAL_SET_PLANES = 0x01,
-        SPECIAL_SET_AUDIO = 0x02,
-    };
+    // Producer: hand the back buffer to the consumer, take the old middle buffer.
+    void publish()
+    {
+        back = middle.exchange(back | FreshBit, std::memory_order_acq_rel) & IndexMask;
+    }
 
-    enum SKPOpcode {
-        SKP_KEY = 0x9E,
-        SKNP_KEY = 0xA1,
-    };
+    // Consumer: if a new buffer was published since the last call, make it the front buffer.
+    bool acquire()
+    {
+        if((middle.load(std::memory_order_relaxed) & FreshBit) == 0) {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & IndexMask;
+        return true;
+    }
+};
 
-    enum ALUOpcode {
-        ALU_LD = 0x0,
-        ALU_OR = 0x1,
-        ALU_AND = 0x2,
-        ALU_XOR = 0x3,
-        ALU_ADD = 0x4,
-        ALU_SUB = 0x5,
-        ALU_SHR = 0x6,
-        ALU_SUBN = 0x7,
-        ALU_SHL = 0xE,
-    };
+// Lock-free single-producer/single-consumer ring buffer.  Capacity is
+// rounded up to a power of two; head and tail increase without wrapping.
+template <class T>
+struct SPSCRingBuffer
+{
+    std::vector<T> buffer;
+    size_t mask;
+    std::atomic<size_t> head{0}; // written only by the producer
+    std::atomic<size_t> tail{0}; // written only by the consumer
 
-    enum StepResult {
-        CONTINUE,
-        EXIT_INTERPRETER,
-        UNSUPPORTED_INSTRUCTION,
-    };
+    SPSCRingBuffer(size_t minimumCapacity)
+    {
+        size_t capacity = 1;
+        while(capacity < minimumCapacity) {
+            capacity *= 2;
+        }
+        buffer.resize(capacity);
+        mask = capacity - 1;
+    }
 
-    uint16_t readU16(MEMORY& memory, uint16_t addr)
+    size_t capacity() const { return buffer.size(); }
+
+    size_t size() const
     {
-        uint8_t hiByte = memory.read(addr);
-        uint8_t loByte = memory.read(addr + 1);
-        return hiByte * 256 + loByte;
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
     }
 
-    int getInstructionSize(MEMORY& memory, uint16_t addr)
+    // Producer: store up to count items, return how many were stored.
+    size_t push(const T* src, size_t count)
     {
-        if(platform == XOCHIP) {
-            if(readU16(memory, addr) == 0xF000) {
-                return 4;
-            } else {
-                return 2;
-            }
-        } else {
-            return 2;
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        count = std::min(count, capacity() - (h - t));
+        for(size_t i = 0; i < count; i++) {
+            buffer[(h + i) & mask] = src[i];
         }
+        head.store(h + count, std::memory_order_release);
+        return count;
     }
 
-    void storeALUResult(int destination, uint8_t result, bool f)
+    // Consumer: fetch up to count items, return how many were fetched.
+    size_t pop(T* dst, size_t count)
     {
-        if(quirks & QUIRKS_VFORDER) {
-            registers[0xF] = f ? 1 : 0;
-            registers[destination] = result;
-        } else {
-            registers[destination] = result;
-            registers[0xF] = f ? 1 : 0;
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_acquire);
+        count = std::min(count, h - t);
+        for(size_t i = 0; i < count; i++) {
+            dst[i] = buffer[(t + i) & mask];
         }
+        tail.store(t + count, std::memory_order_release);
+        return count;
     }
+};
 
-    StepResult step(MEMORY& memory, INTERFACE& interface, const Clock& systemClock)
-    {
-        StepResult stepResult = CONTINUE;
-        uint16_t instructionWord = readU16(memory, pc);
-        uint8_t imm8Argument = instructionWord & 0x00FF;
-        uint8_t imm4Argument = instructionWord & 0x000F;
-        uint16_t imm12Argument = instructionWord & 0x0FFF;
-        uint16_t xArgument = (instructionWord & 0x0F00) >> 8;
-        uint16_t yArgument = (instructionWord & 0x00F0) >> 4;
-        int highNybble = instructionWord >> 12;
-        bool issueInstruction = true;
+void enqueueAudioSamples(ao_device *aodev, uint8_t *buf, size_t sz)
+{
+    ao_play(aodev, (char*)buf, sz);
+}
 
-        if(waitingForKeyPress) {
+// Highest --audio-rate; the audio ring holds a second of samples at this rate.
+constexpr int MaximumAudioRate = 192000;
 
-            bool isPressed = false;
-            uint8_t whichKey;
+ao_device *open_ao(int rate)
+{
+    ao_device *device;
+    ao_sample_format format;
+    int default_driver;
 
-            for(uint8_t i = 0; i < 16; i++) {
-                if(interface.pressed(i)) {
-                    isPressed = true;
-                    whichKey = i;
-                }
-            }
+    ao_initialize();
 
-            if(isPressed) {
-                if(debug & DEBUG_KEYS) {
-                    printf("pressed %d now wait for release\n", whichKey);
-                }
-                keyPressed = whichKey;
-                waitingForKeyPress = false;
-                waitingForKeyRelease = true;
-            } else {
-                issueInstruction = false;
-            }
-        }
+    default_driver = ao_default_driver_id();
 
-        if(waitingForKeyRelease) {
-            if(!interface.pressed(keyPressed)) {
-                if(debug & DEBUG_KEYS) {
-                    printf("key wait over\n");
-                }
-                waitingForKeyRelease = false;
-                registers[keyDestinationRegister] = keyPressed;
-            } else {
-                issueInstruction = false;
-            }
-        }
+    memset(&format, 0, sizeof(format));
+    format.bits = 8;
+    format.channels = 1;
+    format.rate = rate;
+    format.byte_format = AO_FMT_LITTLE;
 
-        if(issueInstruction) {
+    /* -- Open driver -- */
+    device = ao_open_live(default_driver, &format, NULL /* no options */);
+    if (device == NULL) {
+        fprintf(stderr, "Error opening libao audio device.\n");
+        return nullptr;
+    }
+    return device;
+}
 
-            if(debug & DEBUG_STATE) {
-                printf("CHIP8: clk:%llu pc:%04X I:%04X ", insnNumber++, pc, I);
-                for(int i = 0; i < 16; i++) {
-                    printf("%02X ", registers[i]);
-                }
-                puts("");
-            }
+// Plays samples on a dedicated thread so a blocking audio driver never
+// stalls emulation.  The emulator pushes samples into a ring buffer and
+// the thread drains it to libao in blocks.
+//
+// The block size adapts between bounds derived from the configured
+// latency range: an underrun grows it, and a long enough stretch without
+// one shrinks it again, settling on the lowest latency this host can
+// sustain.  The ring is kept to a few blocks of buffered samples, so the
+// block size also sets the queueing latency in front of the driver.
+struct AudioOutput
+{
+    static constexpr size_t ringCapacity = MaximumAudioRate;
+    static constexpr auto shrinkInterval = std::chrono::seconds(5);
+
+    ao_device *aodev = nullptr;
+    SPSCRingBuffer<uint8_t> ring{ringCapacity};
+    std::thread thread;
+    std::atomic<bool> running{false};
+    std::atomic<bool> idle{false};
+
+    int sampleRate = AOSamplingRate;
+    size_t minimumBlockSize = AOSamplingRate / 240;
+    size_t maximumBlockSize = AOSamplingRate / 10;
+    std::atomic<size_t> blockSize{AOSamplingRate / 60};
+    bool reportAdjustments = false;
+
+    // Statistics, written by the audio thread
+    std::atomic<uint64_t> blocksPlayed{0};
+    std::atomic<uint64_t> underruns{0};
+    std::atomic<uint64_t> overruns{0};
+    std::atomic<uint64_t> deviceUnderruns{0};
+    std::atomic<size_t> minimumFill{ringCapacity};
+    std::atomic<size_t> maximumFill{0};
+    std::atomic<size_t> queuedInDevice{0};
+    double minimumLatency = std::numeric_limits<double>::max();
+    double maximumLatency = 0;
+    double latencySum = 0;
+    uint64_t latencyCount = 0;
+
+    // Set the output rate; must be called before setLatencyBounds() and open().
+    void setSampleRate(int rate)
+    {
+        sampleRate = rate;
+        minimumBlockSize = std::max(1, rate / 240);
+        maximumBlockSize = rate / 10;
+        blockSize = std::max(1, rate / 60);
+    }
 
-            if(debug & DEBUG_ASM) {
-                uint16_t wordAfter = readU16(memory, pc + 2);
-                disassemble(pc, instructionWord, wordAfter);
-            }
+    // Set the latency bounds in milliseconds; must be called before open().
+    void setLatencyBounds(int minimumMilliseconds, int maximumMilliseconds)
+    {
+        minimumBlockSize = std::max((size_t)1, (size_t)minimumMilliseconds * sampleRate / 1000 / 2);
+        maximumBlockSize = std::min(ringCapacity / 4, std::max(minimumBlockSize, (size_t)maximumMilliseconds * sampleRate / 1000 / 2));
+        blockSize = std::clamp(blockSize.load(), minimumBlockSize, maximumBlockSize);
+    }
 
-            if(false) {
-                if(false && (insnNumber >= 43757)) {
-                    for(int row = 0; row < 32; row++) {
-                        for(int col = 0; col < 64; col++) {
-                            printf("%c", interface.display.at(row * 2).at(col * 2) ? '#' : '.');
-                        }
-                        puts("");
-                    }
-                }
+    bool open(bool elevatedPriority)
+    {
+        aodev = open_ao(sampleRate);
+        if(aodev == nullptr) {
+            return false;
+        }
+        running = true;
+        thread = std::thread([this]() { play(); });
+        if(elevatedPriority) {
+            sched_param param;
+            param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 1;
+            int error = pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param);
+            if(error != 0) {
+                fprintf(stderr, "AudioOutput: couldn't elevate audio thread priority: %s\n", strerror(error));
             }
-
-            uint16_t nextPC = pc + getInstructionSize(memory, pc);
-
-            switch(highNybble) {
-                case INSN_SYS: {
-                                   uint16_t sysOpcode = instructionWord & 0xFFF;
-                                   switch(sysOpcode) {
-                                       case SYS_CLS: { // 00E0 - CLS - Clear the display.
-                                                         interface.clear();
-                                                         break;
-                                                     }
-                                       case SYS_RET: { //  00EE - RET - Return from a subroutine.  The interpreter sets the program counter to the address at the top of the stack, then subtracts 1 from the stack pointer.
-                                                         nextPC = stack.back();
-                                                         stack.pop_back();
-                                                         break;
-                                                     }
-                                       case SYS_SCROLL_RIGHT_4: { // 00FB*    Scroll display 4 pixels right
-                                                                    if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
-                                                                        interface.scroll(-4, 0);
-                                                                    } else {
-                                                                        fprintf(stderr, "unsupported 0XXX instruction %04X (SCROLL RIGHT 4) - does this ROM require \"schip\" platform?\n", instructionWord);
-                                                                        stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                    }
-                                                                    break;
-                                                                }
-                                       case SYS_SCROLL_LEFT_4: { // 00FC*    Scroll display 4 pixels left
-                                                                   if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
-                                                                       interface.scroll(4, 0);
-                                                                   } else {
-                                                                       fprintf(stderr, "unsupported 0XXX instruction %04X (SCROLL ELFT 4) - does this ROM require \"schip\" platform?\n", instructionWord);
-                                                                       stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                   }
-                                                                   break;
-                                                               }
-                                       case SYS_EXIT: { // 00FD*    Exit CHIP interpreter
-                                                          if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
-                                                              stepResult = EXIT_INTERPRETER;
-                                                          } else {
-                                                              fprintf(stderr, "unsupported 0XXX instruction %04X (EXIT) - does this ROM require \"schip\" platform?\n", instructionWord);
-                                                              stepResult = UNSUPPORTED_INSTRUCTION;
-                                                          }
-                                                          break;
-                                                      }
-                                       case SYS_EXTENDED_SCREEN: { // 00FF*    Enable extended screen mode for full-screen graphics
-                                                                     if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
-                                                                         extendedScreenMode = true;
-                                                                         interface.clear();
-                                                                     } else {
-                                                                         fprintf(stderr, "unsupported 0XXX instruction %04X (EXTENDEDSCREEN) - does this ROM require \"schip\" platform?\n", instructionWord);
-                                                                         stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                     }
-                                                                     break;
-                                                                 }
-                                       case SYS_ORIGINAL_SCREEN: { // 00FE*    Disable extended screen mode
-                                                                     if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
-                                                                         extendedScreenMode = false;
-                                                                         interface.clear();
-                                                                     } else {
-                                                                         fprintf(stderr, "unsupported 0XXX instruction %04X (ORIGINALSCREEN) - does this ROM require \"schip\" platform?\n", instructionWord);
-                                                                         stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                     }
-                                                                     break;
-                                                                 }
-                                       default : { // Opcode undefined or is a range
-                                                     if((sysOpcode & 0xFF0) == SYS_SCROLL_UP) {
-                                                         // scroll-up n (0x00DN) scroll the contents of the display up by 0-15 pixels.
-                                                         if(platform == XOCHIP) {
-                                                             interface.scroll(0, imm4Argument);
-                                                         } else {
-                                                             fprintf(stderr, "unsupported 0XXX instruction %04X (SCROLL UP) - does this ROM require \"xochip\" platform?\n", instructionWord);
-                                                             stepResult = UNSUPPORTED_INSTRUCTION;
-                                                         }
-                                                     } else if((sysOpcode & 0xFF0) == SYS_SCROLL_DOWN) {
-                                                         // 00CN*    Scroll display N lines down
-                                                         if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
-                                                             interface.scroll(0, -imm4Argument);
-                                                         } else {
-                                                             fprintf(stderr, "unsupported 0XXX instruction %04X (SCROLL DOWN) - does this ROM require \"schip\" platform?\n", instructionWord);
-                                                             stepResult = UNSUPPORTED_INSTRUCTION;
-                                                         }
-                                                     } else {
-                                                         fprintf(stderr, "%04X: unsupported 0NNN instruction %04X \n", pc, instructionWord);
-                                                         stepResult = UNSUPPORTED_INSTRUCTION;
-                                                     }
-                                                     break;
-                                                 }
-                                   }
-                                   break;
-                               }
-                case INSN_JP: { // 1nnn - JP addr - Jump to location nnn.  The interpreter sets the program counter to nnn.
-                                  nextPC = imm12Argument;
-                                  break;
-                              }
-                case INSN_CALL: { // 2nnn - CALL addr - Call subroutine at nnn.  The interpreter increments the stack pointer, then puts the current PC on the top of the stack. The PC is then set to nnn.
-                                    stack.push_back(nextPC);
-                                    nextPC = imm12Argument;
-                                    break;
-                                }
-                case INSN_SE_IMM: { // 3xkk - SE Vx, byte - Skip next instruction if Vx = kk.  The interpreter compares register Vx to kk, and if they are equal, increments the program counter by 2.
-                                      if(registers[xArgument] == imm8Argument) {
-                                          nextPC = nextPC + getInstructionSize(memory, nextPC);
-                                      }
-                                      break;
-                                  }
-                case INSN_SNE_IMM: { // 4xkk - SNE Vx, byte - Skip next instruction if Vx != kk.  The interpreter compares register Vx to kk, and if they are not equal, increments the program counter by 2.
-                                       if(registers[xArgument] != imm8Argument) {
-                                           nextPC = nextPC + getInstructionSize(memory, nextPC);
-                                       }
-                                       break;
-                                   }
-                case INSN_HIGH5: {
-                                     uint8_t opcode = instructionWord & 0xF;
-                                     switch(opcode) {
-                                         case HIGH5_LD_I_VXVY : { // save vx - vy (0x5XY2) save an inclusive range of registers to memory starting at i.
-                                                                    if(platform == XOCHIP) {
-                                                                        if(xArgument < yArgument) {
-                                                                            for(int i = 0; i <= yArgument - xArgument; i++) {
-                                                                                memory.write(I + i, registers[xArgument + i]);
-                                                                            }
-                                                                        } else {
-                                                                            for(int i = 0; i <= xArgument - yArgument; i++) {
-                                                                                memory.write(I + i, registers[xArgument - i]);
-                                                                            }
-                                                                        }
-                                                                    } else {
-                                                                        fprintf(stderr, "unsupported 0XXX instruction %04X (LD I Vx-Vy ) - does this ROM require \"xochip\" platform?\n", instructionWord);
-                                                                        stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                    }
-                                                                    break;
-                                                                }
-                                         case HIGH5_LD_VXVY_I : { // load vx - vy (0x5XY3) load an inclusive range of registers from memory starting at i.
-                                                                    if(platform == XOCHIP) {
-                                                                        if(xArgument < yArgument) {
-                                                                            for(int i = 0; i <= yArgument - xArgument; i++) {
-                                                                                registers[xArgument + i] = memory.read(I + i);
-                                                                            }
-                                                                        } else {
-                                                                            for(int i = 0; i <= xArgument - yArgument; i++) {
-                                                                                registers[xArgument - i] = memory.read(I + i);
-                                                                            }
-                                                                        }
-                                                                    } else {
-                                                                        fprintf(stderr, "unsupported 0XXX instruction %04X (LD I Vx-Vy ) - does this ROM require \"xochip\" platform?\n", instructionWord);
-                                                                        stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                    }
-                                                                    break;
-                                                                }
-                                         case HIGH5_SE_REG : { // 5xy0 - SE Vx, Vy - Skip next instruction if Vx = Vy.  The interpreter compares register Vx to register Vy, and if they are equal, increments the program counter by 2.
-                                                                 if(registers[xArgument] == registers[yArgument]) {
-                                                                     nextPC = nextPC + getInstructionSize(memory, nextPC);
-                                                                 }
-                                                                 break;
-                                                             }
-                                         default : {
-                                                       if(opcode != 0) {
-                                                           fprintf(stderr, "%04X: unsupported instruction %04X\n", pc, instructionWord);
-                                                           stepResult = UNSUPPORTED_INSTRUCTION;
-                                                       }
-                                                       break;
-                                                   }
-                                     }
-                                     break;
-                                 }
-                case INSN_LD_IMM: { // 6xkk - LD Vx, byte - Set Vx = kk.  The interpreter puts the value kk into register Vx.  
-                                      registers[xArgument] = imm8Argument;
-                                      break;
-                                  }
-                case INSN_ADD_IMM: { // 7xkk - ADD Vx, byte - Set Vx = Vx + kk.  Adds the value kk to the value of register Vx, then stores the result in Vx.
-                                       registers[xArgument] = registers[xArgument] + imm8Argument;
-                                       break;
-                                   }
-                case INSN_ALU: {
-                                   int opcode = instructionWord & 0x000F;
-                                   switch(opcode) {
-                                       case ALU_LD: { // 8xy0 - LD Vx, Vy - Set Vx = Vy.  Stores the value of register Vy in register Vx.  
-                                                        registers[xArgument] = registers[yArgument];
-                                                        break;
-                                                    }
-                                       case ALU_OR: { // 8xy1 - OR Vx, Vy - Set Vx = Vx OR Vy.
-                                                        registers[xArgument] |= registers[yArgument];
-                                                        if(quirks & QUIRKS_LOGIC) {
-                                                            registers[0xF] = 0;
-                                                        }
-                                                        break;
-                                                    }
-                                       case ALU_AND: { // 8xy2 - AND Vx, Vy - Set Vx = Vx AND Vy.
-                                                         registers[xArgument] &= registers[yArgument];
-                                                         if(quirks & QUIRKS_LOGIC) {
-                                                             registers[0xF] = 0;
-                                                         }
-                                                         break;
-                                                     }
-                                       case ALU_XOR: { // 8xy3 - XOR Vx, Vy -  Set Vx = Vx XOR Vy.
-                                                         registers[xArgument] ^= registers[yArgument];
-                                                         if(quirks & QUIRKS_LOGIC) {
-                                                             registers[0xF] = 0;
-                                                         }
-                                                         break;
-                                                     }
-                                       case ALU_ADD: { // 8xy4 - ADD Vx, Vy - Set Vx = Vx + Vy, set VF = carry.  The values of Vx and Vy are added together. If the result is greater than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept, and stored in Vx.
-                                                         uint8_t result = registers[xArgument] + registers[yArgument];
-                                                         storeALUResult(xArgument, result, (registers[xArgument] + registers[yArgument]) > 0xFF);
-                                                         break;
-                                                     }
-                                       case ALU_SUB: { // 8xy5 - SUB Vx, Vy - Set Vx = Vx - Vy, set VF = NOT borrow.  If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
-                                                         uint8_t result = registers[xArgument] - registers[yArgument];
-                                                         storeALUResult(xArgument, result, registers[xArgument] >= registers[yArgument]);
-                                                         break;
-                                                     }
-                                       case ALU_SUBN: { // 8xy7 - SUBN Vx, Vy - Set Vx = Vy - Vx, set VF = NOT borrow.  If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
-                                                          uint8_t result = registers[yArgument] - registers[xArgument];
-                                                          storeALUResult(xArgument, result, registers[yArgument] >= registers[xArgument]);
-                                                          break;
-                                                      }
-                                       case ALU_SHR: { // 8xy6 - SHR Vx {, Vy} - Set Vx = Vy SHR 1.  If the least-significant bit of Vy is 1, then VF is set to 1, otherwise 0. Then Vx is Vy divided by 2. (if shift.quirk, Vx = Vx SHR 1)
-                                                         if(quirks & QUIRKS_SHIFT) {
-                                                             yArgument = xArgument;
-                                                         }
-                                                         uint8_t result = registers[yArgument] / 2;
-                                                         storeALUResult(xArgument, result, registers[yArgument] & 0x1);
-                                                         break;
-                                                     }
-                                       case ALU_SHL: { // 8xyE - SHL Vx {, Vy} - Set Vx = Vx SHL 1.  If the most-significant bit of Vy is 1, then VF is set to 1, otherwise to 0. Then Vx is Vy multiplied by 2.   (if shift.quirk, Vx = Vx SHL 1)
-                                                         if(quirks & QUIRKS_SHIFT) {
-                                                             yArgument = xArgument;
-                                                         }
-                                                         uint8_t result = registers[yArgument] * 2;
-                                                         storeALUResult(xArgument, result, registers[yArgument] & 0x80);
-                                                         break;
-                                                     }
-                                       default : {
-                                                     fprintf(stderr, "%04X: unsupported 8xyN instruction %04X\n", pc, instructionWord);
-                                                     stepResult = UNSUPPORTED_INSTRUCTION;
-                                                     break;
-                                                 }
-                                   }
-                                   break;
-                               }
-                case INSN_SNE_REG: { // 9xy0 - SNE Vx, Vy - Skip next instruction if Vx != Vy.  The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.  
-                                       if(imm4Argument != 0) {
-                                           fprintf(stderr, "%04X: unsupported 9XY0 instruction %04X\n", pc, instructionWord);
-                                           stepResult = UNSUPPORTED_INSTRUCTION;
-                                       }
-                                       if(registers[xArgument] != registers[yArgument]) {
-                                           nextPC = nextPC + getInstructionSize(memory, nextPC);
-                                       }
-                                       break;
-                                   }
-                case INSN_LD_I: { // Annn - LD I, addr - Set I = nnn.  
-                                    I = imm12Argument;
-                                    break;
-                                }
-                case INSN_JP_V0: { // Bnnn - JP V0, addr - Jump to location nnn + V0.
-                                     if(quirks & QUIRKS_JUMP) { // Ugh!
-                                         nextPC = (imm12Argument & 0xFF) + registers[xArgument] + (xArgument << 8);
-                                     } else {
-                                         nextPC = imm12Argument + registers[0];
-                                     }
-                                     break;
-                                 }
-                case INSN_RND: { // Cxkk - RND Vx, byte - Set Vx = random byte AND kk.  The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk. The results are stored in Vx. See instruction 8xy2 for more information on AND.
-                                   registers[xArgument] = uniform_dist(e1) & imm8Argument;
-                                   break;
-                               }
-                case INSN_DRW: { // Dxyn - DRW Vx, Vy, nibble
-                                   // Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
-                                   // The interpreter reads n bytes from memory, starting at the address stored in
-                                   // I. These bytes are then displayed as sprites on screen at coordinates (Vx, Vy).
-                                   // Sprites are XORed onto the existing screen. If this causes any pixels to be erased,
-                                   // VF is set to 1, otherwise it is set to 0. If the sprite is positioned so part of it
-                                   // is outside the coordinates of the display, it wraps around to the opposite side of
-                                   // the screen. See instruction 8xy3 for more information on XOR, and section 2.4,
-                                   // Display, for more information on the Chip-8 screen and sprites.
-                                   registers[0xF] = 0;
-                                   uint32_t screenWidth = extendedScreenMode ? 128 : 64;
-                                   uint32_t screenHeight = extendedScreenMode ? 64 : 32;
-                                   uint32_t pixelScale = extendedScreenMode ? 1 : 2;
-                                   uint16_t spriteByteAddress = I;
-                                   uint32_t byteCount = 1;
-                                   uint32_t rowCount = imm4Argument;
-                                   if(((platform == SCHIP_1_1) || (platform == XOCHIP)) && (imm4Argument == 0)) {
-                                       // 16x16 sprite
-                                       rowCount = 16;
-                                       byteCount = 2;
-                                   }
-                                   for(int bitplane = 0; bitplane < 2; bitplane++) {
-                                       uint8_t planeMask = 1 << bitplane;
-                                       if(screenPlaneMask & planeMask) {
-                                           for(uint32_t rowIndex = 0; rowIndex < rowCount; rowIndex++) {
-                                               for(uint32_t byteIndex = 0; byteIndex < byteCount; byteIndex++) {
-                                                   uint8_t byte = memory.read(spriteByteAddress++);
-                                                   for(uint32_t bitIndex = 0; bitIndex < 8; bitIndex++) {
-                                                       bool hasPixel = (byte >> (7 - bitIndex)) & 0x1;
-                                                       uint32_t colIndex = bitIndex + byteIndex * 8;
-                                                       if(quirks & QUIRKS_CLIP) {
-                                                           hasPixel &= (((registers[xArgument] % screenWidth) + colIndex) < screenWidth) &&
-                                                               (((registers[yArgument] % screenHeight) + rowIndex) < screenHeight);
-                                                       }
-                                                       if(hasPixel) {
-                                                           uint32_t x = (registers[xArgument] + colIndex) % screenWidth;
-                                                           uint32_t y = (registers[yArgument] + rowIndex) % screenHeight;
-                                                           if(debug & DEBUG_DRAW) {
-                                                               printf("draw %d %d (%d)\n", x, y, x + y * 64);
-                                                           }
-                                                           for(uint32_t ygrid = 0; ygrid < pixelScale; ygrid++) {
-                                                               for(uint32_t xgrid = 0; xgrid < pixelScale; xgrid++) {
-                                                                   int x2 = x * pixelScale + xgrid;
-                                                                   int y2 = y * pixelScale + ygrid;
-                                                                   if(interface.draw(x2, y2, planeMask)) {
-                                                                       registers[0xF] = 1;
-                                                                   }
-                                                               }
-                                                           }
-                                                       }
-                                                   }
-                                               }
-                                           }
-                                       }
-                                   }
-                                   break;
-                               }
-                case INSN_SKP: {
-                                   int opcode = instructionWord & 0xFF;
-                                   switch(opcode) {
-                                       case SKP_KEY: { // Ex9E - SKP Vx - Skip next instruction if key with the value of Vx is pressed.  Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, PC is increased by 2.
-                                                         if(interface.pressed(registers[xArgument])) {
-                                                             if(debug & DEBUG_KEYS) {
-                                                                 printf("clock %llu, pc %04X, SKP_KEY, key %d pressed\n", insnNumber, pc, registers[xArgument]);
-                                                             }
-                                                             nextPC = nextPC + getInstructionSize(memory, nextPC);
-                                                         }
-                                                         break;
-                                                     }
-                                       case SKNP_KEY: { // ExA1 - SKNP Vx - Skip next instruction if key with the value of Vx is not pressed.  Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.
-                                                          if(!interface.pressed(registers[xArgument])) {
-                                                              nextPC = nextPC + getInstructionSize(memory, nextPC);
-                                                          } else {
-                                                              if(debug & DEBUG_KEYS) {
-                                                                  printf("clock %llu, pc %04X, SKNP_KEY, key %d pressed\n", insnNumber, pc, registers[xArgument]);
-                                                              }
-                                                          }
-                                                          break;
-                                                      }
-                                       default : {
-                                                     fprintf(stderr, "%04X: unsupported ExNN instruction %04X\n", pc, instructionWord);
-                                                     stepResult = UNSUPPORTED_INSTRUCTION;
-                                                     break;
-                                                 }
-                                   }
-                                   break;
-                               }
-                case INSN_LD_SPECIAL :{
-                                          int opcode = instructionWord & 0xFF;
-                                          switch(opcode) {
-                                              case SPECIAL_GET_DELAY: { // Fx07 - LD Vx, DT - Set Vx = delay timer value.  The value of DT is placed into Vx.
-                                                                          registers[xArgument] = DT;
-                                                                          break;
-                                                                      }
-                                              case SPECIAL_KEYWAIT: { // Fx0A - LD Vx, K - Wait for a key press, store the value of the key in Vx.  All execution stops until a key is pressed, then the value of that key is stored in Vx.  
-                                                                        if(debug & DEBUG_KEYS) {
-                                                                            printf("waiting for key\n");
-                                                                        }
-                                                                        waitingForKeyPress = true;
-                                                                        keyDestinationRegister = xArgument;
-                                                                        break;
-                                                                    }
-                                              case SPECIAL_SET_DELAY: { // Fx15 - LD DT, Vx - Set delay timer = Vx.  DT is set equal to the value of Vx.
-
-                                                                          DT = registers[xArgument];
-                                                                          DTNextDecrementClock = systemClock.clocks + systemClock.rate / Chip8TimerFrequency;
-                                                                          break;
-                                                                      }
-                                              case SPECIAL_SET_SOUND: { // Fx18 - LD ST, Vx - Set sound timer = Vx.  ST is set equal to the value of Vx.  
-                                                                          ST = registers[xArgument];
-                                                                          if(ST > 0) {
-                                                                              interface.startAudio(systemClock);
-                                                                          }
-                                                                          STNextDecrementClock = systemClock.clocks + systemClock.rate / Chip8TimerFrequency;
-                                                                          break;
-                                                                      }
-                                              case SPECIAL_ADD_INDEX: { // Fx1E - ADD I, Vx - Set I = I + Vx.  The values of I and Vx are added, and the results are stored in I.  
-                                                                          I += registers[xArgument];
-                                                                          break;
-                                                                      }
-                                              case SPECIAL_LD_DIGIT: { // Fx29 - LD F, Vx - Set I = location of sprite for digit Vx.  The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the Chip-8 hexadecimal font.  
-                                                                         I = memory.getDigitLocation(registers[xArgument]);
-                                                                         break;
-                                                                     }
-                                              case SPECIAL_LD_BIGDIGIT: { // FX30* - Point I to 10-byte font sprite for digit VX (0..9)
-                                                                            if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
-                                                                                I = memory.getBigDigitLocation(registers[xArgument]);
-                                                                            } else {
-                                                                                fprintf(stderr, "unsupported 0XXX instruction %04X (LD BIGF) - does this ROM require \"schip\" platform?\n", instructionWord);
-                                                                                stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                            }
-                                                                            break;
-                                                                        }
-                                              case SPECIAL_LD_BCD: { // Fx33 - LD B, Vx - Store BCD representation of Vx in memory locations I, I+1, and I+2.  The interpreter takes the decimal value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.
-                                                                       memory.write(I + 0, registers[xArgument] / 100);
-                                                                       memory.write(I + 1, (registers[xArgument] % 100) / 10);
-                                                                       memory.write(I + 2, registers[xArgument] % 10);
-                                                                       break;
-                                                                   }
-                                              case SPECIAL_LD_IVX: { // Fx55 - LD [I], Vx - Store registers V0 through Vx in memory starting at location I.  The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.  
-                                                                       for(int i = 0; i <= xArgument; i++) {
-                                                                           memory.write(I + i, registers[i]);
-                                                                       }
-                                                                       if(!(quirks & QUIRKS_LOAD_STORE)) {
-                                                                           I = I + xArgument + 1;
-                                                                       }
-                                                                       break;
-                                                                   }
-                                              case SPECIAL_LD_VXI: { // Fx65 - LD Vx, [I] - Read registers V0 through Vx from memory starting at location I.  The interpreter reads values from memory starting at location I into registers V0 through Vx.
-                                                                       for(int i = 0; i <= xArgument; i++) {
-                                                                           registers[i] = memory.read(I + i);
-                                                                       }
-                                                                       if(!(quirks & QUIRKS_LOAD_STORE)) {
-                                                                           I = I + xArgument + 1;
-                                                                       }
-                                                                       break;
-                                                                   }
-                                              case SPECIAL_STORE_RPL: {
-                                                                          if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
-                                                                              for(int i = 0; i <= std::min((uint16_t)7, xArgument); i++) {
-                                                                                  RPL[i] = registers[i];
-                                                                              }
-                                                                          } else {
-                                                                              fprintf(stderr, "unsupported FXNN instruction %04X (STORE_RPL) - does this ROM require \"schip\" platform?\n", instructionWord);
-                                                                              stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                          }
-                                                                          break;
-                                                                      }
-                                              case SPECIAL_LD_RPL: {
-                                                                       if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
-                                                                           for(int i = 0; i <= std::min((uint16_t)7, xArgument); i++) {
-                                                                               registers[i] = RPL[i];
-                                                                           }
-                                                                       } else {
-                                                                           fprintf(stderr, "unsupported FXNN instruction %04X (LD_RPL) - does this ROM require \"schip\" platform?\n", instructionWord);
-                                                                           stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                       }
-                                                                       break;
-                                                                   }
-                                              case SPECIAL_LD_I_16BIT: { // F000 NNNN
-                                                                           if(platform == XOCHIP) {
-                                                                               I = readU16(memory, pc + 2);
-                                                                           } else {
-                                                                               fprintf(stderr, "unsupported 0XXX instruction %04X (LD I NNNN) - does this ROM require \"xochip\" platform?\n", instructionWord);
-                                                                               stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                           }
-                                                                           break;
-                                                                       }
-                                              case SPECIAL_SET_PLANES: { // plane n (0xFN01) select zero or more drawing planes by bitmask (0 <= n <= 3).
-                                                                           if(platform == XOCHIP) {
-                                                                               screenPlaneMask = xArgument;
-                                                                           } else {
-                                                                               fprintf(stderr, "unsupported 0XXX instruction %04X (SET PLANES) - does this ROM require \"xochip\" platform?\n", instructionWord);
-                                                                               stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                           }
-                                                                           break;
-                                                                       }
-                                              case SPECIAL_SET_AUDIO: { // audio (0xF002) store 16 bytes starting at i in the audio pattern buffer. 
-                                                                          if(platform == XOCHIP) {
-                                                                              std::array<uint8_t, 16> audioSample;
-                                                                              for(int i = 0; i < 16; i++) {
-                                                                                  audioSample.at(i) = memory.read(I + i);
-                                                                              }
-                                                                              interface.loadAudio(audioSample.data(), systemClock);
-                                                                          } else {
-                                                                              fprintf(stderr, "unsupported 0XXX instruction %04X (SET AUDIO) - does this ROM require \"xochip\" platform?\n", instructionWord);
-                                                                              stepResult = UNSUPPORTED_INSTRUCTION;
-                                                                          }
-                                                                          break;
-                                                                      }
-                                              default : {
-                                                            fprintf(stderr, "unsupported FxNN instruction %04X\n", instructionWord);
-                                                            stepResult = UNSUPPORTED_INSTRUCTION;
-                                                            break;
-                                                        }
-                                          }
-                                          break;
-                                      }
-            }
-
-            pc = nextPC;
-        }
-
-        while((DT > 0) && (DTNextDecrementClock <= systemClock.clocks)) {
-            DT--;
-            DTNextDecrementClock += systemClock.rate / Chip8TimerFrequency;
-        }
-
-        while((ST > 0) && (STNextDecrementClock <= systemClock.clocks)) {
-            ST--;
-            STNextDecrementClock += systemClock.rate / Chip8TimerFrequency;
-            if(ST == 0) {
-                interface.stopAudio();
-            }
-        }
-
-        return stepResult;
-    }
-
-    // Return the next system clock tick at which the CPU will have transitioned one CPU clock,
-    // that is to say return the least clock for which the CPU has to do some work.
-    clk_t calculateNextActivity()
-    {
-        clk_t next = (mostRecentSystemClock.clocks + cpuClockLengthInSystemClocks - 1) / cpuClockLengthInSystemClocks * cpuClockLengthInSystemClocks;
-        // XXX debug printf("CPU next is %llu\n", next);
-        return next;
-    }
-
-    // Do work associated with CPU clock transitioning to active, after mostRecentSystemClock and up to and including systemClock.
-    // Do not repeat work if called twice with same clock.
-    StepResult updatePastClock(MEMORY& memory, INTERFACE& interface, const Clock& systemClock)
-    {
-        for(uint64_t clock = calculateNextActivity(); clock <= systemClock.clocks; clock += cpuClockLengthInSystemClocks) {
-            StepResult result = step(memory, interface, Clock(systemClock, clock));
-            if(result != CONTINUE) {
-                return result;
-            }
-        }
-        mostRecentSystemClock = systemClock + 1;
-        // XXX debug printf("systemClock is %llu, most recent is now %llu\n", systemClock.clocks, mostRecentSystemClock.clocks);
-        return CONTINUE;
+        }
+        return true;
     }
-};
 
-void disassemble(uint16_t pc, uint16_t instructionWord, uint16_t wordAfter)
-{
-    enum InstructionHighNybble
-    {
-        INSN_SYS = 0x0,
-        INSN_JP = 0x1,
-        INSN_CALL = 0x2,
-        INSN_SE_IMM = 0x3,
-        INSN_SNE_IMM = 0x4,
-        INSN_HIGH5 = 0x5,
-        INSN_LD_IMM = 0x6,
-        INSN_ADD_IMM = 0x7,
-        INSN_ALU = 0x8,
-        INSN_SNE_REG = 0x9,
-        INSN_LD_I = 0xA,
-        INSN_JP_V0 = 0xB,
-        INSN_RND = 0xC,
-        INSN_DRW = 0xD,
-        INSN_SKP = 0xE,
-        INSN_LD_SPECIAL = 0xF,
-    };
+    void close()
+    {
+        if(running) {
+            running = false;
+            thread.join();
+        }
+    }
 
-    enum Series5Opcode // 5XYN low nybble
+    // Called on the emulation thread while it isn't producing samples, so
+    // that the empty ring isn't taken for a run of underruns.  The device
+    // is fed silence in the meantime, and playback re-primes once samples
+    // arrive again.
+    void setIdle(bool isIdle)
     {
-        HIGH5_SE_REG = 0x0,
-        HIGH5_LD_I_VXVY = 0x2,
-        HIGH5_LD_VXVY_I = 0x3,
-    };
+        idle = isIdle;
+    }
 
-    enum SYSOpcode
-    {
-        SYS_CLS = 0x0E0,
-        SYS_RET = 0x0EE,
-        SYS_SCROLL_DOWN = 0x0C0,
-        SYS_SCROLL_UP = 0x0D0,
-        SYS_SCROLL_RIGHT_4 = 0xFB,
-        SYS_SCROLL_LEFT_4 = 0xFC,
-        SYS_EXIT = 0xFD,
-        SYS_ORIGINAL_SCREEN = 0xFE,
-        SYS_EXTENDED_SCREEN = 0xFF,
-    };
+    size_t fillLevel() const
+    {
+        return ring.size();
+    }
 
-    enum SPECIALOpcode
-    {
-        SPECIAL_GET_DELAY = 0x07,
-        SPECIAL_KEYWAIT = 0x0A,
-        SPECIAL_SET_DELAY = 0x15,
-        SPECIAL_SET_SOUND = 0x18,
-        SPECIAL_ADD_INDEX = 0x1E,
-        SPECIAL_LD_DIGIT = 0x29,
-        SPECIAL_LD_BCD = 0x33,
-        SPECIAL_LD_IVX = 0x55,
-        SPECIAL_LD_VXI = 0x65,
-        SPECIAL_STORE_RPL = 0x75, // XXX ignored 
-        SPECIAL_LD_RPL = 0x85, // XXX ignored 
-        SPECIAL_LD_BIGDIGIT = 0x30,
-        SPECIAL_LD_I_16BIT = 0x00,
-        SPECIAL_SET_PLANES = 0x01,
-        SPECIAL_SET_AUDIO = 0x02,
-    };
+    size_t targetFill() const
+    {
+        return blockSize * 2;
+    }
 
-    enum SKPOpcode {
-        SKP_KEY = 0x9E,
-        SKNP_KEY = 0xA1,
-    };
+    // Called on the emulation thread; never waits.  Emulation is paced by
+    // wall-clock time, so if the ring has run more than a target's worth
+    // ahead of the device, the excess is dropped and counted as an overrun.
+    void enqueue(const uint8_t *samples, size_t count)
+    {
+        if(!running) {
+            return;
+        }
+        size_t room = (ring.size() < 2 * targetFill()) ? (2 * targetFill() - ring.size()) : 0;
+        size_t pushed = ring.push(samples, std::min(count, room));
+        if(pushed < count) {
+            overruns++;
+        }
+    }
 
-    enum ALUOpcode {
-        ALU_LD = 0x0,
-        ALU_OR = 0x1,
-        ALU_AND = 0x2,
-        ALU_XOR = 0x3,
-        ALU_ADD = 0x4,
-        ALU_SUB = 0x5,
-        ALU_SHR = 0x6,
-        ALU_SUBN = 0x7,
-        ALU_SHL = 0xE,
-    };
+    void recordLatency(size_t fill, size_t inDevice)
+    {
+        double latency = (fill + inDevice) * 1000.0 / sampleRate;
+        minimumLatency = std::min(minimumLatency, latency);
+        maximumLatency = std::max(maximumLatency, latency);
+        latencySum += latency;
+        latencyCount++;
+    }
 
-    uint8_t imm8Argument = instructionWord & 0x00FF;
-    uint8_t imm4Argument = instructionWord & 0x000F;
-    uint16_t imm12Argument = instructionWord & 0x0FFF;
-    uint16_t xArgument = (instructionWord & 0x0F00) >> 8;
-    uint16_t yArgument = (instructionWord & 0x00F0) >> 4;
-    int highNybble = instructionWord >> 12;
-
-    switch(highNybble) {
-        case INSN_SYS: {
-            uint16_t sysOpcode = instructionWord & 0xFFF;
-            switch(sysOpcode) {
-                case SYS_CLS: { // 00E0 - CLS - Clear the display.
-                    printf("%04X: (%04X) CLS\n", pc, instructionWord);
-                    break;
-                }
-                case SYS_RET: { //  00EE - RET - Return from a subroutine.  The interpreter sets the program counter to the address at the top of the stack, then subtracts 1 from the stack pointer.
-                    printf("%04X: (%04X) RET\n", pc, instructionWord);
-                    break;
-                }
-                case SYS_SCROLL_RIGHT_4: { // 00FB*    Scroll display 4 pixels right
-                    printf("%04X: (%04X) SCROLLRIGHT 4\n", pc, instructionWord);
-                    break;
-                }
-                case SYS_SCROLL_LEFT_4: { // 00FC*    Scroll display 4 pixels left
-                    printf("%04X: (%04X) SCROLLLEFT 4\n", pc, instructionWord);
-                    break;
-                }
-                case SYS_EXIT: { // 00FD*    Exit CHIP interpreter
-                    printf("%04X: (%04X) EXIT\n", pc, instructionWord);
-                    break;
-                }
-                case SYS_EXTENDED_SCREEN: { // 00FF*    Enable extended screen mode for full-screen graphics
-                    printf("%04X: (%04X) EXTENDEDSCREEN\n", pc, instructionWord);
-                    break;
-                }
-                case SYS_ORIGINAL_SCREEN: { // 00FE*    Disable extended screen mode
-                    printf("%04X: (%04X) ORIGINALSCREEN\n", pc, instructionWord);
-                    break;
-                }
-                default : { // Opcode undefined or is a range
-                    if((sysOpcode & 0xFF0) == SYS_SCROLL_UP) {
-                        printf("%04X: (%04X) SCROLLUP %d\n", pc, instructionWord, imm4Argument);
-                    } else if((sysOpcode & 0xFF0) == SYS_SCROLL_DOWN) {
-                        printf("%04X: (%04X) SCROLLDN %d\n", pc, instructionWord, imm4Argument);
-                    } else {
-                        printf("%04X: (%04X) ???\n", pc, instructionWord);
+    void play()
+    {
+        std::vector<uint8_t> block(maximumBlockSize);
+        uint8_t lastSample = 128;
+        bool primed = false;
+
+        // libao doesn't report the driver's queue depth, so estimate it
+        // from samples written versus wall-clock time since the first write.
+        uint64_t samplesWritten = 0;
+        std::chrono::steady_clock::time_point deviceStart;
+        auto lastAdjustment = std::chrono::steady_clock::now();
+
+        while(running) {
+            size_t size = blockSize;
+            size_t fill = ring.size();
+            minimumFill = std::min(minimumFill.load(), fill);
+            maximumFill = std::max(maximumFill.load(), fill);
+
+            auto now = std::chrono::steady_clock::now();
+            size_t got = size;
+            if(idle) {
+                // Discard anything left over from before and hold the last
+                // level; the block size is left alone until samples resume.
+                ring.pop(block.data(), size);
+                std::fill(block.begin(), block.begin() + size, lastSample);
+                primed = false;
+                lastAdjustment = now;
+            } else {
+                if(!primed) {
+                    // Let the ring fill to its target before starting the device
+                    if(fill < targetFill()) {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        continue;
                     }
-                    break;
-                }
-            }
-            break;
-        }
-        case INSN_JP: { // 1nnn - JP addr - Jump to location nnn.  The interpreter sets the program counter to nnn.
-            printf("%04X: (%04X) JP %X\n", pc, instructionWord, imm12Argument);
-            break;
-        }
-        case INSN_CALL: { // 2nnn - CALL addr - Call subroutine at nnn.  The interpreter increments the stack pointer, then puts the current PC on the top of the stack. The PC is then set to nnn.
-            printf("%04X: (%04X) CALL %X\n", pc, instructionWord, imm12Argument);
-            break;
-        }
-        case INSN_SE_IMM: { // 3xkk - SE Vx, byte - Skip next instruction if Vx = kk.  The interpreter compares register Vx to kk, and if they are equal, increments the program counter by 2.
-            printf("%04X: (%04X) SE V%X %X\n", pc, instructionWord, xArgument, imm8Argument);
-            break;
-        }
-        case INSN_SNE_IMM: { // 4xkk - SNE Vx, byte - Skip next instruction if Vx != kk.  The interpreter compares register Vx to kk, and if they are not equal, increments the program counter by 2.
-            printf("%04X: (%04X) SNE V%X %X\n", pc, instructionWord, xArgument, imm8Argument);
-            break;
-        }
-        case INSN_HIGH5: {
-            uint8_t opcode = instructionWord & 0xF;
-            switch(opcode) {
-                case HIGH5_LD_I_VXVY : { // save vx - vy (0x5XY2) save an inclusive range of registers to memory starting at i.
-                    printf("%04X: (%04X) LD I V%X %X\n", pc, instructionWord, xArgument, imm8Argument);
-                    break;
-                }
-                case HIGH5_LD_VXVY_I : { // load vx - vy (0x5XY3) load an inclusive range of registers from memory starting at i.
-                    printf("%04X: (%04X) LD V%X %X I\n", pc, instructionWord, xArgument, imm8Argument);
-                    break;
+                    primed = true;
+                    lastAdjustment = now;
                 }
-                case HIGH5_SE_REG : { // 5xy0 - SE Vx, Vy - Skip next instruction if Vx = Vy.  The interpreter compares register Vx to register Vy, and if they are equal, increments the program counter by 2.
-                    printf("%04X: (%04X) SE V%X V%X\n", pc, instructionWord, xArgument, yArgument);
-                    break;
-                }
-                default : {
-                    printf("%04X: (%04X) ???\n", pc, instructionWord);
-                    break;
+                got = ring.pop(block.data(), size);
+                if(got > 0) {
+                    lastSample = block[got - 1];
                 }
             }
-            break;
-        }
-        case INSN_LD_IMM: { // 6xkk - LD Vx, byte - Set Vx = kk.  The interpreter puts the value kk into register Vx.  
-            printf("%04X: (%04X) LD V%X %X\n", pc, instructionWord, xArgument, imm8Argument);
-            break;
-        }
-        case INSN_ADD_IMM: { // 7xkk - ADD Vx, byte - Set Vx = Vx + kk.  Adds the value kk to the value of register Vx, then stores the result in Vx.
-            printf("%04X: (%04X) ADD V%X, %X\n", pc, instructionWord, xArgument, imm8Argument);
-            break;
-        }
-        case INSN_ALU: {
-            int opcode = instructionWord & 0x000F;
-            switch(opcode) {
-                case ALU_LD: { // 8xy0 - LD Vx, Vy - Set Vx = Vy.  Stores the value of register Vy in register Vx.  
-                    printf("%04X: (%04X) LD V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
-                    break;
-                }
-                case ALU_OR: { // 8xy1 - OR Vx, Vy - Set Vx = Vx OR Vy.
-                    printf("%04X: (%04X) OR V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
-                    break;
-                }
-                case ALU_AND: { // 8xy2 - AND Vx, Vy - Set Vx = Vx AND Vy.
-                    printf("%04X: (%04X) AND V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
-                    break;
-                }
-                case ALU_XOR: { // 8xy3 - XOR Vx, Vy -  Set Vx = Vx XOR Vy.
-                    printf("%04X: (%04X) XOR V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
-                    break;
-                }
-                case ALU_ADD: { // 8xy4 - ADD Vx, Vy - Set Vx = Vx + Vy, set VF = carry.  The values of Vx and Vy are added together. If the result is greater than 8 bits (i.e., > 255,) VF is set to 1, otherwise 0. Only the lowest 8 bits of the result are kept, and stored in Vx.
-                    printf("%04X: (%04X) ADD V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
-                    break;
-                }
-                case ALU_SUB: { // 8xy5 - SUB Vx, Vy - Set Vx = Vx - Vy, set VF = NOT borrow.  If Vx > Vy, then VF is set to 1, otherwise 0. Then Vy is subtracted from Vx, and the results stored in Vx.
-                    printf("%04X: (%04X) SUB V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
-                    break;
-                }
-                case ALU_SUBN: { // 8xy7 - SUBN Vx, Vy - Set Vx = Vy - Vx, set VF = NOT borrow.  If Vy > Vx, then VF is set to 1, otherwise 0. Then Vx is subtracted from Vy, and the results stored in Vx.
-                    printf("%04X: (%04X) SUBN V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
-                    break;
-                }
-                case ALU_SHR: { // 8xy6 - SHR Vx {, Vy} - Set Vx = Vy SHR 1.  If the least-significant bit of Vy is 1, then VF is set to 1, otherwise 0. Then Vx is Vy divided by 2. (if shift.quirk, Vx = Vx SHR 1)
-                    printf("%04X: (%04X) SHR V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
-                    break;
-                }
-                case ALU_SHL: { // 8xyE - SHL Vx {, Vy} - Set Vx = Vx SHL 1.  If the most-significant bit of Vy is 1, then VF is set to 1, otherwise to 0. Then Vx is Vy multiplied by 2.   (if shift.quirk, Vx = Vx SHL 1)
-                    printf("%04X: (%04X) SHL V%X, V%X\n", pc, instructionWord, xArgument, yArgument);
-                    break;
+
+            if(got < size) {
+                // Hold the last level rather than dropping to zero to avoid a click
+                std::fill(block.begin() + got, block.begin() + size, lastSample);
+                underruns++;
+                blockSize = std::min(maximumBlockSize, size + std::max((size_t)1, size / 4));
+                lastAdjustment = now;
+                if(reportAdjustments) {
+                    fprintf(stderr, "audio: underrun, block size now %zu samples\n", blockSize.load());
                 }
-                default : {
-                    printf("%04X: (%04X) ???\n", pc, instructionWord);
-                    break;
+            } else if((now - lastAdjustment > shrinkInterval) && (size > minimumBlockSize)) {
+                blockSize = std::max(minimumBlockSize, size - std::max((size_t)1, size / 10));
+                lastAdjustment = now;
+                if(reportAdjustments) {
+                    fprintf(stderr, "audio: stable, block size now %zu samples\n", blockSize.load());
                 }
             }
-            break;
-        }
-        case INSN_SNE_REG: { // 9xy0 - SNE Vx, Vy - Skip next instruction if Vx != Vy.  The values of Vx and Vy are compared, and if they are not equal, the program counter is increased by 2.  
-            printf("%04X: (%04X) SNE V%X V%X\n", pc, instructionWord, xArgument, yArgument);
-            break;
-        }
-        case INSN_LD_I: { // Annn - LD I, addr - Set I = nnn.  
-            printf("%04X: (%04X) LD I %X\n", pc, instructionWord, imm12Argument);
-            break;
-        }
-        case INSN_JP_V0: { // Bnnn - JP V0, addr - Jump to location nnn + V0.
-            printf("%04X: (%04X) JP V0, %X\n", pc, instructionWord, imm12Argument);
-            break;
-        }
-        case INSN_RND: { // Cxkk - RND Vx, byte - Set Vx = random byte AND kk.  The interpreter generates a random number from 0 to 255, which is then ANDed with the value kk. The results are stored in Vx. See instruction 8xy2 for more information on AND.
-            printf("%04X: (%04X) RND V%X, %X\n", pc, instructionWord, xArgument, imm8Argument);
-            break;
-        }
-        case INSN_DRW: { // Dxyn - DRW Vx, Vy, nibble
-            printf("%04X: (%04X) DRW V%X, V%X, %X\n", pc, instructionWord, xArgument, yArgument, imm4Argument);
-            break;
-        }
-        case INSN_SKP: {
-            int opcode = instructionWord & 0xFF;
-            switch(opcode) {
-                case SKP_KEY: { // Ex9E - SKP Vx - Skip next instruction if key with the value of Vx is pressed.  Checks the keyboard, and if the key corresponding to the value of Vx is currently in the down position, PC is increased by 2.
-                    printf("%04X: (%04X) SKP V%X\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SKNP_KEY: { // ExA1 - SKNP Vx - Skip next instruction if key with the value of Vx is not pressed.  Checks the keyboard, and if the key corresponding to the value of Vx is currently in the up position, PC is increased by 2.
-                    printf("%04X: (%04X) SKNP V%X\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                default : {
-                    printf("%04X: (%04X) ???\n", pc, instructionWord);
-                    break;
-                }
+
+            enqueueAudioSamples(aodev, block.data(), size);
+            blocksPlayed++;
+
+            now = std::chrono::steady_clock::now();
+            if(samplesWritten == 0) {
+                deviceStart = now;
             }
-            break;
-        }
-        case INSN_LD_SPECIAL :{
-            int opcode = instructionWord & 0xFF;
-            switch(opcode) {
-                case SPECIAL_GET_DELAY: { // Fx07 - LD Vx, DT - Set Vx = delay timer value.  The value of DT is placed into Vx.
-                    printf("%04X: (%04X) LD V%X, DT\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_KEYWAIT: { // Fx0A - LD Vx, K - Wait for a key press, store the value of the key in Vx.  All execution stops until a key is pressed, then the value of that key is stored in Vx.  
-                    printf("%04X: (%04X) LD V%X, K\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_SET_DELAY: { // Fx15 - LD DT, Vx - Set delay timer = Vx.  DT is set equal to the value of Vx.
-                    printf("%04X: (%04X) LD DT, V%X\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_SET_SOUND: { // Fx18 - LD ST, Vx - Set sound timer = Vx.  ST is set equal to the value of Vx.  
-                    printf("%04X: (%04X) LD ST, V%X\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_ADD_INDEX: { // Fx1E - ADD I, Vx - Set I = I + Vx.  The values of I and Vx are added, and the results are stored in I.  
-                    printf("%04X: (%04X) ADD I, V%X\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_LD_DIGIT: { // Fx29 - LD F, Vx - Set I = location of sprite for digit Vx.  The value of I is set to the location for the hexadecimal sprite corresponding to the value of Vx. See section 2.4, Display, for more information on the Chip-8 hexadecimal font.  
-                    printf("%04X: (%04X) LD F, V%X\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_LD_BIGDIGIT: { // FX30* - Point I to 10-byte font sprite for digit VX (0..9)
-                    printf("%04X: (%04X) LD BIGF, V%X\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_LD_BCD: { // Fx33 - LD B, Vx - Store BCD representation of Vx in memory locations I, I+1, and I+2.  The interpreter takes the decimal value of Vx, and places the hundreds digit in memory at location in I, the tens digit at location I+1, and the ones digit at location I+2.
-                    printf("%04X: (%04X) LD B, V%X\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_LD_IVX: { // Fx55 - LD [I], Vx - Store registers V0 through Vx in memory starting at location I.  The interpreter copies the values of registers V0 through Vx into memory, starting at the address in I.  
-                    printf("%04X: (%04X) LD [I], V%X\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_LD_VXI: { // Fx65 - LD Vx, [I] - Read registers V0 through Vx from memory starting at location I.  The interpreter reads values from memory starting at location I into registers V0 through Vx.
-                    printf("%04X: (%04X) LD V%X, [I]\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_STORE_RPL: {
-                    printf("%04X: (%04X) ???\n", pc, instructionWord);
-                    break;
-                }
-                case SPECIAL_LD_RPL: {
-                    printf("%04X: (%04X) ???\n", pc, instructionWord);
-                    break;
-                }
-                case SPECIAL_LD_I_16BIT: { // F000 NNNN
-                    printf("%04X: (%04X) LD I %04X\n", pc, instructionWord, wordAfter);
-                    break;
-                }
-                case SPECIAL_SET_PLANES: { // plane n (0xFN01) select zero or more drawing planes by bitmask (0 <= n <= 3).
-                    printf("%04X: (%04X) PLANES %04X\n", pc, instructionWord, xArgument);
-                    break;
-                }
-                case SPECIAL_SET_AUDIO: { // audio (0xF002) store 16 bytes starting at i in the audio pattern buffer. 
-                    printf("%04X: (%04X) AUDIO\n", pc, instructionWord);
-                    break;
-                }
-                default : {
-                    printf("%04X: (%04X) ???\n", pc, instructionWord);
-                    break;
-                }
+            samplesWritten += size;
+            int64_t consumed = std::chrono::duration_cast<std::chrono::microseconds>(now - deviceStart).count() * sampleRate / 1000000;
+            int64_t inDevice = (int64_t)samplesWritten - consumed;
+            if(inDevice < 0) {
+                // The device drained completely; restart the estimate from here.
+                deviceUnderruns++;
+                samplesWritten = 0;
+                inDevice = 0;
+            }
+            queuedInDevice = inDevice;
+            if(primed) {
+                recordLatency(ring.size(), inDevice);
             }
-            break;
         }
     }
-}
-
-
-std::vector<uint8_t> digitSprites = {
-#if 0
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80, // F
-#else
-    0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-    0x20, 0x60, 0x20, 0x20, 0x70, // 1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-    0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-    0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-    0xF0, 0x80, 0xF0, 0x80, 0x80, // F
-#endif
-};
-
-
-std::vector<uint8_t> largeDigitSprites = {
-#if 0
-The MIT License (MIT)
-
-Copyright (c) 2015, John Earnest
 
-Permission is hereby granted, free of charge, to any person obtaining a copy
-of this software and associated documentation files (the "Software"), to deal
-in the Software without restriction, including without limitation the rights
-to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
-copies of the Software, and to permit persons to whom the Software is
-furnished to do so, subject to the following conditions:
-
-The above copyright notice and this permission notice shall be included in
-all copies or substantial portions of the Software.
-
-THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
-IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
-FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
-AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
-LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
-OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
-THE SOFTWARE.
-#endif
-    0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
-    0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
-    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
-    0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
-    0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
-    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
-    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
-    0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
-    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
-    0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
-    0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
-    0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
-    0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
-    0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
-    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
-    0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0  // F
+    void printStatistics()
+    {
+        fprintf(stderr, "audio: %llu blocks played, %llu underruns, %llu overruns, %llu device underruns\n",
+            (unsigned long long)blocksPlayed.load(), (unsigned long long)underruns.load(), (unsigned long long)overruns.load(), (unsigned long long)deviceUnderruns.load());
+        fprintf(stderr, "audio: ring fill %zu..%zu samples, block size %zu samples (bounds %zu..%zu), device queue %zu samples\n",
+            minimumFill.load(), maximumFill.load(), blockSize.load(), minimumBlockSize, maximumBlockSize, queuedInDevice.load());
+        if(latencyCount > 0) {
+            fprintf(stderr, "audio: latency min %.1f ms, mean %.1f ms, max %.1f ms\n",
+                minimumLatency, latencySum / latencyCount, maximumLatency);
+        }
+    }
 };
 
-struct Memory
+// Writes every synthesized output sample to a WAV file for --record-audio,
+// independent of the audio device.  The emulation thread fills large
+// blocks and hands full ones to a writer thread through a bounded queue,
+// taking recycled blocks back from it, so it never waits on the disk.  If
+// the writer falls so far behind that the queue fills, blocks are dropped
+// and counted rather than stalling emulation.
+struct AudioRecorder
 {
-    std::array<uint8_t, 65536> memory;
-
-    std::array<uint16_t, 16> digitAddresses = {0};
-
-    std::array<uint16_t, 16> largeDigitAddresses = {0};
-
-    ChipPlatform platform;
+    typedef std::vector<uint8_t> Block;
+
+    static constexpr size_t blockSize = 65536;
+    static constexpr size_t queueBlocks = 256;
+    static constexpr size_t headerSize = 44;
+
+    FILE *fp = nullptr;
+    uint32_t sampleRate = AOSamplingRate;
+    SPSCRingBuffer<Block*> full{queueBlocks};
+    SPSCRingBuffer<Block*> recycled{queueBlocks};
+    std::thread writer;
+    std::atomic<bool> stopping{false};
+
+    // Emulation thread
+    std::vector<std::unique_ptr<Block>> blocks;
+    Block *current = nullptr;
+    uint64_t samples = 0;
+    uint64_t droppedSamples = 0;
+
+    // Writer thread
+    uint64_t samplesWritten = 0;
+    bool writeFailed = false;
+
+    // Canonical 44-byte header for 8-bit unsigned mono PCM at sampleRate.
+    void makeHeader(uint8_t header[headerSize], uint32_t dataSize)
+    {
+        auto put32 = [](uint8_t *p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; };
+        auto put16 = [](uint8_t *p, uint16_t v) { p[0] = v; p[1] = v >> 8; };
+        memcpy(header, "RIFF", 4);
+        put32(header + 4, 36 + dataSize);
+        memcpy(header + 8, "WAVEfmt ", 8);
+        put32(header + 16, 16);
+        put16(header + 20, 1);                  // PCM
+        put16(header + 22, 1);                  // channels
+        put32(header + 24, sampleRate);
+        put32(header + 28, sampleRate);         // bytes per second
+        put16(header + 32, 1);                  // bytes per frame
+        put16(header + 34, 8);                  // bits per sample
+        memcpy(header + 36, "data", 4);
+        put32(header + 40, dataSize);
+    }
 
-    Memory(ChipPlatform platform) :
-        platform(platform)
+    bool open(const char *filename, uint32_t rate)
     {
-        for(uint16_t i = 0; i < digitSprites.size(); i++) {
-            uint16_t address = i;
-            write(address, digitSprites[i]);
-            if(i % 5 == 0) {
-                digitAddresses[i / 5] = address;
-            }
+        sampleRate = rate;
+        fp = fopen(filename, "wb");
+        if(fp == nullptr) {
+            return false;
         }
-        if((platform == SCHIP_1_1) || (platform == XOCHIP)) {
-            for(uint16_t i = 0; i < largeDigitSprites.size(); i++) {
-                uint16_t address = (uint16_t)digitSprites.size() + i;
-                write(address, largeDigitSprites[i]);
-                if(i % 10 == 0) {
-                    largeDigitAddresses[i / 10] = address;
-                }
-            }
+        // Sizes are patched in by close()
+        uint8_t header[headerSize];
+        makeHeader(header, 0);
+        if(fwrite(header, 1, headerSize, fp) != headerSize) {
+            fclose(fp);
+            fp = nullptr;
+            return false;
         }
+        current = newBlock();
+        writer = std::thread([this]() { run(); });
+        return true;
     }
 
-    uint8_t read(uint16_t addr)
+    Block *newBlock()
     {
-        if(false)printf("read(%x) -> %x\n", addr, memory[addr]);
-        if((platform != SCHIP_1_1) && (platform != XOCHIP)) {
-            assert(addr < 4096);
+        Block *block;
+        if(recycled.pop(&block, 1) == 0) {
+            blocks.push_back(std::make_unique<Block>());
+            block = blocks.back().get();
+            block->reserve(blockSize);
         }
-        return memory[addr];
+        block->clear();
+        return block;
     }
 
-    void write(uint16_t addr, uint8_t v)
+    // Called on the emulation thread with each buffer of output samples.
+    void add(const uint8_t *data, size_t count)
     {
-        if((platform != SCHIP_1_1) && (platform != XOCHIP)) {
-            assert(addr < 4096);
+        samples += count;
+        while(count > 0) {
+            size_t run = std::min(count, blockSize - current->size());
+            current->insert(current->end(), data, data + run);
+            data += run;
+            count -= run;
+            if(current->size() == blockSize) {
+                if(full.push(&current, 1) == 1) {
+                    current = newBlock();
+                } else {
+                    droppedSamples += current->size();
+                    current->clear();
+                }
+            }
         }
-        memory[addr] = v;
     }
 
-    uint16_t getDigitLocation(uint8_t digit)
+    // Writes out everything queued, finishes the header, and reports.
+    // Returns false if writing failed.
+    bool close()
     {
-        return digitAddresses[digit];
+        if(fp == nullptr) {
+            return true;
+        }
+        if(!current->empty()) {
+            if(full.push(&current, 1) == 0) {
+                droppedSamples += current->size();
+            }
+        }
+        stopping = true;
+        writer.join();
+
+        // RIFF sizes are 32 bits, which is over a day of audio
+        uint32_t dataSize = (uint32_t)std::min(samplesWritten, (uint64_t)UINT32_MAX - 36);
+        uint8_t header[headerSize];
+        makeHeader(header, dataSize);
+        if(dataSize & 1) {
+            // Chunks are padded to an even length
+            writeFailed = writeFailed || (fputc(0, fp) == EOF);
+        }
+        writeFailed = writeFailed || (fseek(fp, 0, SEEK_SET) != 0) || (fwrite(header, 1, headerSize, fp) != headerSize);
+        writeFailed = writeFailed || (fclose(fp) != 0);
+        fp = nullptr;
+
+        fprintf(stderr, "audio recording: %llu samples, %.2f seconds\n", (unsigned long long)samplesWritten, samplesWritten / (double)sampleRate);
+        if(droppedSamples > 0) {
+            fprintf(stderr, "audio recording: the writer fell behind and %llu of %llu samples were dropped\n",
+                (unsigned long long)droppedSamples, (unsigned long long)samples);
+        }
+        return !writeFailed;
     }
 
-    uint16_t getBigDigitLocation(uint8_t digit)
+    void run()
     {
-        if((platform != SCHIP_1_1) && (platform != XOCHIP)) {
-            abort();
-        }
-        if(platform != XOCHIP) {
-            assert(digit < 10);
+        Block *block;
+        for(;;) {
+            if(full.pop(&block, 1) == 1) {
+                writeFailed = writeFailed || (fwrite(block->data(), 1, block->size(), fp) != block->size());
+                samplesWritten += block->size();
+                recycled.push(&block, 1);
+            } else if(stopping) {
+                if(full.size() == 0) {
+                    return;
+                }
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
         }
-        return largeDigitAddresses[digit];
     }
 };
 
-typedef std::array<uint8_t, 3> vec3ub;
-
-vec3ub vec3ubFromInts(int r, int g, int b)
-{
-    return { (uint8_t)r, (uint8_t)g, (uint8_t)b };
-}
-
-void enqueueAudioSamples(ao_device *aodev, uint8_t *buf, size_t sz)
+struct Interface : public EmulatedInterface
 {
-    ao_play(aodev, (char*)buf, sz);
-}
+    TripleBuffer<DisplayImage> frames;
+    std::array<vec3ub, 256> colorTable;
+    std::atomic<bool> closed{false};
+    std::atomic<bool> fastForwardHeld{false};
+    DisplayRotation rotation;
 
-constexpr int AOSamplingRate = 44100;
+    // Dynamic rate control: the output sample rate is nudged by up to
+    // maximumRateAdjustment so the audio ring stays near its target fill,
+    // making the effective emulated audio clock follow the device's clock.
+    static constexpr double maximumRateAdjustment = 0.005;
+    static constexpr double fillSmoothing = 0.05;
+    double smoothedFill = -1;
+    double rateRatio = 1.0;
+    double minimumRateRatio = 1.0;
+    double maximumRateRatio = 1.0;
 
-ao_device *open_ao()
-{
-    ao_device *device;
-    ao_sample_format format;
-    int default_driver;
-
-    ao_initialize();
-
-    default_driver = ao_default_driver_id();
-
-    memset(&format, 0, sizeof(format));
-    format.bits = 8;
-    format.channels = 1;
-    format.rate = AOSamplingRate;
-    format.byte_format = AO_FMT_LITTLE;
-
-    /* -- Open driver -- */
-    device = ao_open_live(default_driver, &format, NULL /* no options */);
-    if (device == NULL) {
-        fprintf(stderr, "Error opening libao audio device.\n");
-        return nullptr;
-    }
-    return device;
-}
-
-
-// XXX In support of debugging
-static unsigned char blob[300000];
-static size_t blobsize;
-void loadblob() __attribute__((constructor));
-void loadblob() 
-{
-    FILE *fp = fopen("blob.44k", "rb");
-    assert(fp);
-    blobsize = fread(blob, 1, sizeof(blob), fp);
-    fclose(fp);
-}
-
-struct Interface
-{
-    ChipPlatform platform;
-    std::array<std::array<uint8_t, 128>, 64> display;
-    std::array<vec3ub, 256> colorTable;
-    std::array<uint8_t, XOChipAudioSampleSize> audioSample;
-    uint64_t audioInputSampleLengthInSystemClocks;
-    bool displayChanged = true;
-    bool closed = false;
-    std::array<bool, 16> keyPressed;
-    bool aKeyWasPressed = false;
-    DisplayRotation rotation;
-
-    Clock mostRecentSystemClock;
-    Clock audioSampleStartClock;
-    bool audioActive = false;
-    uint8_t currentAudioSample = 128 - 16;
-
-    bool succeeded = false;
+    bool succeeded = false;
 
     mfb_window *window;
     int windowWidth;
     int windowHeight;
     uint32_t* windowBuffer;
+    PerfCounterGroup *redrawCounters = nullptr;
 
-    ao_device *aodev;
-    static constexpr size_t audioOutputBufferSize = AOSamplingRate / 60;
-    uint8_t audioOutputBuffer[audioOutputBufferSize];
-    uint64_t previousAudioOutputSample = std::numeric_limits<uint64_t>::max();
-    uint64_t nextBufferSample = 0;
-    uint64_t audioOutputSampleLengthInSystemClocks;
+    AudioOutput audio;
+    AudioRecorder *audioRecorder;
 
     static int initialScaleFactor(DisplayRotation rotation) {
         switch(rotation) {
@@ -1441,95 +610,94 @@ struct Interface
         }
     }
 
-    Interface(ChipPlatform platform, const std::string& name, DisplayRotation rotation, const Clock& systemClock) :
-        platform(platform),
+    Interface(ChipPlatform platform, const std::string& name, DisplayRotation rotation, const Clock& systemClock, bool elevatedAudioPriority, int minimumAudioLatency, int maximumAudioLatency, bool reportAudioAdjustments, int audioRate, AudioRecorder *audioRecorder) :
+        EmulatedInterface(platform, systemClock),
         rotation(rotation),
-        mostRecentSystemClock(systemClock),
-        audioSampleStartClock(systemClock.clocks),
         windowWidth((((rotation == ROT_0) || (rotation == ROT_180)) ? 128 : 64) * initialScaleFactor(rotation)),
-        windowHeight((((rotation == ROT_0) || (rotation == ROT_180)) ? 64 : 128) * initialScaleFactor(rotation))
+        windowHeight((((rotation == ROT_0) || (rotation == ROT_180)) ? 64 : 128) * initialScaleFactor(rotation)),
+        audioRecorder(audioRecorder)
     {
+        audioRecorded = (audioRecorder != nullptr);
+        setOutputSampleRate(audioRate);
+
         window = mfb_open_ex(name.c_str(), windowWidth, windowHeight, WF_RESIZABLE);
         if (!window) {
             fprintf(stderr, "Interface: Error opening window.\n");
             return;
         }
 
-        aodev = open_ao();
-        if(aodev == NULL) {
-            fprintf(stderr, "Interface: Error opening audio.\n");
-            return;
-        }
-
-        // XXX debug
-#if 0
-        for(size_t b = 0; b < blobsize; b += 441) {
-            enqueueAudioSamples(aodev, blob + b, 441);
+        audio.setSampleRate(audioRate);
+        audio.setLatencyBounds(minimumAudioLatency, maximumAudioLatency);
+        audio.reportAdjustments = reportAudioAdjustments;
+        if(!audio.open(elevatedAudioPriority)) {
+            if(audioRecorder == nullptr) {
+                fprintf(stderr, "Interface: Error opening audio.\n");
+                return;
+            }
+            fprintf(stderr, "Interface: no audio device, recording audio without playing it.\n");
         }
-#endif
 
         windowBuffer = new uint32_t[windowWidth * windowHeight];
         mfb_set_user_data(window, (void *) this);
         mfb_set_resize_callback(window, resizecb);
         mfb_set_keyboard_callback(window, keyboardcb);
 
-        keyPressed.fill(false);
-
         colorTable.fill({0,0,0});
         colorTable[0] = {153, 102, 0};
-        colorTable[1] = {255, 204, 0}; 
+        colorTable[1] = {255, 204, 0};
         colorTable[2] = {170, 170, 170};
         colorTable[3] = {85, 85, 85};
 
-        clear();
+        publishFrame();
 
-	// XXX is this correct?  John's spec says it but feels like
-	// an error.  Do all XOCHIP variants always set buffer before
-	// calling audio?
-	audioSample.fill(0);
+        succeeded = true;
+    }
 
-        if(platform != XOCHIP) {
-            audioSample[0] = 0xff;
-            audioSample[2] = 0xff;
-            audioSample[4] = 0xff;
-            audioSample[6] = 0xff;
-            audioSample[8] = 0xff;
-            audioSample[10] = 0xff;
-            audioSample[12] = 0xff;
-            audioSample[14] = 0xff;
+    void emitAudio(const uint8_t *samples, size_t count) override
+    {
+        if(audioRecorder != nullptr) {
+            audioRecorder->add(samples, count);
         }
+        if(!audioMuted) {
+            audio.enqueue(samples, count);
+        }
+    }
 
-        audioOutputSampleLengthInSystemClocks = systemClock.rate / AOSamplingRate;
-        audioInputSampleLengthInSystemClocks = systemClock.rate / XOChipAudioSampleRate;
-
-        succeeded = true;
+    // Called once per field on the emulation thread.  Compares the audio
+    // ring's fill to its target and retunes the output sample step.
+    void adjustAudioRate()
+    {
+        double fill = audio.fillLevel();
+        smoothedFill = (smoothedFill < 0) ? fill : (smoothedFill + (fill - smoothedFill) * fillSmoothing);
+        double target = audio.targetFill();
+        double error = std::clamp((target - smoothedFill) / target, -1.0, 1.0);
+        rateRatio = 1.0 + maximumRateAdjustment * error;
+        minimumRateRatio = std::min(minimumRateRatio, rateRatio);
+        maximumRateRatio = std::max(maximumRateRatio, rateRatio);
+        setOutputSampleStep((clk_fixed_t)((double)nominalOutputSampleStep / rateRatio));
     }
 
-    void loadAudio(const uint8_t* audioSampleSrc, const Clock& clk)
+    void printAudioRateStatistics()
     {
-        std::copy(audioSampleSrc, audioSampleSrc + 16, std::begin(audioSample));
-        audioSampleStartClock = clk;
+        fprintf(stderr, "audio: rate ratio %.5f (range %.5f..%.5f), smoothed ring fill %.0f of target %zu samples\n",
+            rateRatio, minimumRateRatio, maximumRateRatio, smoothedFill, audio.targetFill());
     }
 
-    void scroll(int dx, int dy)
+    // Called on the emulation thread; copies the display for the render thread.
+    void publishFrame()
     {
-        static std::array<std::array<uint8_t, 128>, 64> display2;
-        display2 = display; // XXX do something better for production
-        for(int y = 0; y < 64; y++) {
-            int srcy = y + dy;
-            for(int x = 0; x < 128; x++) {
-                int srcx = x + dx;
-                if((srcx >= 0) && (srcx < 128) && (srcy >= 0) && (srcy < 64)) {
-                    display.at(y).at(x) = display2.at(srcy).at(srcx);
-                } else {
-                    display.at(y).at(x) = 0;
-                }
-            }
-        }
+        frames.backBuffer() = display;
+        frames.publish();
+        displayChanged = false;
     }
 
+    // Called on the render thread; scales the most recently published frame into the window.
     bool redraw()
     {
+        if(redrawCounters != nullptr) {
+            redrawCounters->start();
+        }
+        const DisplayImage& frame = frames.frontBuffer();
         for(int row = 0; row < windowHeight; row++) {
             for(int col = 0; col < windowWidth; col++) {
                 int displayX, displayY;
@@ -1555,13 +723,16 @@ struct Interface
                         break;
                     }
                 }
-                uint8_t pixel = display.at(displayY).at(displayX);
+                uint8_t pixel = frame.at(displayY).at(displayX);
                 auto &c = colorTable.at(pixel);
                 windowBuffer[col + row * windowWidth] = MFB_RGB(c[0], c[1], c[2]);
             }
         }
         int status = mfb_update_ex(window, windowBuffer, windowWidth, windowHeight);
         closed = (status < 0);
+        if(redrawCounters != nullptr) {
+            redrawCounters->stop();
+        }
         return status >= 0;
     }
 
@@ -1590,6 +761,8 @@ struct Interface
                     closed = true;
                 }
                 break;
+            case KB_KEY_TAB: fastForwardHeld = isPressed; break;
+            case KB_KEY_F12: if(isPressed) { traceDumpRequested = true; } break;
             case KB_KEY_1: keyPressed[0x1] = isPressed; break;
             case KB_KEY_2: keyPressed[0x2] = isPressed; break;
             case KB_KEY_3: keyPressed[0x3] = isPressed; break;
@@ -1609,7 +782,9 @@ struct Interface
             case KB_KEY_V: keyPressed[0xF] = isPressed; break;
             default: /* pass */ break;
         }
-        aKeyWasPressed |= isPressed;
+        if(isPressed) {
+            aKeyWasPressed = true;
+        }
     }
 
     static void keyboardcb(mfb_window *window, mfb_key key, mfb_key_mod mod, bool isPressed)
@@ -1618,117 +793,1223 @@ struct Interface
         ifc->keyboard(key, mod, isPressed);
     }
 
+    // Called on the render thread; presents a new frame if the emulator published one, otherwise just handles events.
     bool iterate()
     {
         bool success = true;
-        if(displayChanged) {
+        if(frames.acquire()) {
             success = redraw();
-            displayChanged = false;
         } else {
             success = (mfb_update_events(window) >= 0);
         }
         return success && !closed;
     }
+};
 
-    void startAudio(const Clock& clk)
+// Records every emulated field for --record-video in the format in
+// video.h.  The emulation thread only copies the display into a bounded
+// queue; packing, comparison with the previous frame, and writing happen
+// on the recorder's own thread.  If the writer falls far enough behind
+// to fill the queue, frames are dropped rather than stalling emulation,
+// recorded as repeats of the previous frame so the timing stays right,
+// and counted in a warning at the end.
+struct VideoRecorder
+{
+    struct QueuedFrame
     {
-        audioSampleStartClock = clk;
-        audioActive = true;
+        DisplayImage image;
+        uint32_t droppedBefore;
+    };
+
+    static constexpr size_t queueFrames = 64;
+
+    FILE *fp = nullptr;
+    SPSCRingBuffer<QueuedFrame> queue{queueFrames};
+    std::thread writer;
+    std::atomic<bool> stopping{false};
+
+    // Emulation thread
+    uint32_t droppedSinceQueued = 0;
+    uint64_t dropped = 0;
+
+    // Writer thread
+    VideoPackedFrame previous = {0};
+    bool havePrevious = false;
+    uint32_t pendingRepeats = 0;
+    std::vector<uint8_t> payload;
+    uint64_t frames = 0;
+    uint64_t keyFrames = 0;
+    uint64_t deltaFrames = 0;
+    bool writeFailed = false;
+
+    bool open(const char *filename, const std::array<vec3ub, 256>& colorTable)
+    {
+        fp = fopen(filename, "wb");
+        if(fp == nullptr) {
+            return false;
+        }
+        VideoFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, VideoFileMagic, sizeof(header.magic));
+        header.version = VideoFileVersion;
+        header.width = VideoWidth;
+        header.height = VideoHeight;
+        header.framesPerSecond = FieldsPerSecond;
+        for(int i = 0; i < 4; i++) {
+            memcpy(header.palette[i], colorTable[i].data(), 3);
+        }
+        if(fwrite(&header, sizeof(header), 1, fp) != 1) {
+            fclose(fp);
+            fp = nullptr;
+            return false;
+        }
+        writer = std::thread([this]() { run(); });
+        return true;
     }
 
-    void stopAudio()
+    // Called on the emulation thread once per field.
+    void addFrame(const DisplayImage& display)
     {
-        audioActive = false;
+        QueuedFrame frame{display, droppedSinceQueued};
+        if(queue.push(&frame, 1) == 1) {
+            droppedSinceQueued = 0;
+        } else {
+            droppedSinceQueued++;
+            dropped++;
+        }
     }
 
-    bool pressed(uint8_t key)
+    // Flushes the queue, finishes the file, and reports.  Returns false if writing failed.
+    bool close()
     {
-        return keyPressed[key];
+        if(fp == nullptr) {
+            return true;
+        }
+        stopping = true;
+        writer.join();
+        pendingRepeats += droppedSinceQueued;
+        flushRepeats();
+        writeFailed = writeFailed || (fclose(fp) != 0);
+        fp = nullptr;
+        fprintf(stderr, "video: %llu frames, %llu key frames, %llu deltas, %llu repeats\n",
+            (unsigned long long)frames, (unsigned long long)keyFrames, (unsigned long long)deltaFrames,
+            (unsigned long long)(frames - keyFrames - deltaFrames));
+        if(dropped > 0) {
+            fprintf(stderr, "video: the encoder fell behind and %llu frames were recorded as repeats\n", (unsigned long long)dropped);
+        }
+        return !writeFailed;
+    }
+
+    void run()
+    {
+        QueuedFrame frame;
+        for(;;) {
+            if(queue.pop(&frame, 1) == 1) {
+                encode(frame);
+            } else if(stopping) {
+                if(queue.pop(&frame, 1) == 0) {
+                    return;
+                }
+                encode(frame);
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+    }
+
+    void write(const void *data, size_t size)
+    {
+        writeFailed = writeFailed || (fwrite(data, 1, size, fp) != size);
+    }
+
+    void flushRepeats()
+    {
+        if(pendingRepeats > 0) {
+            uint8_t type = VIDEO_REPEAT;
+            write(&type, 1);
+            write(&pendingRepeats, sizeof(pendingRepeats));
+            frames += pendingRepeats;
+            pendingRepeats = 0;
+        }
     }
 
-    bool anyKeyPressed()
+    void encode(const QueuedFrame& frame)
     {
-        bool wasPressed = aKeyWasPressed;
-        aKeyWasPressed = false;
-        return wasPressed;
+        pendingRepeats += frame.droppedBefore;
+        VideoPackedFrame packed;
+        packVideoFrame(&frame.image[0][0], packed);
+        if(havePrevious && (packed == previous)) {
+            pendingRepeats++;
+            return;
+        }
+        flushRepeats();
+        if(havePrevious && encodeVideoDelta(previous, packed, payload)) {
+            uint8_t type = VIDEO_DELTA;
+            write(&type, 1);
+            write(payload.data(), payload.size());
+            deltaFrames++;
+        } else {
+            uint8_t type = VIDEO_KEYFRAME;
+            write(&type, 1);
+            write(packed.data(), packed.size());
+            keyFrames++;
+        }
+        frames++;
+        previous = packed;
+        havePrevious = true;
+    }
+};
+
+// Paces emulation to real time on the monotonic clock.  Each call to
+// waitForNextField() sleeps until the next field deadline; deadlines
+// advance by exactly one field so rounding in sleep doesn't accumulate.
+// If emulation falls more than a few fields behind (e.g. the process was
+// stopped), the deadline is resynchronized to now instead of bursting to
+// catch up.
+struct FramePacer
+{
+    static constexpr int maximumLagFields = 4;
+    static constexpr std::array<int, 8> jitterBucketLimits = {50, 100, 250, 500, 1000, 2000, 5000, std::numeric_limits<int>::max()}; // microseconds
+
+    std::chrono::nanoseconds period;
+    std::chrono::steady_clock::time_point deadline;
+
+    uint64_t fields = 0;
+    uint64_t resyncs = 0;
+    std::array<uint64_t, jitterBucketLimits.size()> jitterHistogram = {0};
+    int64_t maximumJitter = 0;
+
+    FramePacer(int fieldsPerSecond) :
+        period(std::chrono::nanoseconds(1000000000 / fieldsPerSecond)),
+        deadline(std::chrono::steady_clock::now())
+    {}
+
+    // speedMultiple > 1 runs that many fields per real field, for fast-forward.
+    void waitForNextField(int speedMultiple = 1)
+    {
+        deadline += period / speedMultiple;
+        auto now = std::chrono::steady_clock::now();
+        if(now > deadline + maximumLagFields * period) {
+            deadline = now;
+            resyncs++;
+            return;
+        }
+        std::this_thread::sleep_until(deadline);
+
+        int64_t jitter = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - deadline).count();
+        size_t bucket = 0;
+        while(jitter >= jitterBucketLimits[bucket]) {
+            bucket++;
+        }
+        jitterHistogram[bucket]++;
+        maximumJitter = std::max(maximumJitter, jitter);
+        fields++;
+    }
+
+    void printStatistics()
+    {
+        fprintf(stderr, "timing: %llu fields paced, %llu resyncs, maximum wakeup jitter %lld us\n",
+            (unsigned long long)fields, (unsigned long long)resyncs, (long long)maximumJitter);
+        int lower = 0;
+        for(size_t i = 0; i < jitterBucketLimits.size(); i++) {
+            if(jitterBucketLimits[i] == std::numeric_limits<int>::max()) {
+                fprintf(stderr, "timing: %5d us and up   : %llu\n", lower, (unsigned long long)jitterHistogram[i]);
+            } else {
+                fprintf(stderr, "timing: %5d - %5d us : %llu\n", lower, jitterBucketLimits[i], (unsigned long long)jitterHistogram[i]);
+            }
+            lower = jitterBucketLimits[i];
+        }
+    }
+};
+
+// Measures emulated fields against wall-clock time and reports the
+// achieved speed as a multiple of real time about once a second.
+struct SpeedMeter
+{
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point intervalStart;
+    uint64_t fields = 0;
+    uint64_t intervalFields = 0;
+    bool intervalWasFast = false;
+
+    SpeedMeter() :
+        start(std::chrono::steady_clock::now()),
+        intervalStart(start)
+    {}
+
+    static double speed(uint64_t fields, std::chrono::steady_clock::duration elapsed)
+    {
+        double seconds = std::chrono::duration<double>(elapsed).count();
+        return (seconds > 0) ? (fields / (double)FieldsPerSecond / seconds) : 0;
+    }
+
+    void field(bool fast)
+    {
+        fields++;
+        intervalFields++;
+        intervalWasFast |= fast;
+        auto now = std::chrono::steady_clock::now();
+        if(now - intervalStart >= std::chrono::seconds(1)) {
+            if(intervalWasFast) {
+                fprintf(stderr, "speed: %.1fx real time\n", speed(intervalFields, now - intervalStart));
+            }
+            intervalStart = now;
+            intervalFields = 0;
+            intervalWasFast = false;
+        }
+    }
+
+    void printStatistics()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        fprintf(stderr, "speed: %llu fields in %.2f seconds, %.1fx real time\n",
+            (unsigned long long)fields, std::chrono::duration<double>(elapsed).count(), speed(fields, elapsed));
+    }
+};
+
+// The crash handler needs to find the trace without any help from the
+// (possibly corrupt) emulator state, so it is registered here.
+static const TraceBuffer *crashTrace = nullptr;
+static const char *crashTraceFilename = nullptr;
+
+void dumpTrace(const TraceBuffer& trace, const char *filename)
+{
+    if(trace.dump(filename)) {
+        fprintf(stderr, "wrote instruction trace to \"%s\"\n", filename);
+    } else {
+        fprintf(stderr, "couldn't write instruction trace to \"%s\"\n", filename);
+    }
+}
+
+void crashTraceDump(int signum)
+{
+    crashTrace->dump(crashTraceFilename);
+    signal(signum, SIG_DFL);
+    raise(signum);
+}
+
+void requestTraceDump(int signum)
+{
+    traceDumpRequested = true;
+}
+
+void installCrashTraceDump(const TraceBuffer *trace, const char *filename)
+{
+    crashTrace = trace;
+    crashTraceFilename = filename;
+    for(int signum : {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT}) {
+        signal(signum, crashTraceDump);
+    }
+    signal(SIGUSR1, requestTraceDump);
+}
+
+// One independent emulator in a multi-instance host.
+struct HostInstance
+{
+    Clock systemClock;
+    Memory memory;
+    HeadlessInterface interface;
+    Chip8Interpreter<Memory,HeadlessInterface> chip8;
+    uint64_t fieldsLeft;
+    bool failed = false;
+
+    HostInstance(const Memory& image, ChipPlatform platform, uint32_t quirks, int cpuClockRate, const Clock& clock, int debug, uint64_t fields) :
+        systemClock(clock),
+        memory(image),
+        interface(platform, clock),
+        chip8(0x200, platform, quirks, cpuClockRate, clock),
+        fieldsLeft(fields)
+    {
+        chip8.debug = debug;
+    }
+
+    void emulateField()
+    {
+        clk_t fieldEnd = systemClock.clocks + SystemClocksPerField;
+        while(emulateUntil(chip8, memory, interface, systemClock, fieldEnd) == Chip8Interpreter<Memory,HeadlessInterface>::UNSUPPORTED_INSTRUCTION) {
+            if(chip8.debug & DEBUG_FAIL_UNSUPPORTED_INSN) {
+                failed = true;
+                return;
+            }
+        }
+        fieldsLeft--;
+    }
+};
+
+// Each task advances one instance by one field and then resubmits itself,
+// so instances interleave across workers and idle workers steal them.
+void scheduleField(WorkStealingPool& pool, HostInstance& instance)
+{
+    pool.submit([&pool, &instance]() {
+        instance.emulateField();
+        if(!instance.failed && (instance.fieldsLeft > 0)) {
+            scheduleField(pool, instance);
+        }
+    });
+}
+
+// A set of HostInstances run in lockstep.  Registers, I, PC, and timers
+// live here as structure-of-arrays, one array per register across all
+// lanes.  Each CPU cycle the lanes are grouped by PC; when a group's
+// instruction only touches that state (loads, ALU, skips, jumps, I and
+// delay timer operations) the lockstep.h kernels execute it for every lane
+// in the group at once.  Other instructions, lanes waiting for a key, and
+// lanes whose code at the PC differs from the group's run on the lane's
+// own interpreter, with its state copied in and back out around step().
+struct LockstepBatch
+{
+    typedef Chip8Interpreter<Memory,HeadlessInterface> Interpreter;
+
+    std::vector<HostInstance *> lanes;
+    size_t stride;                  // lane count rounded up to LockstepLaneMultiple
+    ChipPlatform platform;
+    uint32_t quirks;
+    clk_t rate;
+    clk_fixed_t cpuClockStep;
+    clk_fixed_t timerStep;
+    clk_fixed_t nextCycleTime;
+    clk_t clock;                    // of the next CPU cycle, nextCycleTime rounded up
+    clk_t idleUntil = 0;            // every lane is waiting for the display until this clock
+    clk_t fieldStart;
+    uint64_t fieldsLeft;
+
+    std::vector<uint8_t> V;         // register r of lane l at V[r * stride + l]
+    std::vector<uint16_t> I;
+    std::vector<uint16_t> PC;
+    std::vector<uint8_t> DT;
+    std::vector<uint8_t> ST;
+    std::vector<clk_fixed_t> DTNext;
+    std::vector<clk_fixed_t> STNext;
+    std::vector<uint32_t> issued;   // instructions run by kernels since the lane was last written back
+    std::vector<clk_t> resumeClock; // the lane's displayWaitClock; it sits out cycles before this
+
+    std::vector<uint8_t> live;      // 0xFF unless the lane stopped on an unsupported instruction
+    std::vector<uint8_t> groupable; // 0xFF if live and not waiting for a key
+    std::vector<uint8_t> pending;   // not yet stepped this cycle
+    std::vector<uint8_t> mask;      // lanes in the current group
+
+    uint64_t lockstepInstructions = 0;
+    uint64_t scalarInstructions = 0;
+
+    LockstepBatch(std::vector<HostInstance *> instances, ChipPlatform platform, uint32_t quirks, uint64_t fields) :
+        lanes(std::move(instances)),
+        stride((lanes.size() + LockstepLaneMultiple - 1) / LockstepLaneMultiple * LockstepLaneMultiple),
+        platform(platform),
+        quirks(quirks),
+        rate(lanes.front()->systemClock.rate),
+        cpuClockStep(lanes.front()->chip8.cpuClockStep),
+        timerStep(lanes.front()->chip8.timerStep),
+        nextCycleTime(lanes.front()->chip8.nextCycleTime),
+        clock(lanes.front()->chip8.calculateNextActivity()),
+        fieldStart(lanes.front()->systemClock.clocks),
+        fieldsLeft(fields),
+        V(16 * stride),
+        I(stride),
+        PC(stride),
+        DT(stride),
+        ST(stride),
+        DTNext(stride),
+        STNext(stride),
+        issued(stride),
+        resumeClock(stride),
+        live(stride),
+        groupable(stride),
+        pending(stride),
+        mask(stride)
+    {
+        for(size_t lane = 0; lane < lanes.size(); lane++) {
+            live[lane] = 0xFF;
+            gather(lane);
+        }
+    }
+
+    // Copy a lane's interpreter state into the arrays.
+    void gather(size_t lane)
+    {
+        Interpreter& chip8 = lanes[lane]->chip8;
+        for(int r = 0; r < 16; r++) {
+            V[r * stride + lane] = chip8.registers[r];
+        }
+        I[lane] = chip8.I;
+        PC[lane] = chip8.pc;
+        DT[lane] = chip8.DT;
+        ST[lane] = chip8.ST;
+        DTNext[lane] = chip8.DTNextDecrementTime;
+        STNext[lane] = chip8.STNextDecrementTime;
+        resumeClock[lane] = chip8.displayWaitClock;
+        groupable[lane] = (live[lane] && !chip8.waitingForKeyPress && !chip8.waitingForKeyRelease) ? 0xFF : 0;
+    }
+
+    // Copy a lane's state from the arrays back into its interpreter.
+    void scatter(size_t lane)
+    {
+        Interpreter& chip8 = lanes[lane]->chip8;
+        for(int r = 0; r < 16; r++) {
+            chip8.registers[r] = V[r * stride + lane];
+        }
+        chip8.I = I[lane];
+        chip8.pc = PC[lane];
+        chip8.DT = DT[lane];
+        chip8.ST = ST[lane];
+        chip8.DTNextDecrementTime = DTNext[lane];
+        chip8.STNextDecrementTime = STNext[lane];
+        chip8.insnNumber += issued[lane];
+        issued[lane] = 0;
+    }
+
+    void stepScalar(size_t lane)
+    {
+        HostInstance& instance = *lanes[lane];
+        scatter(lane);
+        uint64_t before = instance.chip8.insnNumber;
+        // Like updatePastClock(), which leaves the cycle unfinished after
+        // anything but CONTINUE, the next instruction issues on the same cycle.
+        Interpreter::StepResult result;
+        do {
+            result = instance.chip8.step(instance.memory, instance.interface, Clock(rate, clock));
+            if((result == Interpreter::UNSUPPORTED_INSTRUCTION) && (instance.chip8.debug & DEBUG_FAIL_UNSUPPORTED_INSN)) {
+                instance.failed = true;
+                live[lane] = 0;
+            }
+        } while((result != Interpreter::CONTINUE) && !instance.failed);
+        scalarInstructions += instance.chip8.insnNumber - before;
+        gather(lane);
+    }
+
+    // Instructions the kernels implement; the rest go through step().
+    bool isLockstepInstruction(uint16_t word)
+    {
+        switch(word >> 12) {
+            case 0x1: case 0x3: case 0x4: case 0x6: case 0x7: case 0xA: case 0xB:
+                return true;
+            case 0x5: case 0x9:
+                return (word & 0xF) == 0;
+            case 0x8:
+                return ((word & 0xF) <= 0x7) || ((word & 0xF) == 0xE);
+            case 0xF:
+                switch(word & 0xFF) {
+                    case 0x07: case 0x15: case 0x1E: return true;
+                    case 0x00: return (word == 0xF000) && (platform == XOCHIP);
+                    default: return false;
+                }
+            default:
+                return false;
+        }
     }
 
-    bool draw(uint8_t x, uint8_t y, uint8_t planeMask)
+    int instructionSize(uint16_t word)
     {
-        bool erased = false;
+        return ((platform == XOCHIP) && (word == 0xF000)) ? 4 : 2;
+    }
 
-        displayChanged = true; /* pixel will either be set or cleared... */
+    // Execute word at pc for the lanes in mask.  The group shares the four
+    // code bytes at pc, so the skipped instruction's size and the F000
+    // operand can be read from any member.
+    void executeGroup(const uint8_t *code)
+    {
+        uint16_t word = code[0] * 256 + code[1];
+        uint16_t next = code[2] * 256 + code[3];
+        uint8_t x = (word >> 8) & 0xF;
+        uint8_t y = (word >> 4) & 0xF;
+        uint8_t kk = word & 0xFF;
+        uint16_t nnn = word & 0xFFF;
+        uint8_t *vx = &V[x * stride];
+        uint8_t *vy = &V[y * stride];
+        uint8_t *vf = &V[0xF * stride];
+        const uint8_t *m = mask.data();
+        bool vfOrder = quirks & QUIRKS_VFORDER;
+        bool logicQuirk = quirks & QUIRKS_LOGIC;
+        int skipSize = instructionSize(next);
+
+        switch(word >> 12) {
+            case 0x1:
+                lockstepSet16(PC.data(), nnn, m, stride);
+                return;
+            case 0x3:
+                lockstepSkip(PC.data(), vx, nullptr, kk, true, skipSize, m, stride);
+                return;
+            case 0x4:
+                lockstepSkip(PC.data(), vx, nullptr, kk, false, skipSize, m, stride);
+                return;
+            case 0x5:
+                lockstepSkip(PC.data(), vx, vy, 0, true, skipSize, m, stride);
+                return;
+            case 0x9:
+                lockstepSkip(PC.data(), vx, vy, 0, false, skipSize, m, stride);
+                return;
+            case 0xB:
+                if(quirks & QUIRKS_JUMP) {
+                    lockstepSet16PlusByte(PC.data(), (nnn & 0xFF) + (x << 8), vx, m, stride);
+                } else {
+                    lockstepSet16PlusByte(PC.data(), nnn, &V[0], m, stride);
+                }
+                return;
+            case 0x6:
+                lockstepALU(LOCKSTEP_MOV_IMM, vx, nullptr, kk, vf, vfOrder, logicQuirk, m, stride);
+                break;
+            case 0x7:
+                lockstepALU(LOCKSTEP_ADD_IMM, vx, nullptr, kk, vf, vfOrder, logicQuirk, m, stride);
+                break;
+            case 0x8: {
+                const uint8_t *shiftSource = (quirks & QUIRKS_SHIFT) ? vx : vy;
+                switch(word & 0xF) {
+                    case 0x0: lockstepALU(LOCKSTEP_MOV, vx, vy, 0, vf, vfOrder, logicQuirk, m, stride); break;
+                    case 0x1: lockstepALU(LOCKSTEP_OR, vx, vy, 0, vf, vfOrder, logicQuirk, m, stride); break;
+                    case 0x2: lockstepALU(LOCKSTEP_AND, vx, vy, 0, vf, vfOrder, logicQuirk, m, stride); break;
+                    case 0x3: lockstepALU(LOCKSTEP_XOR, vx, vy, 0, vf, vfOrder, logicQuirk, m, stride); break;
+                    case 0x4: lockstepALU(LOCKSTEP_ADD, vx, vy, 0, vf, vfOrder, logicQuirk, m, stride); break;
+                    case 0x5: lockstepALU(LOCKSTEP_SUB, vx, vy, 0, vf, vfOrder, logicQuirk, m, stride); break;
+                    case 0x6: lockstepALU(LOCKSTEP_SHR, vx, shiftSource, 0, vf, vfOrder, logicQuirk, m, stride); break;
+                    case 0x7: lockstepALU(LOCKSTEP_SUBN, vx, vy, 0, vf, vfOrder, logicQuirk, m, stride); break;
+                    case 0xE: lockstepALU(LOCKSTEP_SHL, vx, shiftSource, 0, vf, vfOrder, logicQuirk, m, stride); break;
+                }
+                break;
+            }
+            case 0xA:
+                lockstepSet16(I.data(), nnn, m, stride);
+                break;
+            case 0xF:
+                switch(word & 0xFF) {
+                    case 0x07:
+                        lockstepCopy8(vx, DT.data(), m, stride);
+                        break;
+                    case 0x15:
+                        lockstepCopy8(DT.data(), vx, m, stride);
+                        for(size_t lane = 0; lane < stride; lane++) {
+                            DTNext[lane] = m[lane] ? fixedClock(clock) + timerStep : DTNext[lane];
+                        }
+                        break;
+                    case 0x1E:
+                        lockstepAdd16Byte(I.data(), vx, m, stride);
+                        break;
+                    case 0x00:
+                        lockstepSet16(I.data(), next, m, stride);
+                        break;
+                }
+                break;
+        }
+        lockstepAdd16(PC.data(), instructionSize(word), m, stride);
+    }
 
-        if((x < 128) && (y < 64)) {
-            uint8_t& pixel = display.at(y).at(x);
-            uint8_t oldValue = pixel;
-            for(int i = 0; i < 2; i++) {
-                uint8_t bit = (0x1 << i);
-                if(planeMask & bit) {
-                    pixel = pixel ^ bit;
+    void cycle()
+    {
+        size_t laneCount = lanes.size();
+        pending = live;
+        for(size_t lane = 0; lane < laneCount; lane++) {
+            if(resumeClock[lane] > clock) {
+                pending[lane] = 0;
+            }
+        }
+        for(size_t first = 0; first < laneCount; first++) {
+            if(!pending[first]) {
+                continue;
+            }
+            uint16_t pc = PC[first];
+            const uint8_t *code = &lanes[first]->memory.memory[pc];
+            if(!groupable[first] || (pc > 0xFFFC) || !isLockstepInstruction(code[0] * 256 + code[1])) {
+                stepScalar(first);
+                pending[first] = 0;
+                continue;
+            }
+            lockstepMatchPC(mask.data(), pending.data(), PC.data(), pc, stride);
+            size_t count = 0;
+            for(size_t lane = first; lane < laneCount; lane++) {
+                if(mask[lane]) {
+                    if(!groupable[lane] || (memcmp(&lanes[lane]->memory.memory[pc], code, 4) != 0)) {
+                        mask[lane] = 0;
+                    } else {
+                        pending[lane] = 0;
+                        issued[lane]++;
+                        count++;
+                    }
                 }
-                if(((oldValue & bit) != 0) && ((pixel & bit) == 0)) {
-                    erased = true;
+            }
+            executeGroup(code);
+            lockstepInstructions += count;
+        }
+
+        // Lanes stepped by their interpreter have already moved their
+        // decrement clocks past this cycle.  Like the interpreter, a lane
+        // waiting for the display leaves its timers alone until it resumes
+        // and then catches up, which can take more than one decrement.
+        clk_fixed_t now = fixedClock(clock);
+        idleUntil = std::numeric_limits<clk_t>::max();
+        for(size_t lane = 0; lane < laneCount; lane++) {
+            if(!live[lane]) {
+                continue;
+            }
+            if(resumeClock[lane] > clock) {
+                idleUntil = std::min(idleUntil, resumeClock[lane]);
+                continue;
+            }
+            idleUntil = 0;
+            while((DT[lane] > 0) && (DTNext[lane] <= now)) {
+                DT[lane]--;
+                DTNext[lane] += timerStep;
+            }
+            while((ST[lane] > 0) && (STNext[lane] <= now)) {
+                ST[lane]--;
+                STNext[lane] += timerStep;
+                if(ST[lane] == 0) {
+                    lanes[lane]->interface.stopAudio(Clock(rate, clock));
                 }
             }
         }
+        if(idleUntil == std::numeric_limits<clk_t>::max()) {
+            idleUntil = 0;
+        }
+    }
 
-        return erased;
+    // Move to the next cycle, skipping cycles in which every lane would
+    // just be waiting for the display.
+    void advanceCycle()
+    {
+        nextCycleTime = stepToClock(nextCycleTime + cpuClockStep, cpuClockStep, idleUntil);
+        clock = clockAtOrAfter(nextCycleTime);
+    }
+
+    // Run every lane for one field.
+    void emulateField()
+    {
+        clk_t fieldEnd = fieldStart + SystemClocksPerField;
+        for(; clock < fieldEnd; advanceCycle()) {
+            cycle();
+        }
+        endField();
     }
 
-    void clear()
+    // Write every lane's state back so the instances are current between fields.
+    void endField()
     {
-        for(auto& rowOfPixels : display) {
-            for(auto& pixel : rowOfPixels) {
-                pixel = 0;
+        clk_t fieldEnd = fieldStart + SystemClocksPerField;
+        for(size_t lane = 0; lane < lanes.size(); lane++) {
+            HostInstance& instance = *lanes[lane];
+            scatter(lane);
+            if(!instance.failed) {
+                instance.systemClock.clocks = fieldEnd;
+                instance.chip8.nextCycleTime = stepToClock(nextCycleTime, cpuClockStep, instance.chip8.displayWaitClock);
+                instance.interface.updatePastClock(Clock(rate, fieldEnd - 1));
+                instance.fieldsLeft--;
             }
         }
+        fieldStart = fieldEnd;
+        fieldsLeft--;
     }
+};
 
-    // Return the next system clock tick at which the interface will have transitioned one interface clock,
-    // that is to say return the least clock for which the interface has to do some work.
-    clk_t calculateNextActivity()
+void scheduleField(WorkStealingPool& pool, LockstepBatch& batch)
+{
+    pool.submit([&pool, &batch]() {
+        batch.emulateField();
+        if(batch.fieldsLeft > 0) {
+            scheduleField(pool, batch);
+        }
+    });
+}
+
+// Run instanceCount headless copies of the loaded ROM for fields fields each.
+// If lockstepLanes is nonzero, instances run in LockstepBatches of up to
+// that many lanes, and the pool schedules batches instead of instances.
+void runHost(const Memory& image, ChipPlatform platform, uint32_t quirks, int cpuClockRate, const Clock& systemClock, int debug, int instanceCount, uint64_t fields, int lockstepLanes)
+{
+    std::vector<std::unique_ptr<HostInstance>> instances;
+    for(int i = 0; i < instanceCount; i++) {
+        instances.push_back(std::make_unique<HostInstance>(image, platform, quirks, cpuClockRate, systemClock, debug, fields));
+    }
+
+    std::vector<std::unique_ptr<LockstepBatch>> batches;
+    if(lockstepLanes > 0) {
+        for(int first = 0; first < instanceCount; first += lockstepLanes) {
+            std::vector<HostInstance *> lanes;
+            for(int i = first; i < std::min(instanceCount, first + lockstepLanes); i++) {
+                lanes.push_back(instances[i].get());
+            }
+            batches.push_back(std::make_unique<LockstepBatch>(std::move(lanes), platform, quirks, fields));
+        }
+    }
+
+    size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    auto started = std::chrono::steady_clock::now();
+    uint64_t steals;
     {
-        clk_t next = (mostRecentSystemClock.clocks + audioOutputSampleLengthInSystemClocks - 1) / audioOutputSampleLengthInSystemClocks * audioOutputSampleLengthInSystemClocks;
-        // XXX debug printf("interface next is %llu\n", next);
-        return next;
+        WorkStealingPool pool(threadCount);
+        if(lockstepLanes > 0) {
+            for(auto& batch : batches) {
+                scheduleField(pool, *batch);
+            }
+        } else {
+            for(auto& instance : instances) {
+                scheduleField(pool, *instance);
+            }
+        }
+        pool.waitIdle();
+        steals = pool.steals;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    uint64_t totalFields = 0;
+    uint64_t totalInstructions = 0;
+    int failures = 0;
+    for(auto& instance : instances) {
+        totalFields += fields - instance->fieldsLeft;
+        totalInstructions += instance->chip8.insnNumber;
+        failures += instance->failed ? 1 : 0;
     }
+    fprintf(stderr, "host: %d instances on %zu threads, %llu fields, %llu instructions in %.3f s\n",
+        instanceCount, threadCount, (unsigned long long)totalFields, (unsigned long long)totalInstructions, seconds);
+    fprintf(stderr, "host: %.0f fields/s (%.1fx real time per instance), %.0f instructions/s, %llu steals, %d instances stopped on unsupported instructions\n",
+        totalFields / seconds, totalFields / seconds / FieldsPerSecond / instanceCount, totalInstructions / seconds, (unsigned long long)steals, failures);
+    if(lockstepLanes > 0) {
+        uint64_t lockstepInstructions = 0;
+        uint64_t scalarInstructions = 0;
+        for(auto& batch : batches) {
+            lockstepInstructions += batch->lockstepInstructions;
+            scalarInstructions += batch->scalarInstructions;
+        }
+        fprintf(stderr, "host: %zu lockstep batches (%s kernels), %.1f%% of instructions in lockstep\n", batches.size(),
+#if defined(__AVX2__)
+            "AVX2",
+#else
+            "scalar",
+#endif
+            100.0 * lockstepInstructions / std::max<uint64_t>(1, lockstepInstructions + scalarInstructions));
+    }
+}
 
-    // Do work associated with CPU clock transitioning to active, strictly after mostRecentSystemClock, up to and including systemClock.
-    // Do not repeat work if called twice with same clock.
-    void updatePastClock(const Clock& systemClock)
+// Run one headless instance for fields fields as fast as possible,
+// hashing its state after every field.  Writes the hashes to hashFilename
+// and compares them with goldenFilename when those are given.  Returns
+// false if the run differs from the golden hashes.
+bool runHashed(const Memory& image, ChipPlatform platform, uint32_t quirks, int ticksPerField, const Clock& systemClock, int debug, uint64_t romHash, uint64_t fields, const char *hashFilename, const char *goldenFilename, bool hashState)
+{
+    StateHashFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, StateHashFileMagic, sizeof(header.magic));
+    header.version = StateHashFileVersion;
+    header.romHash = romHash;
+    header.platform = platform;
+    header.quirks = quirks;
+    header.ticksPerField = ticksPerField;
+    header.flags = hashState ? STATEHASH_STATE : 0;
+    header.seed = StateHashDefaultSeed;
+
+    FILE *golden = nullptr;
+    if(goldenFilename != nullptr) {
+        golden = fopen(goldenFilename, "rb");
+        if(golden == nullptr) {
+            fprintf(stderr, "couldn't open golden hashes \"%s\"\n", goldenFilename);
+            exit(EXIT_FAILURE);
+        }
+        StateHashFileHeader goldenHeader;
+        if((fread(&goldenHeader, sizeof(goldenHeader), 1, golden) != 1) ||
+            (memcmp(goldenHeader.magic, StateHashFileMagic, sizeof(goldenHeader.magic)) != 0) ||
+            (goldenHeader.version != StateHashFileVersion))
+        {
+            fprintf(stderr, "\"%s\" is not a version %u xochip hash file\n", goldenFilename, StateHashFileVersion);
+            exit(EXIT_FAILURE);
+        }
+        if((goldenHeader.romHash != header.romHash) || (goldenHeader.platform != header.platform) ||
+            (goldenHeader.quirks != header.quirks) || (goldenHeader.ticksPerField != header.ticksPerField))
+        {
+            fprintf(stderr, "golden hashes in \"%s\" were made from a different ROM, platform, quirks, or rate\n", goldenFilename);
+            exit(EXIT_FAILURE);
+        }
+        // Hash what the golden run hashed, with its seed
+        header.flags = goldenHeader.flags;
+        header.seed = goldenHeader.seed;
+    }
+
+    FILE *out = nullptr;
+    if(hashFilename != nullptr) {
+        out = fopen(hashFilename, "wb");
+        if((out == nullptr) || (fwrite(&header, sizeof(header), 1, out) != 1)) {
+            fprintf(stderr, "couldn't write hashes to \"%s\"\n", hashFilename);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    HostInstance instance(image, platform, quirks, ticksPerField * FieldsPerSecond, systemClock, debug, fields);
+    instance.chip8.e1.seed(header.seed);
+    StateHasher hasher;
+    StateHashRecord record = {0, 0};
+    bool matched = true;
+    bool goldenEnded = false;
+
+    auto started = std::chrono::steady_clock::now();
+    uint64_t field = 0;
+    for(; (field < fields) && !instance.failed; field++) {
+        instance.emulateField();
+        record.display = hasher.hashDisplay(instance.interface.display);
+        record.state = (header.flags & STATEHASH_STATE) ? hasher.hashState(instance.memory, instance.chip8) : 0;
+        if(out != nullptr) {
+            fwrite(&record, sizeof(record), 1, out);
+        }
+        if((golden != nullptr) && !goldenEnded) {
+            StateHashRecord expected;
+            if(fread(&expected, sizeof(expected), 1, golden) != 1) {
+                fprintf(stderr, "golden hashes end after field %llu\n", (unsigned long long)field);
+                goldenEnded = true;
+            } else if((expected.display != record.display) || (expected.state != record.state)) {
+                const char *which = (expected.state == record.state) ? "display" :
+                    ((expected.display == record.display) ? "memory/registers" : "display and memory/registers");
+                fprintf(stderr, "first difference from golden at field %llu (%.2f s) in %s, pc %03X after %llu instructions\n",
+                    (unsigned long long)field, field / (double)FieldsPerSecond, which,
+                    instance.chip8.pc, (unsigned long long)instance.chip8.insnNumber);
+                matched = false;
+                field++;
+                break;
+            }
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    if(instance.failed) {
+        fprintf(stderr, "stopped on an unsupported instruction in field %llu\n", (unsigned long long)(field - 1));
+    }
+    if(out != nullptr) {
+        if(ferror(out) || (fclose(out) != 0)) {
+            fprintf(stderr, "couldn't write hashes to \"%s\"\n", hashFilename);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if(golden != nullptr) {
+        fclose(golden);
+    }
+    fprintf(stderr, "hash: %llu fields, %llu instructions in %.3f s, final display %016llx state %016llx%s\n",
+        (unsigned long long)field, (unsigned long long)instance.chip8.insnNumber, seconds,
+        (unsigned long long)record.display, (unsigned long long)record.state,
+        (golden == nullptr) ? "" : (matched ? ", matches golden" : ""));
+    return matched;
+}
+
+// The state --diff compares after every CPU cycle.
+struct DiffState
+{
+    std::array<uint8_t, 16> registers;
+    uint16_t I;
+    uint16_t pc;
+    uint8_t DT;
+    uint8_t ST;
+    uint64_t instructions;
+    const std::vector<uint16_t> *stack;
+    Memory *memory;
+    const DisplayImage *display;
+};
+
+// An execution engine driven one CPU cycle at a time by --diff.
+struct DiffEngine
+{
+    HostInstance instance;
+
+    DiffEngine(const Memory& image, ChipPlatform platform, uint32_t quirks, int cpuClockRate, const Clock& systemClock, int debug) :
+        instance(image, platform, quirks, cpuClockRate, systemClock, debug, 0)
     {
-        // XXX debug printf("audio loop\n");
-        for(uint64_t clock = calculateNextActivity(); clock <= systemClock.clocks; clock += audioOutputSampleLengthInSystemClocks) {
-            // determine output sample index
-            int audioOutputSampleIndex = (clock / audioOutputSampleLengthInSystemClocks) % audioOutputBufferSize;
-            static int prev = 0;
-            if(audioOutputSampleIndex != (prev + 1) % audioOutputBufferSize) {
-                printf("uh oh %d %d\n", prev, audioOutputSampleIndex);
+        instance.chip8.e1.seed(StateHashDefaultSeed);
+    }
+
+    virtual ~DiffEngine() {}
+
+    virtual const char *name() const = 0;
+
+    // Execute the CPU cycle at clock.
+    virtual void runCycle(clk_t clock) = 0;
+
+    virtual void endField(clk_t fieldEnd) = 0;
+
+    virtual DiffState state() = 0;
+};
+
+// The reference: Chip8Interpreter::step() through emulateUntil().
+struct InterpreterDiffEngine : public DiffEngine
+{
+    using DiffEngine::DiffEngine;
+
+    const char *name() const override { return "interpreter"; }
+
+    void runCycle(clk_t clock) override
+    {
+        while(emulateUntil(instance.chip8, instance.memory, instance.interface, instance.systemClock, clock + 1) ==
+            Chip8Interpreter<Memory,HeadlessInterface>::UNSUPPORTED_INSTRUCTION) {
+        }
+    }
+
+    void endField(clk_t fieldEnd) override
+    {
+        runCycle(fieldEnd - 1);
+    }
+
+    DiffState state() override
+    {
+        auto& chip8 = instance.chip8;
+        return DiffState{chip8.registers, chip8.I, chip8.pc, chip8.DT, chip8.ST, chip8.insnNumber,
+            &chip8.stack, &instance.memory, &instance.interface.display};
+    }
+};
+
+// The --lockstep engine as a batch of one lane.
+struct LockstepDiffEngine : public DiffEngine
+{
+    LockstepBatch batch;
+
+    LockstepDiffEngine(const Memory& image, ChipPlatform platform, uint32_t quirks, int cpuClockRate, const Clock& systemClock, int debug) :
+        DiffEngine(image, platform, quirks, cpuClockRate, systemClock, debug),
+        batch({&instance}, platform, quirks, 0)
+    {
+    }
+
+    const char *name() const override { return "lockstep"; }
+
+    // A --diff-quirk vblank on either side makes the engines idle on
+    // different cycles, so run every batch cycle up to A's; the clocks only
+    // differ once the states already do.
+    void runCycle(clk_t clock) override
+    {
+        while(batch.clock <= clock) {
+            batch.cycle();
+            batch.advanceCycle();
+        }
+    }
+
+    void endField(clk_t) override
+    {
+        batch.endField();
+    }
+
+    DiffState state() override
+    {
+        DiffState state;
+        for(int r = 0; r < 16; r++) {
+            state.registers[r] = batch.V[r * batch.stride];
+        }
+        state.I = batch.I[0];
+        state.pc = batch.PC[0];
+        state.DT = batch.DT[0];
+        state.ST = batch.ST[0];
+        state.instructions = instance.chip8.insnNumber + batch.issued[0];
+        state.stack = &instance.chip8.stack;
+        state.memory = &instance.memory;
+        state.display = &instance.interface.display;
+        return state;
+    }
+};
+
+std::unique_ptr<DiffEngine> makeDiffEngine(const std::string& name, const Memory& image, ChipPlatform platform, uint32_t quirks, int cpuClockRate, const Clock& systemClock, int debug)
+{
+    if(name == "interpreter") {
+        return std::make_unique<InterpreterDiffEngine>(image, platform, quirks, cpuClockRate, systemClock, debug);
+    } else if(name == "lockstep") {
+        return std::make_unique<LockstepDiffEngine>(image, platform, quirks, cpuClockRate, systemClock, debug);
+    }
+    return nullptr;
+}
+
+// Print what differs between a and b, leaving out everything that matches.
+// Only memory pages marked dirty on either side are compared.  Returns
+// true if anything differs.
+bool reportDifferences(const DiffState& a, const DiffState& b, bool print)
+{
+    bool differ = false;
+    auto note = [&differ, print](const char *what, unsigned valueA, unsigned valueB, const char *format) {
+        differ = true;
+        if(print) {
+            printf("  %-10s A=", what);
+            printf(format, valueA);
+            printf(" B=");
+            printf(format, valueB);
+            printf("\n");
+        }
+    };
+    for(int r = 0; r < 16; r++) {
+        if(a.registers[r] != b.registers[r]) {
+            char name[4];
+            snprintf(name, sizeof(name), "V%X", r);
+            note(name, a.registers[r], b.registers[r], "%02X");
+        }
+    }
+    if(a.I != b.I) {
+        note("I", a.I, b.I, "%04X");
+    }
+    if(a.pc != b.pc) {
+        note("PC", a.pc, b.pc, "%04X");
+    }
+    if(a.DT != b.DT) {
+        note("DT", a.DT, b.DT, "%u");
+    }
+    if(a.ST != b.ST) {
+        note("ST", a.ST, b.ST, "%u");
+    }
+    if(*a.stack != *b.stack) {
+        note("stack depth", a.stack->size(), b.stack->size(), "%u");
+        for(size_t i = 0; i < std::min(a.stack->size(), b.stack->size()); i++) {
+            if((*a.stack)[i] != (*b.stack)[i]) {
+                char name[32];
+                snprintf(name, sizeof(name), "stack[%zu]", i);
+                note(name, (*a.stack)[i], (*b.stack)[i], "%04X");
             }
-            prev = audioOutputSampleIndex;
-            // XXX debug printf("system clock = %llu, audio clock = %llu, sampleIndex = %d\n", systemClock.clocks, clock, audioOutputSampleIndex);
-            uint8_t sample;
-            if(audioActive) {
-                int audioInputSampleIndex = ((clock - audioSampleStartClock.clocks) / audioInputSampleLengthInSystemClocks) %XOChipAudioSampleRate;
-                int byteIndex = audioInputSampleIndex / 8;
-                int bitIndex = audioInputSampleIndex % 8;
-                currentAudioSample = ((audioSample[byteIndex] << bitIndex) & 0x80) ? (128 - 16) : (128 + 16);
+        }
+    }
+
+    size_t bytes = 0;
+    size_t firstAddress = 0;
+    for(size_t word = 0; word < a.memory->dirtyPages.size(); word++) {
+        uint64_t dirty = a.memory->dirtyPages[word] | b.memory->dirtyPages[word];
+        for(size_t bit = 0; (dirty != 0) && (bit < 64); bit++) {
+            if(dirty & (1ULL << bit)) {
+                size_t start = (word * 64 + bit) * Memory::pageSize;
+                for(size_t address = start; address < start + Memory::pageSize; address++) {
+                    if(a.memory->memory[address] != b.memory->memory[address]) {
+                        firstAddress = (bytes == 0) ? address : firstAddress;
+                        bytes++;
+                    }
+                }
             }
-            audioOutputBuffer[audioOutputSampleIndex] = currentAudioSample;
-            if(false) { /* XXX debugging */
-                static uint64_t byte = 0;
-                audioOutputBuffer[audioOutputSampleIndex] = blob[byte];
-                byte = (byte + 1) % blobsize;
+        }
+    }
+    if(bytes > 0) {
+        differ = true;
+        if(print) {
+            printf("  memory     %zu bytes differ, first at %04zX: A=%02X B=%02X\n", bytes, firstAddress,
+                a.memory->memory[firstAddress], b.memory->memory[firstAddress]);
+        }
+    }
+
+    if(*a.display != *b.display) {
+        differ = true;
+        size_t pixels = 0;
+        int firstX = 0, firstY = 0;
+        for(int y = 0; y < 64; y++) {
+            for(int x = 0; x < 128; x++) {
+                if((*a.display)[y][x] != (*b.display)[y][x]) {
+                    if(pixels++ == 0) {
+                        firstX = x;
+                        firstY = y;
+                    }
+                }
             }
-            if(audioOutputSampleIndex == audioOutputBufferSize - 1) {
-                enqueueAudioSamples(aodev, audioOutputBuffer, audioOutputBufferSize);
+        }
+        if(print) {
+            printf("  display    %zu pixels differ, first at %d,%d: A=%u B=%u\n", pixels, firstX, firstY,
+                (*a.display)[firstY][firstX], (*b.display)[firstY][firstX]);
+        }
+    }
+    return differ;
+}
+
+// Run the reference interpreter (A) and a second engine (B) over the same
+// ROM and key schedule, comparing their state after every CPU cycle, and
+// report the first divergence with the instructions leading up to it.  B
+// may also run with different quirks.  keyPeriod, if nonzero, presses a
+// pseudo-random key on both sides every keyPeriod fields.  Returns false
+// on a divergence.
+bool runDiff(const Memory& image, ChipPlatform platform, uint32_t quirksA, uint32_t quirksB, const std::string& engineName, int cpuClockRate, const Clock& systemClock, int debug, uint64_t fields, int keyPeriod)
+{
+    constexpr size_t reportedInstructions = 8;
+
+    InterpreterDiffEngine a(image, platform, quirksA, cpuClockRate, systemClock, debug);
+    std::unique_ptr<DiffEngine> b = makeDiffEngine(engineName, image, platform, quirksB, cpuClockRate, systemClock, debug);
+    TraceBuffer trace(reportedInstructions, systemClock.rate);
+    a.instance.chip8.trace = &trace;
+
+    std::mt19937 keys(StateHashDefaultSeed);
+    int heldKey = -1;
+    clk_t clock = a.instance.chip8.calculateNextActivity();
+    auto started = std::chrono::steady_clock::now();
+
+    for(uint64_t field = 0; field < fields; field++) {
+        if((keyPeriod > 0) && (field % keyPeriod == 0)) {
+            if(heldKey >= 0) {
+                a.instance.interface.setKey(heldKey, false);
+                b->instance.interface.setKey(heldKey, false);
+            }
+            heldKey = keys() % 16;
+            a.instance.interface.setKey(heldKey, true);
+            b->instance.interface.setKey(heldKey, true);
+        }
+        clk_t fieldEnd = (field + 1) * SystemClocksPerField;
+        for(; clock < fieldEnd; clock = a.instance.chip8.calculateNextActivity()) {
+            a.runCycle(clock);
+            b->runCycle(clock);
+            DiffState stateA = a.state();
+            DiffState stateB = b->state();
+            if((stateA.instructions != stateB.instructions) || reportDifferences(stateA, stateB, false)) {
+                printf("first divergence at field %llu, clock %llu, after %llu instructions on A and %llu on B\n",
+                    (unsigned long long)field, (unsigned long long)clock,
+                    (unsigned long long)stateA.instructions, (unsigned long long)stateB.instructions);
+                printf("A is the interpreter with quirks %02X, B is %s with quirks %02X\n", quirksA, b->name(), quirksB);
+                printf("differences:\n");
+                // Compare again with every memory page so the report is complete
+                a.instance.memory.dirtyPages.fill(~0ULL);
+                reportDifferences(stateA, stateB, true);
+                printf("last instructions on A:\n");
+                size_t count = std::min<uint64_t>(trace.written, trace.records.size());
+                for(size_t i = trace.written - count; i < trace.written; i++) {
+                    const TraceRecord& r = trace.records[i & trace.mask];
+                    printf("  clk:%llu | ", (unsigned long long)r.clock);
+                    const auto& memory = a.instance.memory.memory;
+                    disassemble(r.pc, r.instructionWord, memory[(uint16_t)(r.pc + 2)] * 256 + memory[(uint16_t)(r.pc + 3)]);
+                }
+                printf("reproduce with --diff %llu\n", (unsigned long long)(field + 1));
+                return false;
+            }
+            // The pages written this cycle match, so start the next comparison clean
+            stateA.memory->dirtyPages.fill(0);
+            stateB.memory->dirtyPages.fill(0);
+        }
+        a.endField(fieldEnd);
+        b->endField(fieldEnd);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    fprintf(stderr, "diff: interpreter and %s agree for %llu fields, %llu instructions (%.3f s)\n",
+        b->name(), (unsigned long long)fields, (unsigned long long)a.instance.chip8.insnNumber, seconds);
+    return true;
+}
+
+// A file mapped read-only for as long as this object lives.
+struct MappedFile
+{
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+
+    MappedFile() {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        if(data != nullptr) {
+            munmap(const_cast<uint8_t *>(data), size);
+        }
+    }
+
+    // On failure errno describes the problem.
+    bool open(const char *filename)
+    {
+        int fd = ::open(filename, O_RDONLY);
+        if(fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if(fstat(fd, &info) != 0) {
+            ::close(fd);
+            return false;
+        }
+        if(!S_ISREG(info.st_mode)) {
+            ::close(fd);
+            errno = S_ISDIR(info.st_mode) ? EISDIR : EINVAL;
+            return false;
+        }
+        size = info.st_size;
+        if(size > 0) {
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(mapped == MAP_FAILED) {
+                ::close(fd);
+                return false;
             }
+            data = static_cast<const uint8_t *>(mapped);
         }
-        mostRecentSystemClock = systemClock + 1;
-        // XXX debug printf("systemClock is %llu, most recent is now %llu\n", systemClock.clocks, mostRecentSystemClock.clocks);
+        ::close(fd);
+        return true;
     }
-
 };
 
 void usage(const char *name)
@@ -1738,6 +2019,39 @@ void usage(const char *name)
     fprintf(stderr, "\t--rate N           - issue N instructions per 60Hz field\n");
     fprintf(stderr, "\t--color N RRGGBB   - set color N to RRGGBB\n");
     fprintf(stderr, "\t--platform name    - enable platform, \"schip\" or \"xochip\"\n");
+    fprintf(stderr, "\t--turbo            - run as fast as possible without audio, presenting at most %d frames per second\n", UIUpdateFrequency);
+    fprintf(stderr, "\t--fast-forward N   - run N times real time while TAB is held (default 4)\n");
+    fprintf(stderr, "\t--stats file.json  - write per-opcode execution counts and times at exit (requires XOCHIP_STATS build)\n");
+    fprintf(stderr, "\t--record-video file\n");
+    fprintf(stderr, "\t                   - record every emulated frame to file on a background thread;\n");
+    fprintf(stderr, "\t                     convert it to a standard video file with videoconvert\n");
+    fprintf(stderr, "\t--record-audio file.wav\n");
+    fprintf(stderr, "\t                   - write every generated audio sample to a WAV file, also in --turbo\n");
+    fprintf(stderr, "\t                     and without an audio device; disables audio rate control\n");
+    fprintf(stderr, "\t--profile N        - sample the PC N times per emulated second and print hotspots at exit\n");
+    fprintf(stderr, "\t--trace file       - keep a ring of recent instructions, written to file on crash,\n");
+    fprintf(stderr, "\t                     first unsupported instruction, F12, or SIGUSR1; print it with tracedump\n");
+    fprintf(stderr, "\t--host N FIELDS    - run N headless instances of the ROM for FIELDS fields each on a\n");
+    fprintf(stderr, "\t                     work-stealing thread pool and report aggregate throughput\n");
+    fprintf(stderr, "\t--lockstep N       - with --host, run instances in batches of N that execute register,\n");
+    fprintf(stderr, "\t                     jump, and skip instructions together with SIMD kernels\n");
+    fprintf(stderr, "\t--frames N         - run headless, without a window or audio, for N fields as fast as possible\n");
+    fprintf(stderr, "\t                     and print the final state hashes\n");
+    fprintf(stderr, "\t--hash file        - with --frames, write a hash of the display after every field to file\n");
+    fprintf(stderr, "\t--hash-state       - with --frames, also hash memory and registers after every field\n");
+    fprintf(stderr, "\t--golden file      - with --frames, compare every field's hashes against file written by\n");
+    fprintf(stderr, "\t                     --hash and report the first difference; exits with failure on one\n");
+    fprintf(stderr, "\t--diff N           - run the interpreter and a second engine over N fields in lockstep, compare\n");
+    fprintf(stderr, "\t                     their state after every CPU cycle, and report the first divergence\n");
+    fprintf(stderr, "\t--diff-engine name - the second engine for --diff, \"lockstep\" (default) or \"interpreter\"\n");
+    fprintf(stderr, "\t--diff-quirk name  - toggle a quirk (see --quirk) for the second engine only\n");
+    fprintf(stderr, "\t--diff-keys N      - with --diff, press a pseudo-random key on both sides every N fields\n");
+    fprintf(stderr, "\t--pack file.pack   - load ROM.o8 by program name from a pack written by \"launcher --pack\",\n");
+    fprintf(stderr, "\t                     with its platform, quirks, rate, colors, and rotation unless given here\n");
+    fprintf(stderr, "\t--analyze          - print the ROM's basic blocks, jump tables, code/data split, and\n");
+    fprintf(stderr, "\t                     extension opcodes (cached under ~/.cache/xochip)\n");
+    fprintf(stderr, "\t--perf-counters    - measure host cycles, instructions, branch and cache misses around\n");
+    fprintf(stderr, "\t                     emulation and redraw (Linux only) and report them at exit\n");
     fprintf(stderr, "\t--wait             - wait for a keypress before starting simulation\n");
     fprintf(stderr, "\t--rot amount       - emulate rotating the screen; amount may be 0, 90, 180, or 270\n");
     fprintf(stderr, "\t--quirk name       - enable SCHIP quirk\n");
@@ -1747,14 +2061,25 @@ void usage(const char *name)
     fprintf(stderr, "\t                     \"loadstore\" : multi-register Vx load/store doesn't change I \n");
     fprintf(stderr, "\t                     \"vforder\" : assign flag to VF before storing ALU result\n");
     fprintf(stderr, "\t                     \"logic\" : clear VF at the end of logic ALU operations\n");
+    fprintf(stderr, "\t                     \"vblank\" : sprite draws wait for the next 60Hz field\n");
     fprintf(stderr, "\t--debug name       - enable debugging flag by name\n");
-    fprintf(stderr, "\t                     \"state\" : dump the state of the CPU before each instruction\n");
-    fprintf(stderr, "\t                     \"asm\" : disassemble each instruction\n");
+    fprintf(stderr, "\t                     \"state\" : trace CPU state for each instruction (same as --trace xochip.trace)\n");
+    fprintf(stderr, "\t                     \"asm\" : trace each instruction (same as --trace xochip.trace)\n");
     fprintf(stderr, "\t                     \"draw\" : print sprite draw coordinates\n");
     fprintf(stderr, "\t                     \"insn\" : stop execution on unsupported instruction\n");
     fprintf(stderr, "\t                     \"keys\" : dump some debugging information about keypresses\n");
+    fprintf(stderr, "\t                     \"audio\" : report audio latency, queue depth, underruns, and buffer adjustments\n");
+    fprintf(stderr, "\t                     \"timing\" : print a histogram of frame pacing wakeup jitter at exit\n");
+    fprintf(stderr, "\t--audio-priority   - run the audio output thread at elevated (realtime) priority\n");
+    fprintf(stderr, "\t--audio-latency MIN MAX - keep audio buffering latency between MIN and MAX milliseconds\n");
+    fprintf(stderr, "\t--audio-rate N     - output audio at N samples per second (default %d)\n", AOSamplingRate);
 }
 
+static_assert(((int)PACK_PLATFORM_CHIP8 == CHIP8) && ((int)PACK_PLATFORM_SCHIP == SCHIP_1_1) && ((int)PACK_PLATFORM_XOCHIP == XOCHIP), "pack platforms must match ChipPlatform");
+static_assert((PACK_QUIRK_SHIFT == QUIRKS_SHIFT) && (PACK_QUIRK_LOAD_STORE == QUIRKS_LOAD_STORE) && (PACK_QUIRK_JUMP == QUIRKS_JUMP) &&
+    (PACK_QUIRK_CLIP == QUIRKS_CLIP) && (PACK_QUIRK_VFORDER == QUIRKS_VFORDER) && (PACK_QUIRK_LOGIC == QUIRKS_LOGIC) &&
+    (PACK_QUIRK_VBLANK == QUIRKS_VBLANK), "pack quirks must match QUIRKS_ values");
+
 std::map<std::string, uint32_t> keywordsToQuirkValues = {
     {"shift", QUIRKS_SHIFT},
     {"loadstore", QUIRKS_LOAD_STORE},
@@ -1762,6 +2087,7 @@ std::map<std::string, uint32_t> keywordsToQuirkValues = {
     {"clip", QUIRKS_CLIP},
     {"vforder", QUIRKS_VFORDER},
     {"logic", QUIRKS_LOGIC},
+    {"vblank", QUIRKS_VBLANK},
 };
 
 int main(int argc, char **argv)
@@ -1776,6 +2102,35 @@ int main(int argc, char **argv)
     uint32_t quirks = QUIRKS_NONE;
     std::map<int,vec3ub> colorTable;
     bool paused = false;
+    bool elevatedAudioPriority = false;
+    bool turbo = false;
+    int fastForwardMultiple = 4;
+    const char *statsFilename = nullptr;
+    int profileSamplesPerSecond = 0;
+    const char *traceFilename = nullptr;
+    const char *videoFilename = nullptr;
+    const char *audioFilename = nullptr;
+    bool measurePerfCounters = false;
+    bool analyzeROMImage = false;
+    const char *packFilename = nullptr;
+    bool platformSpecified = false;
+    bool rotationSpecified = false;
+    bool rateSpecified = false;
+    int debug = 0;
+    int hostInstances = 0;
+    uint64_t hostFields = 0;
+    uint64_t hashFields = 0;
+    const char *hashFilename = nullptr;
+    const char *goldenFilename = nullptr;
+    bool hashState = false;
+    uint64_t diffFields = 0;
+    std::string diffEngine = "lockstep";
+    uint32_t diffQuirkToggles = 0;
+    int diffKeyPeriod = 0;
+    int lockstepLanes = 0;
+    int minimumAudioLatency = 10;
+    int maximumAudioLatency = 200;
+    int audioRate = AOSamplingRate;
 
     while((argc > 0) && (argv[0][0] == '-')) {
 	if(strcmp(argv[0], "--color") == 0) {
@@ -1798,8 +2153,10 @@ int main(int argc, char **argv)
             }
             if(strcmp(argv[1], "schip") == 0) {
                 platform = SCHIP_1_1;
+                platformSpecified = true;
             } else if(strcmp(argv[1], "xochip") == 0) {
                 platform = XOCHIP;
+                platformSpecified = true;
             } else {
                 fprintf(stderr, "unknown platform name \"%s\".\n", argv[1]);
                 usage(progname);
@@ -1814,6 +2171,7 @@ int main(int argc, char **argv)
                 exit(EXIT_FAILURE);
             }
             int angle = atoi(argv[1]);
+            rotationSpecified = true;
             switch(angle) {
                 case 0: rotation = ROT_0; break;
                 case 90: rotation = ROT_90; break;
@@ -1858,6 +2216,254 @@ int main(int argc, char **argv)
             fprintf(stderr, "debug value now 0x%02X\n", debug);
             argv += 2;
             argc -= 2;
+        } else if(strcmp(argv[0], "--audio-priority") == 0) {
+            elevatedAudioPriority = true;
+            argv += 1;
+            argc -= 1;
+        } else if(strcmp(argv[0], "--audio-latency") == 0) {
+            if(argc < 3) {
+                fprintf(stderr, "--audio-latency option requires minimum and maximum latency in milliseconds.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            minimumAudioLatency = atoi(argv[1]);
+            maximumAudioLatency = atoi(argv[2]);
+            if((minimumAudioLatency <= 0) || (maximumAudioLatency < minimumAudioLatency)) {
+                fprintf(stderr, "audio latency bounds must satisfy 0 < MIN <= MAX.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 3;
+            argc -= 3;
+        } else if(strcmp(argv[0], "--audio-rate") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--audio-rate option requires a rate in samples per second.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            audioRate = atoi(argv[1]);
+            if((audioRate < 1000) || (audioRate > MaximumAudioRate)) {
+                fprintf(stderr, "audio rate must be between 1000 and %d.\n", MaximumAudioRate);
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--stats") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--stats option requires an output filename.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+#ifndef XOCHIP_STATS
+            fprintf(stderr, "--stats requires building with XOCHIP_STATS enabled.\n");
+            exit(EXIT_FAILURE);
+#endif
+            statsFilename = argv[1];
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--record-video") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--record-video option requires an output filename.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            videoFilename = argv[1];
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--record-audio") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--record-audio option requires an output filename.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            audioFilename = argv[1];
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--profile") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--profile option requires a sampling rate in samples per emulated second.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            profileSamplesPerSecond = atoi(argv[1]);
+            if(profileSamplesPerSecond < 1) {
+                fprintf(stderr, "profile sampling rate must be at least 1.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--trace") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--trace option requires an output filename.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            traceFilename = argv[1];
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--frames") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--frames option requires a field count.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            hashFields = strtoull(argv[1], nullptr, 0);
+            if(hashFields < 1) {
+                fprintf(stderr, "--frames field count must be at least 1.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--hash") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--hash option requires an output filename.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            hashFilename = argv[1];
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--hash-state") == 0) {
+            hashState = true;
+            argv += 1;
+            argc -= 1;
+        } else if(strcmp(argv[0], "--golden") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--golden option requires a hash filename.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            goldenFilename = argv[1];
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--diff") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--diff option requires a field count.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            diffFields = strtoull(argv[1], nullptr, 0);
+            if(diffFields < 1) {
+                fprintf(stderr, "--diff field count must be at least 1.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--diff-engine") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--diff-engine option requires an engine name.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            diffEngine = argv[1];
+            if((diffEngine != "lockstep") && (diffEngine != "interpreter")) {
+                fprintf(stderr, "unknown engine \"%s\".\n", argv[1]);
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--diff-quirk") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--diff-quirk option requires a quirk keyword.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            std::string quirkKeyword = argv[1];
+            if(keywordsToQuirkValues.count(quirkKeyword) == 0) {
+                fprintf(stderr, "unknown quirk keyword \"%s\".\n", argv[1]);
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            diffQuirkToggles ^= keywordsToQuirkValues.at(quirkKeyword);
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--diff-keys") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--diff-keys option requires a period in fields.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            diffKeyPeriod = atoi(argv[1]);
+            if(diffKeyPeriod < 1) {
+                fprintf(stderr, "--diff-keys period must be at least 1.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 2;
+            argc -= 2;
+        } else if(strcmp(argv[0], "--host") == 0) {
+            if(argc < 3) {
+                fprintf(stderr, "--host option requires an instance count and a field count.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            hostInstances = atoi(argv[1]);
+            hostFields = strtoull(argv[2], nullptr, 0);
+            if((hostInstances < 1) || (hostFields < 1)) {
+                fprintf(stderr, "--host instance and field counts must be at least 1.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 3;
+            argc -= 3;
+
+        } else if(strcmp(argv[0], "--lockstep") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--lockstep option requires a batch size.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            lockstepLanes = atoi(argv[1]);
+            if(lockstepLanes < 1) {
+                fprintf(stderr, "--lockstep batch size must be at least 1.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 2;
+            argc -= 2;
+
+        } else if(strcmp(argv[0], "--pack") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--pack option requires a ROM pack filename.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            packFilename = argv[1];
+            argv += 2;
+            argc -= 2;
+
+        } else if(strcmp(argv[0], "--analyze") == 0) {
+            analyzeROMImage = true;
+            argv += 1;
+            argc -= 1;
+
+        } else if(strcmp(argv[0], "--perf-counters") == 0) {
+            measurePerfCounters = true;
+            argv += 1;
+            argc -= 1;
+        } else if(strcmp(argv[0], "--turbo") == 0) {
+            turbo = true;
+            argv += 1;
+            argc -= 1;
+        } else if(strcmp(argv[0], "--fast-forward") == 0) {
+            if(argc < 2) {
+                fprintf(stderr, "--fast-forward option requires a speed multiple.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            fastForwardMultiple = atoi(argv[1]);
+            if(fastForwardMultiple < 1) {
+                fprintf(stderr, "fast-forward multiple must be at least 1.\n");
+                usage(progname);
+                exit(EXIT_FAILURE);
+            }
+            argv += 2;
+            argc -= 2;
         } else if(strcmp(argv[0], "--wait") == 0) {
             paused = true;
             argv += 1;
@@ -1869,6 +2475,7 @@ int main(int argc, char **argv)
                 exit(EXIT_FAILURE);
             }
             ticksPerField = atoi(argv[1]);
+            rateSpecified = true;
             argv += 2;
             argc -= 2;
         } else if(
@@ -1890,15 +2497,142 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    Clock systemClock(std::lcm(AOSamplingRate, ticksPerField * FieldsPerSecond));
+    ROMPack pack;
+    const PackEntry *packEntry = nullptr;
+    if(packFilename != nullptr) {
+        if(!pack.open(packFilename)) {
+            fprintf(stderr, "couldn't open ROM pack \"%s\"\n", packFilename);
+            exit(EXIT_FAILURE);
+        }
+        packEntry = pack.find(argv[0]);
+        if(packEntry == nullptr) {
+            fprintf(stderr, "no program \"%s\" in ROM pack \"%s\"\n", argv[0], packFilename);
+            exit(EXIT_FAILURE);
+        }
+        if(!platformSpecified) {
+            platform = (ChipPlatform)packEntry->platform;
+        }
+        if(!rateSpecified && (packEntry->ticksPerField != 0)) {
+            ticksPerField = packEntry->ticksPerField;
+        }
+        if(!rotationSpecified) {
+            rotation = (DisplayRotation)((packEntry->rotation / 90) % 4);
+        }
+        quirks |= packEntry->quirks;
+        for(int i = 0; i < 4; i++) {
+            if((packEntry->colorsSet & (1 << i)) && (colorTable.count(i) == 0)) {
+                uint32_t c = packEntry->colors[i];
+                colorTable[i] = vec3ubFromInts((c >> 16) & 0xff, (c >> 8) & 0xff, c & 0xff);
+            }
+        }
+    }
+
+    Clock systemClock(SystemClockRate);
+
+    Memory memory(platform);
+
+    MappedFile romFile;
+    const uint8_t *romData;
+    size_t romSize;
+    if(packEntry != nullptr) {
+        romData = pack.image(*packEntry);
+        romSize = packEntry->size;
+    } else {
+        if(!romFile.open(argv[0])) {
+            fprintf(stderr, "couldn't open ROM \"%s\": %s\n", argv[0], strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        romData = romFile.data;
+        romSize = romFile.size;
+    }
+    if(romSize == 0) {
+        fprintf(stderr, "ROM \"%s\" is empty\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if(!memory.load(0x200, romData, romSize)) {
+        fprintf(stderr, "ROM \"%s\" is %zu bytes but at most %zu fit in this platform's memory above 0x200\n",
+            argv[0], romSize, memory.addressSpaceSize() - 0x200);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t romHash = hashROM(romData, romSize);
+
+    if(analyzeROMImage) {
+        bool wasCached;
+        ROMAnalysis analysis = analyzeROMCached(romData, romSize, romHash, 0x200, &wasCached);
+        printf("ROM analysis%s:\n", wasCached ? " (cached)" : "");
+        analysis.print(stdout);
+        fflush(stdout);
+        if((analysis.extensionOpcodes & XOCHIPExtensionOpcodes) && (platform != XOCHIP)) {
+            fprintf(stderr, "warning: ROM uses XO-CHIP opcodes; try --platform xochip\n");
+        } else if((analysis.extensionOpcodes & SCHIPExtensionOpcodes) && (platform == CHIP8)) {
+            fprintf(stderr, "warning: ROM uses SCHIP opcodes; try --platform schip\n");
+        }
+    }
+
+    const int cpuClockRate = ticksPerField * FieldsPerSecond;
+
+    if((lockstepLanes > 0) && (hostInstances == 0)) {
+        fprintf(stderr, "--lockstep requires --host.\n");
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    if(((hashFilename != nullptr) || (goldenFilename != nullptr) || hashState) && (hashFields == 0)) {
+        fprintf(stderr, "--hash, --hash-state, and --golden require --frames.\n");
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    if((diffFields > 0) && ((hashFields > 0) || (hostInstances > 0) || (videoFilename != nullptr) || (audioFilename != nullptr))) {
+        fprintf(stderr, "--diff can't be used with --frames, --host, --record-video, or --record-audio.\n");
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    if((hashFields > 0) && ((hostInstances > 0) || (videoFilename != nullptr) || (audioFilename != nullptr))) {
+        fprintf(stderr, "--frames can't be used with --host, --record-video, or --record-audio.\n");
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    if(((videoFilename != nullptr) || (audioFilename != nullptr)) && (hostInstances > 0)) {
+        fprintf(stderr, "--record-video and --record-audio can't be used with --host.\n");
+        usage(progname);
+        exit(EXIT_FAILURE);
+    }
+
+    if(hostInstances > 0) {
+        runHost(memory, platform, quirks, cpuClockRate, systemClock, debug, hostInstances, hostFields, lockstepLanes);
+        exit(EXIT_SUCCESS);
+    }
+
+    if(diffFields > 0) {
+        bool agreed = runDiff(memory, platform, quirks, quirks ^ diffQuirkToggles, diffEngine, cpuClockRate, systemClock, debug, diffFields, diffKeyPeriod);
+        exit(agreed ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    if(hashFields > 0) {
+        bool matched = runHashed(memory, platform, quirks, ticksPerField, systemClock, debug, romHash, hashFields, hashFilename, goldenFilename, hashState);
+        exit(matched ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    // Opened before the interface so it can run without an audio device
+    std::unique_ptr<AudioRecorder> audioRecorder;
+    if(audioFilename != nullptr) {
+        audioRecorder = std::make_unique<AudioRecorder>();
+        if(!audioRecorder->open(audioFilename, audioRate)) {
+            fprintf(stderr, "couldn't open \"%s\" for recording audio\n", audioFilename);
+            exit(EXIT_FAILURE);
+        }
+    }
 
 #ifdef XCODE_MISSING_FILESYSTEM_FOR_YEARS
     char *base = strdup(argv[0]);
-    Interface interface(platform, basename(base), rotation, systemClock);
+    Interface interface(platform, basename(base), rotation, systemClock, elevatedAudioPriority, minimumAudioLatency, maximumAudioLatency, debug & DEBUG_AUDIO, audioRate, audioRecorder.get());
     free(base);
 #else
     std::filesystem::path base(argv[0]);
-    Interface interface(platform, base.filename().string(), rotation, systemClock);
+    Interface interface(platform, base.filename().string(), rotation, systemClock, elevatedAudioPriority, minimumAudioLatency, maximumAudioLatency, debug & DEBUG_AUDIO, audioRate, audioRecorder.get());
 #endif
 
     if(!interface.succeeded) {
@@ -1906,65 +2640,183 @@ int main(int argc, char **argv)
         exit(EXIT_FAILURE);
     }
 
-    Memory memory(platform);
-
     for(const auto& [index, color] : colorTable) {
         interface.colorTable[index] = color;
     }
 
-    FILE *fp = fopen(argv[0], "rb");
-    fseek(fp, 0, SEEK_END);
-    long size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    for(uint16_t i = 0; i < size; i++) {
-        uint8_t byte;
-        fread(&byte, 1, 1, fp);
-        memory.write(0x200 + i, byte);
+    std::unique_ptr<VideoRecorder> videoRecorder;
+    if(videoFilename != nullptr) {
+        videoRecorder = std::make_unique<VideoRecorder>();
+        if(!videoRecorder->open(videoFilename, interface.colorTable)) {
+            fprintf(stderr, "couldn't open \"%s\" for recording video\n", videoFilename);
+            exit(EXIT_FAILURE);
+        }
     }
-    fclose(fp);
 
-    const int cpuClockRate = ticksPerField * FieldsPerSecond;
     Chip8Interpreter<Memory,Interface> chip8(0x200, platform, quirks, cpuClockRate, systemClock);
+    chip8.debug = debug;
+
+    if((traceFilename == nullptr) && (debug & (DEBUG_STATE | DEBUG_ASM))) {
+        traceFilename = "xochip.trace";
+    }
+    std::unique_ptr<TraceBuffer> trace;
+    if(traceFilename != nullptr) {
+        trace = std::make_unique<TraceBuffer>(TraceRecordsKept, systemClock.rate);
+        chip8.trace = trace.get();
+        installCrashTraceDump(trace.get(), traceFilename);
+    }
 
-    std::chrono::time_point<std::chrono::system_clock> interfaceThen = std::chrono::system_clock::now();
+    std::unique_ptr<PCProfiler> profiler;
+    if(profileSamplesPerSecond > 0) {
+        profiler = std::make_unique<PCProfiler>(systemClock, profileSamplesPerSecond, chip8.pc);
+        chip8.profiler = profiler.get();
+    }
 
-    bool done = false;
-    while(!done) {
+    // Emulation runs on its own thread so that a slow compositor or vsync
+    // stall in the window system never delays CPU emulation or audio.  The
+    // window stays on the main thread, which some platforms require, and
+    // becomes the render thread.
+    std::atomic<bool> emulationDone{false};
+    int emulationExitStatus = EXIT_SUCCESS;
+
+    FramePacer pacer(FieldsPerSecond);
+    SpeedMeter speedMeter;
+
+    // Counters only count the thread that opens them, so the emulation
+    // group is opened on the emulation thread and the redraw group here.
+    PerfCounterGroup emulationCounters;
+    PerfCounterGroup redrawCounters;
+    uint64_t emulatedFields = 0;
+    if(measurePerfCounters && redrawCounters.open()) {
+        interface.redrawCounters = &redrawCounters;
+    }
 
-        if(paused) {
-            if(interface.anyKeyPressed()) {
-                paused = false;
-            }
+    std::thread emulationThread([&]() {
+        if(measurePerfCounters) {
+            emulationCounters.open();
         }
+        auto lastPublish = std::chrono::steady_clock::now();
+        // Only the first unsupported instruction writes the trace; a ROM
+        // that keeps hitting one would otherwise rewrite it every field.
+        bool unsupportedTraceDumped = false;
+        while(!interface.closed) {
+
+            bool fastForward = interface.fastForwardHeld;
+            interface.audioMuted = turbo || fastForward;
+
+            if(paused) {
+                if(interface.anyKeyPressed()) {
+                    paused = false;
+                }
+            }
+
+            // Only a shortfall while fields are being emulated is a real underrun
+            interface.audio.setIdle(interface.audioMuted || paused);
 
-        if(!paused) {
-            uint64_t newClock = systemClock.clocks + systemClock.rate / 240; // XXX I dunno, 4 chunks of a 60Hz tick???
-            while(systemClock.clocks < newClock) {
-                uint64_t nextCPU = chip8.calculateNextActivity();
-                uint64_t nextInterface = interface.calculateNextActivity();
-                // XXX debug printf("cpu : %llu, interface: %llu\n", nextCPU, nextInterface);
-                if(nextCPU < nextInterface) {
-                    // XXX debug printf("do cpu\n");
-                    Chip8Interpreter<Memory,Interface>::StepResult result = chip8.updatePastClock(memory, interface, systemClock);
-                    if((result == Chip8Interpreter<Memory,Interface>::UNSUPPORTED_INSTRUCTION) && (debug & DEBUG_FAIL_UNSUPPORTED_INSN)) {
+            if(!paused) {
+                if(measurePerfCounters) {
+                    emulationCounters.start();
+                }
+                uint64_t fieldEnd = systemClock.clocks + SystemClocksPerField;
+                while(emulateUntil(chip8, memory, interface, systemClock, fieldEnd) == Chip8Interpreter<Memory,Interface>::UNSUPPORTED_INSTRUCTION) {
+                    if(trace && !unsupportedTraceDumped) {
+                        dumpTrace(*trace, traceFilename);
+                        unsupportedTraceDumped = true;
+                    }
+                    if(debug & DEBUG_FAIL_UNSUPPORTED_INSN) {
                         // XXX debug printf("exit on unsupported instruction\n");
-                        exit(EXIT_FAILURE);
+                        emulationExitStatus = EXIT_FAILURE;
+                        interface.audio.setIdle(true);
+                        emulationDone = true;
+                        return;
                     }
-                    systemClock.clocks = nextCPU;
-                } else {
-                    // XXX debug printf("do interface\n");
-                    interface.updatePastClock(systemClock);
-                    systemClock.clocks = nextInterface;
                 }
+                if(measurePerfCounters) {
+                    emulationCounters.stop();
+                }
+                emulatedFields++;
+                if(videoRecorder) {
+                    videoRecorder->addFrame(interface.display);
+                }
+            }
+
+            if(interface.displayChanged) {
+                // Faster than real time, there's no point handing over more frames than can be shown
+                auto now = std::chrono::steady_clock::now();
+                if(!interface.audioMuted || (now - lastPublish >= std::chrono::microseconds(1000000 / UIUpdateFrequency))) {
+                    interface.publishFrame();
+                    lastPublish = now;
+                }
+            }
+
+            if(trace && traceDumpRequested.exchange(false)) {
+                dumpTrace(*trace, traceFilename);
+            }
+
+            if(!paused) {
+                speedMeter.field(turbo || fastForward);
+            }
+
+            // Rate control would make a recording depend on the host's audio clock
+            if(!interface.audioMuted && !audioRecorder) {
+                interface.adjustAudioRate();
             }
+            if(!turbo || paused) {
+                pacer.waitForNextField(fastForward ? fastForwardMultiple : 1);
+            }
+        }
+        interface.audio.setIdle(true);
+        emulationDone = true;
+    });
+
+    auto interfaceNext = std::chrono::steady_clock::now();
+    while(!emulationDone) {
+        if(!interface.iterate()) {
+            break;
         }
+        interfaceNext += std::chrono::microseconds(1000000 / UIUpdateFrequency);
+        std::this_thread::sleep_until(interfaceNext);
+    }
+
+    interface.closed = true;
+    emulationThread.join();
+    interface.audio.close();
+    if(audioRecorder) {
+        // The samples in the partly filled output buffer
+        audioRecorder->add(interface.audioOutputBuffer, interface.nextOutputSample % interface.audioOutputBufferSize);
+        if(!audioRecorder->close()) {
+            fprintf(stderr, "couldn't write audio to \"%s\"\n", audioFilename);
+        }
+    }
+    if(videoRecorder && !videoRecorder->close()) {
+        fprintf(stderr, "couldn't write video to \"%s\"\n", videoFilename);
+    }
 
-        std::chrono::time_point<std::chrono::system_clock> interfaceNow = std::chrono::system_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::duration<float>>(interfaceNow - interfaceThen);
-        float dt = elapsed.count();
-        if(dt > (.9f * 1.0f / UIUpdateFrequency)) {
-            done = !interface.iterate();
-            interfaceThen = interfaceNow;
+    if(debug & DEBUG_AUDIO) {
+        interface.audio.printStatistics();
+        interface.printAudioRateStatistics();
+    }
+    if(debug & DEBUG_TIMING) {
+        pacer.printStatistics();
+    }
+    if(turbo || (debug & DEBUG_TIMING)) {
+        speedMeter.printStatistics();
+    }
+    if(measurePerfCounters) {
+        emulationCounters.printReport("emulation", emulatedFields / (double)FieldsPerSecond, chip8.insnNumber);
+        redrawCounters.printReport("redraw", emulatedFields / (double)FieldsPerSecond, chip8.insnNumber);
+    }
+    if(trace && (debug & (DEBUG_STATE | DEBUG_ASM))) {
+        dumpTrace(*trace, traceFilename);
+    }
+    if(profiler) {
+        profiler->printReport(memory, 20, romHash);
+    }
+    if(statsFilename != nullptr) {
+        if(!chip8.statistics.writeJSON(statsFilename, romHash)) {
+            fprintf(stderr, "couldn't write statistics to \"%s\"\n", statsFilename);
         }
     }
+
+    exit(emulationExitStatus);
 }